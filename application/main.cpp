@@ -1,44 +1,249 @@
 /*! \file
  * The Simple Droid Motion Planner (SDMP) Command Line Interface
  *
- * TODO Write me, with examples
+ * Every command reads a `MotionPlan` from standard input, as JSON, or,
+ * after the option `--format=binary`, in the Protocol Buffers wire format,
+ * which is much faster to read and write for long lists of obstacles:
+ *
+ * - `sdmp gnuplot [X_MIN Y_MIN X_MAX Y_MAX]` prints `GnuPlot` commands to plot
+ *   the plan, or only the given window of it
+ * - `sdmp svg [X_MIN Y_MIN X_MAX Y_MAX]` prints the plan, or only the given
+ *   window of it, as an `SVG` image
+ * - `sdmp find_path X_INIT Y_INIT X_GOAL Y_GOAL TIMEOUT_SECONDS LENGTH_THRESHOLD [ALGORITHM [SIMPLIFY_SECONDS]]`
+ *   prints the plan, with its new path, as JSON, where `ALGORITHM` is one of
+ *   `rrt_star` (the default), `visibility_graph`, `rrt_connect` (fastest to a
+ *   first path), `informed_rrt_star`, `bit_star`, or `hybrid` (`rrt_connect`,
+ *   then `informed_rrt_star` to refine its path), and `SIMPLIFY_SECONDS` is
+ *   taken out of the timeout to simplify the path found (zero by default)
+ * - `sdmp find_path_report` takes the same arguments as `find_path`, but
+ *   prints a `PathResult` as JSON, with the path and a `PlannerReport` of
+ *   what the planner did (its timings, tree size, validity checks, and
+ *   the cost of each improvement over time)
+ * - `sdmp find_path_stream` takes the same arguments as `find_path`, but
+ *   reads many plans, one JSON plan per line, or length-delimited binary
+ *   ones, and prints each, with its new path (or none), as soon as it is
+ *   planned, in the same format
+ * - `sdmp find_path_anytime` takes the same arguments as `find_path`, but
+ *   prints each improved path as a line of JSON `PathImprovement`, as soon as
+ *   it is found, and stops with the best path so far on an interrupt (Ctrl-C)
+ * - `sdmp batch_find_path QUERIES THREADS` plans every newline-delimited JSON
+ *   `PathQuery` in the file `QUERIES`, printing each `PathResult` as a line
+ *   of JSON as soon as it is ready (so not necessarily in order)
+ * - `sdmp find_fleet_paths FLEET THREADS TIMEOUT_SECONDS LENGTH_THRESHOLD`
+ *   plans every newline-delimited JSON `FleetDroid` in the file `FLEET`,
+ *   in order of priority, around each other, and prints the `FleetResult`
+ *   of each, in order, with its timed path, as a line of JSON
+ * - `sdmp save_flat_map FILE` saves the map of the plan (but not its path)
+ *   as a flat map file, which opens in a fraction of the time, for huge maps
+ * - `sdmp load_flat_map FILE` ignores the standard input, and prints the plan
+ *   of the flat map file
+ *
+ * After the option `--path_cache=FILE`, before or after `--format`, the
+ * `find_path` commands and `serve` answer repeated queries on the same map
+ * from a cache of their paths, which is loaded from `FILE`, if it exists,
+ * and saved back to it on exit.
+ *
+ * With `--format=binary`, the output is binary too: a single message, or,
+ * for the commands that print many, length-delimited ones (each prefixed
+ * with its size, as a varint), as are the queries of `batch_find_path`,
+ * and the droids of `find_fleet_paths`.
+ * The `serve` command has its own `FRAMING` instead.
+ *
+ * The `serve` and `client` commands read requests instead:
+ *
+ * - `sdmp serve FRAMING THREADS [SOCKET]` answers each `ServeRequest`, with a
+ *   `ServeResponse`, from standard input, or from every connection to the Unix
+ *   domain socket `SOCKET`, until the end of the input, or an interrupt, where
+ *   `FRAMING` is `json` (a message per line) or `delimited` (binary messages,
+ *   each prefixed with its size), and `THREADS` is zero for one per hardware
+ *   thread; maps are cached, so later requests only need their `map_id`
+ * - `sdmp client SOCKET` sends its standard input to a `serve` socket, and
+ *   prints the responses
  *
  */
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
 #include <iostream>
 #include <fstream>
-#include <sstream>
+#include <iterator>
+#include <vector>
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+#include <google/protobuf/util/json_util.h>
 
 #include "sdmp.hpp"
+#include "server.hpp"
 
 using namespace std;
 using namespace sdmp;
+using namespace sdmp::application;
 
 // TODO Use a proper argument parsing library, such as "boost::program_options"
 
 namespace {
 
+  atomic<bool> interrupted(false);
+
+  bool binary = false; // as set by `--format`
+
+  bb8::simple::PathCachePtr path_cache; // as set by `--path_cache`
+
+  // Loads the path cache from the file, or starts an empty one if there is no such file
+  bool path_cache_from_file(const string &filename) {
+    ifstream file(filename, ios::binary);
+    path_cache = file ? bb8::simple::load_path_cache(file) : bb8::simple::create_path_cache();
+    return path_cache != nullptr;
+  }
+
+  // Saves the path cache back to its file, however the command returns
+  struct PathCacheSaver {
+    string filename;
+    ~PathCacheSaver() {
+      if (path_cache == nullptr || filename.empty()) return;
+      ofstream file(filename, ios::binary);
+      if (file) bb8::simple::save_path_cache(*path_cache, file);
+    }
+  };
+
+  // Reads all of standard input, without copying it more than JSON parsing requires
   MotionPlanPtr motion_plan_from_std_cin() {
-    stringstream buffer;
-    while(cin >> buffer.rdbuf());
-    return load_json(buffer.str());
+    if (binary) return load_binary(cin);
+    return load_json(string(istreambuf_iterator<char>(cin), istreambuf_iterator<char>()));
+  }
+
+  // Prints a message as a line of JSON, or in binary, prefixed with its size if it is one of many
+  void print(const google::protobuf::Message &message, bool one_of_many) {
+    if (binary) {
+      if (one_of_many) google::protobuf::util::SerializeDelimitedToOstream(message, &cout);
+      else message.SerializeToOstream(&cout);
+      cout.flush();
+    } else {
+      string json;
+      google::protobuf::util::MessageToJsonString(message, &json);
+      cout << json << endl;
+    }
+  }
+
+  void print(const MotionPlan &motion_plan, bool one_of_many) {
+    if (binary) {
+      if (one_of_many) write_delimited(motion_plan, cout);
+      else motion_plan.SerializeToOstream(&cout);
+      cout.flush();
+    } else {
+      cout << save_json(motion_plan) << endl;
+    }
+  }
+
+  // Reads the optional `[ALGORITHM [SIMPLIFY_SECONDS]]` arguments of the `find_path` commands
+  bool planner_options_from_arguments(int argc, char *argv[], bb8::simple::PlannerOptions &options) {
+    if (argc > 8 && !algorithm_from_string(argv[8], options.algorithm)) return false;
+    if (argc > 9) options.simplify_seconds = stod(argv[9]);
+    options.path_cache = path_cache.get();
+    return true;
+  }
+
+  // Reads newline-delimited JSON messages, such as `PathQuery`, skipping blank lines, or length-delimited binary ones
+  template <class Message>
+  bool messages_from_file(const string &filename, vector<Message> &messages) {
+    ifstream file(filename, ios::binary);
+    if (!file) return false;
+    if (binary) {
+      google::protobuf::io::IstreamInputStream stream(&file);
+      bool clean_eof = false;
+      for (;;) {
+        Message message;
+        if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(&message, &stream, &clean_eof)) return clean_eof;
+        messages.push_back(message);
+      }
+    }
+    string line;
+    while (getline(file, line)) {
+      if (line.find_first_not_of(" \t\r") == string::npos) continue;
+      Message message;
+      if (!google::protobuf::util::JsonStringToMessage(line, &message).ok()) return false;
+      messages.push_back(message);
+    }
+    return true;
   }
 
 }
 
 int main(int argc, char *argv[]) {
 
-  if (argc == 2 && string(argv[1]) == "gnuplot" ) {
+  // Take the options out of the arguments, so that the commands see only their own
+
+  PathCacheSaver path_cache_saver;
+
+  while (argc > 1 && string(argv[1]).rfind("--", 0) == 0) {
+    const string option(argv[1]);
+    if (option.rfind("--format=", 0) == 0) {
+      const string format = option.substr(9);
+      if (format != "json" && format != "binary") return -1;
+      binary = format == "binary";
+    } else if (option.rfind("--path_cache=", 0) == 0) {
+      path_cache_saver.filename = option.substr(13);
+      if (path_cache_saver.filename.empty() || !path_cache_from_file(path_cache_saver.filename)) return -1;
+    } else {
+      return -1;
+    }
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
+
+  if ((argc == 2 || argc == 6) && (string(argv[1]) == "gnuplot" || string(argv[1]) == "svg")) {
+
+    bb8::simple::Viewport viewport{};
+    if (argc == 6) viewport = {stod(argv[2]), stod(argv[3]), stod(argv[4]), stod(argv[5])};
+
+    // An empty, or not finite, window is refused before the map is read, as the export would refuse it
+    const bool is_window = isfinite(viewport.x_min) && isfinite(viewport.y_min) && isfinite(viewport.x_max) &&
+                           isfinite(viewport.y_max) && viewport.x_min < viewport.x_max && viewport.y_min < viewport.y_max;
+    if (argc == 6 && !is_window) return -1;
+
+    auto motion_plan = motion_plan_from_std_cin();
+    if (motion_plan == nullptr) return -1;
+
+    // Written as it is formatted, so that huge maps are never held in memory as text
+    const bb8::simple::Viewport *window = argc == 6 ? &viewport : nullptr;
+    const bool saved = string(argv[1]) == "svg" ? bb8::simple::save_svg(*motion_plan, cout, window)
+                                                : bb8::simple::save_gnuplot(*motion_plan, cout, window);
+
+    return saved ? 0 : -1;
+
+  }
+
+  if (argc == 3 && string(argv[1]) == "save_flat_map") {
 
     auto motion_plan = motion_plan_from_std_cin();
     if (motion_plan == nullptr) return -1;
 
-    cout << bb8::simple::save_gnuplot(*motion_plan);
+    ofstream file(argv[2], ios::binary);
+    if (!file || !bb8::simple::save_flat_map(*motion_plan, file)) return -1;
+
+    file.close();
+    return file ? 0 : -1;
+
+  }
+
+  if (argc == 3 && string(argv[1]) == "load_flat_map") {
+
+    const auto map = bb8::simple::open_flat_map(argv[2]);
+    if (map == nullptr) return -1;
+
+    print(*bb8::simple::to_motion_plan(*map), false);
     return 0;
 
   }
 
-  if (argc == 8 && string(argv[1]) == "find_path") {
+  if (argc >= 8 && argc <= 10 && string(argv[1]) == "find_path") {
+
+    bb8::simple::PlannerOptions options;
+    if (!planner_options_from_arguments(argc, argv, options)) return -1;
 
     auto motion_plan = motion_plan_from_std_cin();
     if (motion_plan == nullptr) return -1;
@@ -47,15 +252,171 @@ int main(int argc, char *argv[]) {
       stod(argv[2]), stod(argv[3]),
       stod(argv[4]), stod(argv[5]),
       stod(argv[6]),
-      stod(argv[7]));
+      stod(argv[7]),
+      options);
 
     if (failed) return -2;
 
-    cout << save_json(*motion_plan) << endl;
+    print(*motion_plan, false);
     return 0;
 
   }
 
+  if (argc >= 8 && argc <= 10 && string(argv[1]) == "find_path_report") {
+
+    bb8::simple::PlannerOptions options;
+    if (!planner_options_from_arguments(argc, argv, options)) return -1;
+
+    auto motion_plan = motion_plan_from_std_cin();
+    if (motion_plan == nullptr) return -1;
+
+    PathResult result;
+
+    result.set_status(bb8::simple::find_path(*motion_plan,
+      stod(argv[2]), stod(argv[3]),
+      stod(argv[4]), stod(argv[5]),
+      stod(argv[6]),
+      stod(argv[7]),
+      options,
+      result.mutable_report()));
+
+    *result.mutable_path() = motion_plan->path();
+
+    print(result, false);
+
+    return result.status() == 0 ? 0 : -2;
+
+  }
+
+  if (argc >= 8 && argc <= 10 && string(argv[1]) == "find_path_anytime") {
+
+    bb8::simple::PlannerOptions options;
+    if (!planner_options_from_arguments(argc, argv, options)) return -1;
+
+    auto motion_plan = motion_plan_from_std_cin();
+    if (motion_plan == nullptr) return -1;
+
+    const auto started = chrono::steady_clock::now();
+
+    // Print each improvement, flushed, so that it can be acted upon at once
+    options.improved_path_callback = [&started](const google::protobuf::RepeatedPtrField<Coordinates> &path, double length) {
+      PathImprovement improvement;
+      improvement.set_seconds(chrono::duration<double>(chrono::steady_clock::now() - started).count());
+      improvement.set_length(length);
+      *improvement.mutable_path() = path;
+      print(improvement, true);
+    };
+
+    // Stop refining on an interrupt, rather than exit, keeping the best path so far
+    options.cancel = &interrupted;
+    signal(SIGINT, [](int) { interrupted = true; });
+
+    const bool failed = bb8::simple::find_path(*motion_plan,
+      stod(argv[2]), stod(argv[3]),
+      stod(argv[4]), stod(argv[5]),
+      stod(argv[6]),
+      stod(argv[7]),
+      options);
+
+    return failed ? -2 : 0;
+
+  }
+
+  if (argc >= 8 && argc <= 10 && string(argv[1]) == "find_path_stream") {
+
+    bb8::simple::PlannerOptions options;
+    if (!planner_options_from_arguments(argc, argv, options)) return -1;
+
+    int failures = 0;
+
+    const auto plan = [&](MotionPlan &motion_plan) {
+      const bool failed = bb8::simple::find_path(motion_plan,
+        stod(argv[2]), stod(argv[3]),
+        stod(argv[4]), stod(argv[5]),
+        stod(argv[6]),
+        stod(argv[7]),
+        options);
+      if (failed) failures++;
+      print(motion_plan, true);
+    };
+
+    if (binary) {
+      MotionPlan motion_plan; // reused, so that its memory is too
+      MotionPlanReader reader(cin);
+      while (reader.read(motion_plan)) plan(motion_plan);
+      if (reader.failed()) return -1;
+    } else {
+      string line;
+      while (getline(cin, line)) {
+        if (line.find_first_not_of(" \t\r") == string::npos) continue;
+        auto motion_plan = load_json(line);
+        if (motion_plan == nullptr) return -1;
+        plan(*motion_plan);
+      }
+    }
+
+    return failures > 0 ? -2 : 0;
+
+  }
+
+  if (argc == 4 && string(argv[1]) == "batch_find_path") {
+
+    auto motion_plan = motion_plan_from_std_cin();
+    if (motion_plan == nullptr) return -1;
+
+    vector<PathQuery> queries;
+    if (!messages_from_file(argv[2], queries)) return -1;
+
+    // Stream each result as soon as it is ready
+    const auto results = bb8::simple::batch_find_path(*motion_plan, queries, stoul(argv[3]),
+      [](const PathResult &result) { print(result, true); });
+
+    if (results.size() != queries.size()) return -2;
+
+    return 0;
+
+  }
+
+  if (argc == 6 && string(argv[1]) == "find_fleet_paths") {
+
+    auto motion_plan = motion_plan_from_std_cin();
+    if (motion_plan == nullptr) return -1;
+
+    vector<FleetDroid> droids;
+    if (!messages_from_file(argv[2], droids)) return -1;
+
+    const auto results = bb8::simple::find_fleet_paths(*motion_plan, droids, stod(argv[4]), stod(argv[5]),
+      bb8::simple::PlannerOptions(), stoul(argv[3]));
+
+    if (results.size() != droids.size()) return -1;
+
+    bool failed = false;
+    for (const auto &result : results) {
+      print(result, true);
+      failed = failed || result.status() != 0;
+    }
+
+    return failed ? -2 : 0;
+
+  }
+
+  if ((argc == 4 || argc == 5) && string(argv[1]) == "serve") {
+
+    Framing framing;
+    if (!framing_from_string(argv[2], framing)) return -1;
+
+    const unsigned thread_count = stoul(argv[3]);
+
+    if (argc == 5) return serve(argv[4], framing, thread_count, path_cache.get());
+
+    return serve(cin, cout, framing, thread_count, path_cache.get());
+
+  }
+
+  if (argc == 3 && string(argv[1]) == "client") {
+    return client(argv[2]);
+  }
+
   return -3;
 
 }
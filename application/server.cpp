@@ -0,0 +1,703 @@
+#include "server.hpp"
+#include "obstacle_index.hpp"
+#include "planner_session.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <streambuf>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+#include <google/protobuf/util/json_util.h>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::application;
+using namespace sdmp::bb8::simple;
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  const size_t map_capacity = 64;     // the most recently used maps are kept
+  const size_t session_capacity = 16; // and, for each, the most recently idle sessions, whatever their options
+
+  string to_hex(uint64_t value) {
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+    return buffer;
+  }
+
+  // ------------------------------------------------------------------------
+
+  // A cached map, indexed once, when first planned in, with the most recently idle planner sessions for it
+  class Map {
+
+   public:
+
+    const MotionPlanPtr motion_plan;
+    const string hash;
+
+    Map(MotionPlanPtr motion_plan, string hash)
+        : motion_plan(move(motion_plan)), hash(move(hash)) { }
+
+    // An idle session with the given options, or a new one, or `nullptr` if the options are invalid
+    PlannerSessionPtr acquire(const PlannerOptions &options) {
+      {
+        lock_guard<mutex> lock(sessions_mutex);
+        const Key wanted = key(options);
+        const auto found = find_if(idle.begin(), idle.end(), [&](const auto &entry) { return entry.first == wanted; });
+        if (found != idle.end()) {
+          auto session = move(found->second);
+          idle.erase(found);
+          return session;
+        }
+      }
+      // A copy of the index of the map, rather than indexing it again, on a single thread as planning is
+      call_once(indexed, [this]() { obstacles = make_unique<detail::ObstacleIndex>(*motion_plan, 0.0, 1); });
+      return detail::create_planner_session(*motion_plan, *obstacles, options);
+    }
+
+    // Keeps the session for later, freeing the least recently idle one, if too many are
+    void release(const PlannerOptions &options, PlannerSessionPtr session) {
+      lock_guard<mutex> lock(sessions_mutex);
+      idle.emplace_front(key(options), move(session));
+      if (idle.size() > session_capacity) idle.pop_back();
+    }
+
+   private:
+
+    typedef tuple<int, double, bool> Key; // of the options that a session keeps
+
+    static Key key(const PlannerOptions &options) {
+      return Key(int(options.algorithm), options.simplify_seconds, options.smooth_path);
+    }
+
+    once_flag indexed;
+    unique_ptr<const detail::ObstacleIndex> obstacles;
+
+    mutex sessions_mutex;
+    list<pair<Key, PlannerSessionPtr>> idle; // most recently released first
+
+  };
+
+  // The maps, by content hash, and by name, keeping only the most recently used
+  class MapCache {
+
+   public:
+
+    // Caches the map, replacing any of the same name, and returns it
+    shared_ptr<Map> insert(MotionPlanPtr motion_plan, const string &name) {
+      lock_guard<mutex> lock(cache_mutex);
+      const string hash = to_hex(content_hash(*motion_plan));
+      auto found = by_hash.find(hash);
+      if (found == by_hash.end()) {
+        recent.push_front(make_shared<Map>(move(motion_plan), hash));
+        found = by_hash.emplace(hash, recent.begin()).first;
+        if (recent.size() > map_capacity) {
+          by_hash.erase(recent.back()->hash); // names of evicted maps are left to dangle
+          recent.pop_back();
+        }
+      }
+      recent.splice(recent.begin(), recent, found->second);
+      if (!name.empty()) names[name] = hash;
+      return recent.front();
+    }
+
+    // The map of the given name or hash, or `nullptr`
+    shared_ptr<Map> find(const string &id) {
+      lock_guard<mutex> lock(cache_mutex);
+      auto found = locate(id);
+      if (found == by_hash.end()) return nullptr;
+      recent.splice(recent.begin(), recent, found->second);
+      return recent.front();
+    }
+
+    bool forget(const string &id) {
+      lock_guard<mutex> lock(cache_mutex);
+      auto found = locate(id);
+      if (found == by_hash.end()) return false;
+      const string hash = found->first;
+      recent.erase(found->second);
+      by_hash.erase(found);
+      for (auto it = names.begin(); it != names.end();) {
+        it = it->second == hash ? names.erase(it) : next(it);
+      }
+      return true;
+    }
+
+   private:
+
+    typedef list<shared_ptr<Map>> Recent;
+
+    unordered_map<string, Recent::iterator>::iterator locate(const string &id) {
+      const auto name = names.find(id);
+      return by_hash.find(name != names.end() ? name->second : id);
+    }
+
+    mutex cache_mutex;
+    Recent recent; // most recently used first
+    unordered_map<string, Recent::iterator> by_hash;
+    unordered_map<string, string> names; // to hashes
+
+  };
+
+  // ------------------------------------------------------------------------
+
+  // A fixed pool of threads, running jobs in order of submission, whose
+  // queue is bounded, so that a fast reader cannot run far ahead of them
+  class WorkerPool {
+
+   public:
+
+    explicit WorkerPool(unsigned thread_count)
+        : capacity(4 * size_t(thread_count)) {
+      for (unsigned i = 0; i < thread_count; i++) workers.emplace_back(&WorkerPool::work, this);
+    }
+
+    ~WorkerPool() {
+      {
+        lock_guard<mutex> lock(jobs_mutex);
+        stopping = true;
+      }
+      ready.notify_all();
+      for (auto &worker : workers) worker.join();
+    }
+
+    void submit(function<void()> job) {
+      unique_lock<mutex> lock(jobs_mutex);
+      space.wait(lock, [this]() { return jobs.size() < capacity; });
+      jobs.push_back(move(job));
+      ready.notify_one();
+    }
+
+   private:
+
+    void work() {
+      for (;;) {
+        unique_lock<mutex> lock(jobs_mutex);
+        ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+        if (jobs.empty()) return;
+        auto job = move(jobs.front());
+        jobs.pop_front();
+        space.notify_one();
+        lock.unlock();
+        job();
+      }
+    }
+
+    const size_t capacity;
+
+    mutex jobs_mutex;
+    condition_variable ready, space;
+    deque<function<void()>> jobs;
+    bool stopping = false;
+
+    vector<thread> workers;
+
+  };
+
+  // ------------------------------------------------------------------------
+
+  // Reads and writes a file descriptor, such as a socket, through the standard streams
+  class FileDescriptorBuffer : public streambuf {
+
+   public:
+
+    explicit FileDescriptorBuffer(int fd) : fd(fd) {
+      setg(input, input, input);
+      setp(output, output + sizeof(output));
+    }
+
+    ~FileDescriptorBuffer() override { sync(); }
+
+   protected:
+
+    int_type underflow() override {
+      ssize_t n;
+      do n = ::read(fd, input, sizeof(input)); while (n < 0 && errno == EINTR);
+      if (n <= 0) return traits_type::eof();
+      setg(input, input, input + n);
+      return traits_type::to_int_type(*gptr());
+    }
+
+    int_type overflow(int_type c) override {
+      if (sync() != 0) return traits_type::eof();
+      if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+      }
+      return traits_type::not_eof(c);
+    }
+
+    int sync() override {
+      for (char *p = pbase(); p < pptr();) {
+        const ssize_t n = ::write(fd, p, size_t(pptr() - p));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+      }
+      setp(output, output + sizeof(output));
+      return 0;
+    }
+
+   private:
+
+    const int fd;
+    char input[1 << 16], output[1 << 16];
+
+  };
+
+  // ------------------------------------------------------------------------
+
+  // The responses of one connection, written whole, and flushed, one at a time
+  class Responses {
+
+   public:
+
+    Responses(ostream &out, Framing framing) : out(out), framing(framing) { }
+
+    void write(const ServeResponse &response) {
+      lock_guard<mutex> lock(out_mutex);
+      if (framing == Framing::delimited) {
+        google::protobuf::util::SerializeDelimitedToOstream(response, &out);
+      } else {
+        string json;
+        google::protobuf::util::MessageToJsonString(response, &json);
+        out << json << '\n';
+      }
+      out.flush();
+    }
+
+   private:
+
+    ostream &out;
+    const Framing framing;
+    mutex out_mutex;
+
+  };
+
+  // Counts the jobs of one connection, so that it can wait for them before closing
+  class Pending {
+
+   public:
+
+    void add() {
+      lock_guard<mutex> lock(count_mutex);
+      count++;
+    }
+
+    void done() {
+      lock_guard<mutex> lock(count_mutex);
+      if (--count == 0) idle.notify_all();
+    }
+
+    void wait() {
+      unique_lock<mutex> lock(count_mutex);
+      idle.wait(lock, [this]() { return count == 0; });
+    }
+
+   private:
+
+    mutex count_mutex;
+    condition_variable idle;
+    size_t count = 0;
+
+  };
+
+  // ------------------------------------------------------------------------
+
+  ServeResponse bad_request(uint64_t id, int status, const string &error) {
+    ServeResponse response;
+    response.set_id(id);
+    response.set_status(status);
+    response.set_error(error);
+    return response;
+  }
+
+  // Answers a request for a cached map, on a worker
+  ServeResponse answer(const ServeRequest &request, Map &map, PathCache *path_cache) {
+
+    ServeResponse response;
+    response.set_id(request.id());
+    response.set_map_hash(map.hash);
+
+    if (request.command() == ServeRequest::GNUPLOT) {
+      response.set_gnuplot(save_gnuplot(*map.motion_plan));
+      return response;
+    }
+
+    if (!request.has_query()) return bad_request(request.id(), -1, "missing query");
+
+    // Parallelism is across requests, so each session plans on a single thread
+    PlannerOptions options;
+    options.simplify_seconds = request.simplify_seconds();
+    options.path_cache = path_cache;
+    if (!request.algorithm().empty() && !algorithm_from_string(request.algorithm(), options.algorithm)) {
+      return bad_request(request.id(), -1, "unknown algorithm");
+    }
+
+    auto session = map.acquire(options);
+    if (session == nullptr) return bad_request(request.id(), -1, "invalid planner options");
+
+    const auto &query = request.query();
+    response.set_status(session->plan(*response.mutable_path(),
+        query.init().x(), query.init().y(),
+        query.goal().x(), query.goal().y(),
+        query.timeout_seconds(), query.length_threshold(),
+        request.report() ? response.mutable_report() : nullptr));
+
+    map.release(options, move(session));
+
+    return response;
+
+  }
+
+  // Reads the next request, returning false at the end of the input, or on an
+  // error, which sets the error message (and leaves the input unusable)
+  class Requests {
+
+   public:
+
+    Requests(istream &in, Framing framing) : in(in), framing(framing), stream(&in) { }
+
+    bool read(ServeRequest &request, string &error) {
+
+      request.Clear();
+
+      if (framing == Framing::delimited) {
+        bool clean_eof = false;
+        if (google::protobuf::util::ParseDelimitedFromZeroCopyStream(&request, &stream, &clean_eof)) return true;
+        if (!clean_eof) error = "malformed message";
+        return false;
+      }
+
+      string line;
+      while (getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == string::npos) continue;
+        const auto status = google::protobuf::util::JsonStringToMessage(line, &request);
+        if (status.ok()) return true;
+        error = string(status.message());
+        return false;
+      }
+
+      return false;
+
+    }
+
+   private:
+
+    istream &in;
+    const Framing framing;
+    google::protobuf::io::IstreamInputStream stream;
+
+  };
+
+  // Reads, and answers, the requests of one connection, until the end of its input
+  int serve_connection(istream &in, ostream &out, Framing framing, MapCache &maps, WorkerPool &workers,
+                       PathCache *path_cache) {
+
+    Requests requests(in, framing);
+    Responses responses(out, framing);
+    Pending pending;
+
+    int result = 0;
+
+    ServeRequest request;
+    string error;
+
+    while (requests.read(request, error) || !error.empty()) {
+
+      // A malformed JSON line can be skipped, but a malformed binary message cannot
+      if (!error.empty()) {
+        responses.write(bad_request(0, -1, error));
+        error.clear();
+        if (framing == Framing::delimited) { result = -1; break; }
+        continue;
+      }
+
+      // Maps are cached here, in the order of the requests, so that later ones may refer to them
+
+      shared_ptr<Map> cached;
+
+      if (request.has_motion_plan()) {
+        MotionPlanPtr motion_plan(request.release_motion_plan());
+        motion_plan->clear_path();
+        if (!is_valid(*motion_plan)) {
+          responses.write(bad_request(request.id(), -1, "invalid motion plan"));
+          continue;
+        }
+        cached = maps.insert(move(motion_plan), request.map_id());
+      } else if (!request.map_id().empty()) {
+        cached = maps.find(request.map_id());
+      }
+
+      if (request.command() == ServeRequest::FORGET) {
+        ServeResponse response;
+        response.set_id(request.id());
+        response.set_status(maps.forget(request.map_id()) ? 0 : -3);
+        responses.write(response);
+        continue;
+      }
+
+      if (cached == nullptr) {
+        responses.write(bad_request(request.id(), -3, "unknown map"));
+        continue;
+      }
+
+      pending.add();
+      workers.submit([request, cached, path_cache, &responses, &pending]() {
+        responses.write(answer(request, *cached, path_cache));
+        pending.done();
+      });
+
+    }
+
+    // The responses refer to the output, so wait for all of them
+    pending.wait();
+
+    return in.bad() ? -1 : result;
+
+  }
+
+  // ------------------------------------------------------------------------
+
+  // Written to by the signal handler, so that `poll` wakes up, however late the signal comes
+  int interrupt_pipe[2] = {-1, -1};
+
+  void on_interrupt(int) {
+    const int saved = errno;
+    const char byte = 0;
+    [[maybe_unused]] const ssize_t written = write(interrupt_pipe[1], &byte, 1); // if full, already readable
+    errno = saved;
+  }
+
+  // Sets, or clears, `O_NONBLOCK` on a file descriptor
+  bool set_nonblocking(int fd, bool nonblocking) {
+    const int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) == 0;
+  }
+
+  int connect_or_bind(const string &socket_path, bool bind) {
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) return -1;
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    const auto *generic = reinterpret_cast<const sockaddr *>(&address);
+    const bool ok = bind
+        ? ::bind(fd, generic, sizeof(address)) == 0 && listen(fd, SOMAXCONN) == 0
+        : ::connect(fd, generic, sizeof(address)) == 0;
+
+    if (!ok) {
+      close(fd);
+      return -1;
+    }
+
+    return fd;
+
+  }
+
+  // Copies everything from one file descriptor to another, until the end of the input
+  bool copy(int from, int to) {
+    char buffer[1 << 16];
+    for (;;) {
+      ssize_t n = read(from, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) return false;
+      if (n == 0) return true;
+      for (char *p = buffer; n > 0;) {
+        const ssize_t written = write(to, p, size_t(n));
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        p += written;
+        n -= written;
+      }
+    }
+  }
+
+}
+
+// ---------------------------------------------------------------------------
+
+bool sdmp::application::framing_from_string(const string &name, Framing &framing) {
+  if (name == "json") { framing = Framing::json_lines; return true; }
+  if (name == "delimited") { framing = Framing::delimited; return true; }
+  return false;
+}
+
+bool sdmp::application::algorithm_from_string(const string &name, PlannerOptions::Algorithm &algorithm) {
+  using Algorithm = PlannerOptions::Algorithm;
+  if (name == "rrt_star") { algorithm = Algorithm::rrt_star; return true; }
+  if (name == "visibility_graph") { algorithm = Algorithm::visibility_graph; return true; }
+  if (name == "rrt_connect") { algorithm = Algorithm::rrt_connect; return true; }
+  if (name == "informed_rrt_star") { algorithm = Algorithm::informed_rrt_star; return true; }
+  if (name == "bit_star") { algorithm = Algorithm::bit_star; return true; }
+  if (name == "hybrid") { algorithm = Algorithm::hybrid; return true; }
+  return false;
+}
+
+int sdmp::application::serve(istream &in, ostream &out, Framing framing, unsigned thread_count,
+                             PathCache *path_cache) {
+
+  thread_count = thread_count > 0 ? thread_count : max(1u, thread::hardware_concurrency());
+
+  MapCache maps;
+  WorkerPool workers(thread_count);
+
+  return serve_connection(in, out, framing, maps, workers, path_cache);
+
+}
+
+int sdmp::application::serve(const string &socket_path, Framing framing, unsigned thread_count,
+                             PathCache *path_cache) {
+
+  thread_count = thread_count > 0 ? thread_count : max(1u, thread::hardware_concurrency());
+
+  unlink(socket_path.c_str()); // left over by a previous server, if any
+
+  const int listener = connect_or_bind(socket_path, true);
+  if (listener < 0 || !set_nonblocking(listener, true)) {
+    cerr << "error: cannot listen on '" << socket_path << "': " << strerror(errno) << endl;
+    if (listener >= 0) close(listener);
+    return -1;
+  }
+
+  if (pipe(interrupt_pipe) != 0 || !set_nonblocking(interrupt_pipe[0], true) || !set_nonblocking(interrupt_pipe[1], true)) {
+    cerr << "error: cannot create the interrupt pipe: " << strerror(errno) << endl;
+    close(listener);
+    return -1;
+  }
+
+  // Stop accepting on an interrupt, and let the open connections finish what they have read. The
+  // handler writes to a pipe that the loop polls with the listener, so that a signal that comes
+  // between two calls is not lost, as a flag checked before a blocking `accept` would be
+  struct sigaction action{}, previous_int{}, previous_term{};
+  action.sa_handler = on_interrupt;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGINT, &action, &previous_int);
+  sigaction(SIGTERM, &action, &previous_term);
+  signal(SIGPIPE, SIG_IGN); // clients may hang up early
+
+  MapCache maps;
+  WorkerPool workers(thread_count);
+
+  // Each connection is handled on its own thread, which the server waits for before returning
+  mutex connections_mutex;
+  condition_variable all_closed;
+  set<int> connections;
+
+  pollfd polled[2] = {{listener, POLLIN, 0}, {interrupt_pipe[0], POLLIN, 0}};
+  int result = 0;
+
+  for (;;) {
+
+    if (poll(polled, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      result = -1;
+    } else if ((polled[0].revents & (POLLERR | POLLHUP | POLLNVAL)) != 0) {
+      result = -1;
+    }
+
+    if (result != 0) {
+      cerr << "error: cannot accept connections on '" << socket_path << "'" << endl;
+      break;
+    }
+
+    if (polled[1].revents != 0) break; // interrupted
+    if ((polled[0].revents & POLLIN) == 0) continue;
+
+    const int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) continue; // a connection that failed before it was accepted
+
+    // Connections are read with blocking calls, whatever they inherit from the listener
+    if (!set_nonblocking(fd, false)) {
+      close(fd);
+      continue;
+    }
+
+    lock_guard<mutex> lock(connections_mutex);
+    connections.insert(fd);
+
+    thread([fd, framing, path_cache, &maps, &workers, &connections, &connections_mutex, &all_closed]() {
+      {
+        FileDescriptorBuffer buffer(fd);
+        istream in(&buffer); // separately, since reading to the end fails the stream
+        ostream out(&buffer);
+        serve_connection(in, out, framing, maps, workers, path_cache);
+      }
+      lock_guard<mutex> lock(connections_mutex);
+      close(fd);
+      connections.erase(fd);
+      if (connections.empty()) all_closed.notify_all();
+    }).detach();
+
+  }
+
+  close(listener);
+  unlink(socket_path.c_str());
+
+  sigaction(SIGINT, &previous_int, nullptr);
+  sigaction(SIGTERM, &previous_term, nullptr);
+  close(interrupt_pipe[0]);
+  close(interrupt_pipe[1]);
+  interrupt_pipe[0] = interrupt_pipe[1] = -1;
+
+  unique_lock<mutex> lock(connections_mutex);
+  for (int fd : connections) shutdown(fd, SHUT_RD);
+  all_closed.wait(lock, [&connections]() { return connections.empty(); });
+
+  return result;
+
+}
+
+int sdmp::application::client(const string &socket_path) {
+
+  const int fd = connect_or_bind(socket_path, false);
+  if (fd < 0) {
+    cerr << "error: cannot connect to '" << socket_path << "': " << strerror(errno) << endl;
+    return -1;
+  }
+
+  // Send all the requests, then say so, while the responses come back
+  thread sender([fd]() {
+    copy(STDIN_FILENO, fd);
+    shutdown(fd, SHUT_WR);
+  });
+
+  const bool received = copy(fd, STDOUT_FILENO);
+
+  sender.join();
+  close(fd);
+
+  return received ? 0 : -1;
+
+}
+
+// ---------------------------------------------------------------------------
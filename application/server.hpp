@@ -0,0 +1,50 @@
+/*! \file
+ * The long-running `serve` mode of the SDMP Command Line Interface
+ *
+ * A server reads `ServeRequest` messages, and writes a `ServeResponse`
+ * for each, as soon as it is ready, so not necessarily in order. Maps
+ * are parsed, and indexed, once, and cached (with a few idle planner
+ * sessions) by content hash and by name, so later requests only need
+ * to refer to them, and paths may be cached too, by map and query.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include "sdmp.hpp"
+
+#include <iosfwd>
+#include <string>
+
+namespace sdmp::application {
+
+/**
+ * \brief How messages are delimited on a stream.
+ */
+enum class Framing {
+  json_lines, // one JSON message per line
+  delimited,  // binary messages, each prefixed with its size, as a varint
+};
+
+// Parses `json` or `delimited`
+bool framing_from_string(const std::string &name, Framing &framing);
+
+// Parses the name of a planner algorithm, as used on the command line
+bool algorithm_from_string(const std::string &name, bb8::simple::PlannerOptions::Algorithm &algorithm);
+
+// Answers the requests from the input, on the output, with the given number of
+// workers (zero for one per hardware thread), until the end of the input, and
+// returns zero, or -1 if the input could not be read to its end; paths are
+// looked up in, and kept in, the path cache, if any
+int serve(std::istream &in, std::ostream &out, Framing framing, unsigned thread_count,
+          bb8::simple::PathCache *path_cache = nullptr);
+
+// As above, but for every connection to a Unix domain socket, concurrently,
+// sharing the workers and the maps, until interrupted
+int serve(const std::string &socket_path, Framing framing, unsigned thread_count,
+          bb8::simple::PathCache *path_cache = nullptr);
+
+// A stand-in for a client of a socket server: relays the standard input to
+// the socket, and its responses to the standard output, until both are done
+int client(const std::string &socket_path);
+
+} // end namespace sdmp::application
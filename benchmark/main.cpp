@@ -0,0 +1,629 @@
+/*! \file
+ * The Simple Droid Motion Planner (SDMP) Benchmarks
+ *
+ * Runs each benchmark over the seeded scenarios of `scenarios.hpp`,
+ * and writes one JSON record per line, with the median, minimum,
+ * and maximum of its samples, to the output file (or `-`, stdout).
+ * Progress goes to stderr.
+ *
+ * - `clearance`, `is_valid_state`, `is_valid_motion`: ns per call
+ *   of the obstacle index, at uniformly random points (and from
+ *   each point to a random one nearby, for motions)
+ * - `build_index`: ms to build the obstacle index, once per map,
+ *   culling the obstacles that cannot change any clearance, and
+ *   `culled_obstacles`, how many it culled
+ * - `first_solution`: seconds for `find_path` to find any path
+ * - `cost`: the path length `find_path` reaches within a fixed
+ *   budget
+ *
+ * Both planning benchmarks run for each planner (algorithm), with
+ * one thread and with all of them, so as to compare strategies on
+ * each class of scenario, and `cost` also with 2, 4, 8, ... threads
+ * in between, for a curve of cost against threads. The `_simplified`
+ * planners spend a tenth of the `cost` budget on simplification.
+ * - `visibility_graph`: seconds for a session to find the shortest
+ *   path, over its tangent graph, built beforehand, up to 10000
+ *   obstacles, with a budget of its own, so as to see how the search
+ *   scales, and `visibility_graph_vertices`, how many it reached
+ * - `replan`: seconds for a session to repair its `rrt_connect` path
+ *   after an obstacle is dropped onto it, which should not grow with
+ *   the size of the map, as planning from scratch does
+ * - `path_cache_hit`: seconds for a session to answer a repeated
+ *   query from a `PathCache`, which only checks the cached path
+ * - `fleet`: seconds for `find_fleet_paths` to plan a fleet of 32
+ *   droids, at random, around each other, with all threads, and
+ *   the droids that failed, as failures
+ * - `verify_path`: ns per segment to verify a long random walk,
+ *   with one thread and with all of them
+ * - `save_json`, `load_json`, `save_gnuplot`, `save_svg`: MB/s
+ * - `build_heap`, `build_arena`: ns per obstacle to build a copy of
+ *   the map with `create` and `add_circular_obstacle`, on the heap,
+ *   or on an arena, including freeing it
+ * - `load_binary`, `open_flat_map`: ms to load the map from memory,
+ *   in the Protocol Buffers wire format, or to open (and check) it
+ *   as a flat map file
+ * - `peak_rss`: the peak resident set size of the whole run, in KiB
+ *
+ * Planning is only benchmarked up to 1000 obstacles, since the
+ * budgets would need to grow with the map to mean much.
+ *
+ * Usage: `sdmp-bench [output_file] [max_obstacles] [budget_seconds] [repetitions]`
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "sdmp.hpp"
+#include "obstacle_index.hpp"
+#include "scenarios.hpp"
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::benchmark;
+
+namespace {
+
+  const unsigned seed = 42;
+  const int max_planning_obstacles = 1000;
+
+  // The visibility graph is exact, so it is given long enough to finish, on larger maps
+  const int max_visibility_graph_obstacles = 10000;
+  const double visibility_graph_seconds = 60.0;
+
+  struct Record {
+
+    string benchmark, scenario, unit;
+    string planner; // for the planning benchmarks
+    int obstacles;
+    unsigned threads;
+    double budget_seconds;
+
+    vector<double> samples;
+    int failures = 0;
+
+    Record(string benchmark, string unit, const string &scenario, int obstacles,
+           unsigned threads = 1, double budget_seconds = NAN)
+        : benchmark(move(benchmark)), scenario(scenario), unit(move(unit)),
+          obstacles(obstacles), threads(threads), budget_seconds(budget_seconds) {}
+
+  };
+
+  // One line of JSON, with the median, minimum, and maximum of the samples
+  void write(ostream &out, Record record) {
+
+    sort(record.samples.begin(), record.samples.end());
+
+    const auto number = [](double value) { return isfinite(value) ? to_string(value) : string("null"); };
+
+    const size_t n = record.samples.size();
+    const double median = n == 0 ? NAN : n % 2 ? record.samples[n / 2] : 0.5 * (record.samples[n / 2 - 1] + record.samples[n / 2]);
+
+    out << "{\"benchmark\":\"" << record.benchmark << "\""
+        << ",\"scenario\":\"" << record.scenario << "\""
+        << ",\"planner\":" << (record.planner.empty() ? string("null") : "\"" + record.planner + "\"")
+        << ",\"obstacles\":" << record.obstacles
+        << ",\"threads\":" << record.threads
+        << ",\"budget_seconds\":" << number(record.budget_seconds)
+        << ",\"samples\":" << n
+        << ",\"failures\":" << record.failures
+        << ",\"value\":" << number(median)
+        << ",\"min\":" << number(n == 0 ? NAN : record.samples.front())
+        << ",\"max\":" << number(n == 0 ? NAN : record.samples.back())
+        << ",\"unit\":\"" << record.unit << "\"}" << endl;
+
+  }
+
+  double seconds_since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  }
+
+  double path_length(const MotionPlan &motion_plan) {
+    double length = 0.0;
+    for (int i = 0; i + 1 < motion_plan.path_size(); i++) {
+      length += hypot(motion_plan.path(i + 1).x() - motion_plan.path(i).x(),
+                      motion_plan.path(i + 1).y() - motion_plan.path(i).y());
+    }
+    return length;
+  }
+
+  // ------------------------------------------------------------------------
+
+  void benchmark_obstacle_index(ostream &out, const Scenario &scenario, int repetitions) {
+
+    const MotionPlan &motion_plan = *scenario.motion_plan;
+    const detail::ObstacleIndex index(motion_plan);
+
+    const size_t query_count = 1 << 16;
+    const double step = 0.5; // about the length of a motion checked by a planner
+
+    mt19937 random(seed);
+    uniform_real_distribution<double> x(0.0, motion_plan.rectangle().length()), y(0.0, motion_plan.rectangle().width());
+    uniform_real_distribution<double> angle(0.0, 2.0 * M_PI);
+
+    vector<double> xs(query_count), ys(query_count), dxs(query_count), dys(query_count);
+    for (size_t i = 0; i < query_count; i++) {
+      const double a = angle(random);
+      xs[i] = x(random);
+      ys[i] = y(random);
+      dxs[i] = step * cos(a);
+      dys[i] = step * sin(a);
+    }
+
+    const auto time = [&](const string &name, auto &&call) {
+      Record record(name, "ns", scenario.name, motion_plan.obstacle_size());
+      double sink = 0.0; // keeps the calls from being optimized away
+      for (int r = 0; r < repetitions; r++) {
+        const auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < query_count; i++) sink += call(i);
+        record.samples.push_back(1e9 * seconds_since(start) / query_count);
+      }
+      if (sink == -1.0) cerr << sink;
+      write(out, record);
+    };
+
+    time("clearance", [&](size_t i) { return index.clearance(xs[i], ys[i]); });
+    time("is_valid_state", [&](size_t i) { return double(index.is_valid(xs[i], ys[i])); });
+    time("is_valid_motion", [&](size_t i) { return double(index.is_valid(xs[i], ys[i], xs[i] + dxs[i], ys[i] + dys[i])); });
+
+    Record build("build_index", "ms", scenario.name, motion_plan.obstacle_size());
+    for (int r = 0; r < repetitions; r++) {
+      const auto start = chrono::steady_clock::now();
+      const detail::ObstacleIndex built(motion_plan);
+      build.samples.push_back(1e3 * seconds_since(start));
+    }
+    write(out, build);
+
+    Record culled("culled_obstacles", "obstacles", scenario.name, motion_plan.obstacle_size());
+    culled.samples.push_back(double(index.out_of_bounds_count() + index.dominated_count()));
+    write(out, culled);
+
+  }
+
+  void benchmark_verification(ostream &out, const Scenario &scenario, int repetitions) {
+
+    MotionPlan motion_plan = *scenario.motion_plan;
+
+    const int waypoint_count = 1 << 16;
+    const double step = 0.5;
+    const double length = motion_plan.rectangle().length(), width = motion_plan.rectangle().width();
+
+    // A random walk, which crosses obstacles, so as to time a full report, and not an early exit
+    mt19937 random(seed);
+    uniform_real_distribution<double> angle(0.0, 2.0 * M_PI);
+    double x = 0.5 * length, y = 0.5 * width;
+    motion_plan.mutable_path()->Reserve(waypoint_count);
+    for (int i = 0; i < waypoint_count; i++) {
+      const double a = angle(random);
+      x = clamp(x + step * cos(a), 0.0, length);
+      y = clamp(y + step * sin(a), 0.0, width);
+      auto coordinates = motion_plan.add_path();
+      coordinates->set_x(x);
+      coordinates->set_y(y);
+    }
+
+    for (unsigned threads : {1u, thread::hardware_concurrency()}) {
+      Record record("verify_path", "ns", scenario.name, motion_plan.obstacle_size(), threads);
+      for (int r = 0; r < repetitions; r++) {
+        PathVerification verification;
+        const auto start = chrono::steady_clock::now();
+        bb8::simple::verify_path(motion_plan, &verification, threads);
+        record.samples.push_back(1e9 * seconds_since(start) / (waypoint_count - 1));
+      }
+      write(out, record);
+    }
+
+  }
+
+  void benchmark_json(ostream &out, const Scenario &scenario, int repetitions) {
+
+    const MotionPlan &motion_plan = *scenario.motion_plan;
+
+    Record save("save_json", "MB/s", scenario.name, motion_plan.obstacle_size());
+    Record load("load_json", "MB/s", scenario.name, motion_plan.obstacle_size());
+
+    for (int r = 0; r < repetitions; r++) {
+
+      auto start = chrono::steady_clock::now();
+      const string json = save_json(motion_plan);
+      save.samples.push_back(1e-6 * json.size() / seconds_since(start));
+
+      start = chrono::steady_clock::now();
+      const auto loaded = load_json(json);
+      if (!loaded) { load.failures++; continue; }
+      load.samples.push_back(1e-6 * json.size() / seconds_since(start));
+
+    }
+
+    write(out, save);
+    write(out, load);
+
+    // The exporters, into a sink that only counts, so as to time the formatting alone
+
+    const auto time_export = [&](const string &name, auto &&save_to) {
+      Record record(name, "MB/s", scenario.name, motion_plan.obstacle_size());
+      for (int r = 0; r < repetitions; r++) {
+        size_t bytes = 0;
+        const bb8::simple::ExportSink sink([&bytes](const char *, size_t size) { bytes += size; return true; });
+        const auto start = chrono::steady_clock::now();
+        if (!save_to(sink)) { record.failures++; continue; }
+        record.samples.push_back(1e-6 * bytes / seconds_since(start));
+      }
+      write(out, record);
+    };
+
+    time_export("save_gnuplot", [&](const bb8::simple::ExportSink &sink) { return bb8::simple::save_gnuplot(motion_plan, sink); });
+    time_export("save_svg", [&](const bb8::simple::ExportSink &sink) { return bb8::simple::save_svg(motion_plan, sink); });
+
+  }
+
+  void benchmark_flat_map(ostream &out, const Scenario &scenario, int repetitions) {
+
+    const MotionPlan &motion_plan = *scenario.motion_plan;
+
+    const string binary = save_binary(motion_plan);
+    const string filename = (filesystem::temp_directory_path() / "sdmp-bench.flat").string();
+
+    {
+      ofstream file(filename, ios::binary);
+      if (!bb8::simple::save_flat_map(motion_plan, file)) return;
+    }
+
+    Record load("load_binary", "ms", scenario.name, motion_plan.obstacle_size());
+    Record open("open_flat_map", "ms", scenario.name, motion_plan.obstacle_size());
+
+    for (int r = 0; r < repetitions; r++) {
+
+      auto start = chrono::steady_clock::now();
+      if (!load_binary(binary)) load.failures++;
+      else load.samples.push_back(1e3 * seconds_since(start));
+
+      start = chrono::steady_clock::now();
+      if (!bb8::simple::open_flat_map(filename)) open.failures++;
+      else open.samples.push_back(1e3 * seconds_since(start));
+
+    }
+
+    filesystem::remove(filename);
+
+    write(out, load);
+    write(out, open);
+
+  }
+
+  void benchmark_building(ostream &out, const Scenario &scenario, int repetitions) {
+
+    const MotionPlan &motion_plan = *scenario.motion_plan;
+    const int count = motion_plan.obstacle_size();
+
+    const auto build = [&](MotionPlan &copy) {
+      copy.mutable_obstacle()->Reserve(count);
+      for (const auto &obstacle : motion_plan.obstacle()) {
+        const auto &circle = obstacle.circle();
+        add_circular_obstacle(copy, circle.coordinates().x(), circle.coordinates().y(), circle.radius());
+      }
+    };
+
+    Record heap("build_heap", "ns", scenario.name, count);
+    Record arena("build_arena", "ns", scenario.name, count);
+
+    const double droid_radius = motion_plan.bb8().radius();
+    const double length = motion_plan.rectangle().length(), width = motion_plan.rectangle().width();
+
+    for (int r = 0; r < repetitions; r++) {
+
+      auto start = chrono::steady_clock::now();
+      {
+        auto copy = bb8::simple::create(droid_radius, length, width);
+        build(*copy);
+      }
+      heap.samples.push_back(1e9 * seconds_since(start) / max(count, 1));
+
+      start = chrono::steady_clock::now();
+      {
+        google::protobuf::Arena owner;
+        auto *copy = bb8::simple::create(owner, droid_radius, length, width);
+        build(*copy);
+      }
+      arena.samples.push_back(1e9 * seconds_since(start) / max(count, 1));
+
+    }
+
+    write(out, heap);
+    write(out, arena);
+
+  }
+
+  void benchmark_planning(ostream &out, const Scenario &scenario, double budget_seconds, int repetitions) {
+
+    const int obstacles = scenario.motion_plan->obstacle_size();
+    const unsigned max_threads = max(1u, thread::hardware_concurrency());
+
+    const auto plan = [&](Record &record, double length_threshold, const bb8::simple::PlannerOptions &options, auto &&sample) {
+      for (int r = 0; r < repetitions; r++) {
+        MotionPlan motion_plan(*scenario.motion_plan);
+        PlannerReport report;
+        const int failed = bb8::simple::find_path(motion_plan, scenario.x_init, scenario.y_init, scenario.x_goal, scenario.y_goal,
+                                                  record.budget_seconds, length_threshold, options, &report);
+        if (failed) { record.failures++; continue; }
+        record.samples.push_back(sample(motion_plan, report));
+      }
+      write(out, record);
+    };
+
+    const auto first_solution = [](const MotionPlan &, const PlannerReport &report) { return report.first_solution_seconds(); };
+    const auto cost = [](const MotionPlan &motion_plan, const PlannerReport &) { return path_length(motion_plan); };
+
+    using Algorithm = bb8::simple::PlannerOptions::Algorithm;
+
+    // Each planner, and the fraction of the budget it spends on simplification
+    const vector<tuple<string, Algorithm, double>> planners = {
+      {"rrt_star", Algorithm::rrt_star, 0.0},
+      {"rrt_star_simplified", Algorithm::rrt_star, 0.1},
+      {"rrt_connect", Algorithm::rrt_connect, 0.0},
+      {"rrt_connect_simplified", Algorithm::rrt_connect, 0.1},
+      {"informed_rrt_star", Algorithm::informed_rrt_star, 0.0},
+      {"bit_star", Algorithm::bit_star, 0.0},
+      {"hybrid", Algorithm::hybrid, 0.0},
+      {"visibility_graph", Algorithm::visibility_graph, 0.0},
+    };
+
+    // 1, 2, 4, ... threads, up to all of them, so that `cost` draws a curve against threads
+    vector<unsigned> thread_counts;
+    for (unsigned threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    for (const auto &[planner, algorithm, simplify] : planners) {
+      for (unsigned threads : thread_counts) {
+
+        bb8::simple::PlannerOptions options;
+        options.algorithm = algorithm;
+        options.thread_count = threads;
+
+        // which would not change the first path, and only with one thread and with all of them
+        if (simplify == 0.0 && (threads == 1 || threads == max_threads)) {
+          Record record("first_solution", "s", scenario.name, obstacles, threads, budget_seconds);
+          record.planner = planner;
+          plan(record, numeric_limits<double>::max(), options, first_solution);
+        }
+
+        for (double budget : {0.25 * budget_seconds, budget_seconds}) {
+          Record record("cost", "length", scenario.name, obstacles, threads, budget);
+          record.planner = planner;
+          options.simplify_seconds = simplify * budget;
+          plan(record, 0.0, options, cost);
+        }
+
+        // The visibility graph is single-threaded
+        if (max_threads == 1 || algorithm == Algorithm::visibility_graph) break;
+
+      }
+    }
+
+  }
+
+  void benchmark_visibility_graph(ostream &out, const Scenario &scenario, int repetitions) {
+
+    const MotionPlan &motion_plan = *scenario.motion_plan;
+
+    bb8::simple::PlannerOptions options;
+    options.algorithm = bb8::simple::PlannerOptions::Algorithm::visibility_graph;
+
+    Record seconds("visibility_graph", "s", scenario.name, motion_plan.obstacle_size(), 1, visibility_graph_seconds);
+    Record vertices("visibility_graph_vertices", "vertices", scenario.name, motion_plan.obstacle_size(), 1, visibility_graph_seconds);
+    seconds.planner = vertices.planner = "visibility_graph";
+
+    const auto session = bb8::simple::create_planner_session(motion_plan, options);
+    google::protobuf::RepeatedPtrField<Coordinates> path;
+
+    for (int r = 0; r < repetitions; r++) {
+      PlannerReport report;
+      if (session == nullptr ||
+          session->plan(path, scenario.x_init, scenario.y_init, scenario.x_goal, scenario.y_goal,
+                        visibility_graph_seconds, 0.0, &report) != 0) {
+        seconds.failures++;
+        vertices.failures++;
+        continue;
+      }
+      seconds.samples.push_back(report.planning_seconds());
+      vertices.samples.push_back(double(report.tree_size()));
+    }
+
+    write(out, seconds);
+    write(out, vertices);
+
+  }
+
+  void benchmark_replanning(ostream &out, const Scenario &scenario, double budget_seconds, int repetitions) {
+
+    const MotionPlan &motion_plan = *scenario.motion_plan;
+
+    bb8::simple::PlannerOptions options;
+    options.algorithm = bb8::simple::PlannerOptions::Algorithm::rrt_connect;
+
+    Record record("replan", "s", scenario.name, motion_plan.obstacle_size(), 1, budget_seconds);
+    record.planner = "rrt_connect";
+
+    const auto session = bb8::simple::create_planner_session(motion_plan, options);
+    google::protobuf::RepeatedPtrField<Coordinates> path;
+
+    for (int r = 0; r < repetitions; r++) {
+
+      if (session == nullptr ||
+          session->plan(path, scenario.x_init, scenario.y_init, scenario.x_goal, scenario.y_goal, budget_seconds) != 0) {
+        record.failures++;
+        continue;
+      }
+
+      // Block the middle of the middle segment of the path
+      const auto &a = path.Get((path.size() - 1) / 2), &b = path.Get((path.size() - 1) / 2 + 1);
+      const int id = session->add_obstacle(0.5 * (a.x() + b.x()), 0.5 * (a.y() + b.y()), 0.1);
+
+      const auto start = chrono::steady_clock::now();
+      if (session->replan(path, budget_seconds) != 0) record.failures++;
+      else record.samples.push_back(seconds_since(start));
+
+      session->remove_obstacle(id);
+
+    }
+
+    write(out, record);
+
+  }
+
+  void benchmark_path_cache(ostream &out, const Scenario &scenario, double budget_seconds, int repetitions) {
+
+    const MotionPlan &motion_plan = *scenario.motion_plan;
+
+    const auto cache = bb8::simple::create_path_cache();
+
+    bb8::simple::PlannerOptions options;
+    options.algorithm = bb8::simple::PlannerOptions::Algorithm::rrt_connect;
+    options.path_cache = cache.get();
+
+    Record record("path_cache_hit", "s", scenario.name, motion_plan.obstacle_size(), 1, budget_seconds);
+    record.planner = "rrt_connect";
+
+    const auto session = bb8::simple::create_planner_session(motion_plan, options);
+    google::protobuf::RepeatedPtrField<Coordinates> path;
+
+    // The first query is planned, and cached
+    if (session == nullptr ||
+        session->plan(path, scenario.x_init, scenario.y_init, scenario.x_goal, scenario.y_goal, budget_seconds) != 0) {
+      record.failures++;
+      write(out, record);
+      return;
+    }
+
+    for (int r = 0; r < repetitions; r++) {
+      PlannerReport report;
+      const auto start = chrono::steady_clock::now();
+      const int failed = session->plan(path, scenario.x_init, scenario.y_init, scenario.x_goal, scenario.y_goal,
+                                       budget_seconds, 0.0, &report);
+      if (failed || !report.cached()) record.failures++;
+      else record.samples.push_back(seconds_since(start));
+    }
+
+    write(out, record);
+
+  }
+
+  void benchmark_fleet(ostream &out, const Scenario &scenario, double budget_seconds, int repetitions) {
+
+    const MotionPlan &motion_plan = *scenario.motion_plan;
+    const detail::ObstacleIndex index(motion_plan);
+    const unsigned max_threads = max(1u, thread::hardware_concurrency());
+
+    const int droid_count = 32;
+
+    // Starts and goals where the droid of the scenario is clear of the obstacles, if it can be
+    mt19937 random(seed);
+    uniform_real_distribution<double> x(0.0, motion_plan.rectangle().length()), y(0.0, motion_plan.rectangle().width());
+    const auto clear_point = [&](Coordinates &coordinates) {
+      for (int attempt = 0; attempt < 1000; attempt++) {
+        coordinates.set_x(x(random));
+        coordinates.set_y(y(random));
+        if (index.is_valid(coordinates.x(), coordinates.y())) return;
+      }
+    };
+
+    vector<FleetDroid> droids(droid_count);
+    for (auto &droid : droids) {
+      clear_point(*droid.mutable_init());
+      clear_point(*droid.mutable_goal());
+      droid.set_radius(motion_plan.bb8().radius());
+    }
+
+    bb8::simple::PlannerOptions options;
+    options.algorithm = bb8::simple::PlannerOptions::Algorithm::rrt_connect;
+
+    Record record("fleet", "s", scenario.name, motion_plan.obstacle_size(), max_threads, budget_seconds);
+    record.planner = "rrt_connect";
+
+    for (int r = 0; r < repetitions; r++) {
+      const auto start = chrono::steady_clock::now();
+      const auto results = bb8::simple::find_fleet_paths(motion_plan, droids, budget_seconds, 0.0, options, max_threads);
+      record.samples.push_back(seconds_since(start));
+      for (const auto &result : results) record.failures += result.status() != 0;
+    }
+
+    write(out, record);
+
+  }
+
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+
+  const string output_file = argc > 1 ? argv[1] : "-";
+  const int max_obstacles = argc > 2 ? stoi(argv[2]) : 100000;
+  const double budget_seconds = argc > 3 ? stod(argv[3]) : 1.0;
+  const int repetitions = argc > 4 ? stoi(argv[4]) : 5;
+
+  if (max_obstacles < 1 || budget_seconds <= 0.0 || repetitions < 1) {
+    cerr << "usage: " << argv[0] << " [output_file] [max_obstacles] [budget_seconds] [repetitions]" << endl;
+    return -1;
+  }
+
+  ofstream file;
+  if (output_file != "-") {
+    file.open(output_file);
+    if (!file) {
+      cerr << "error: cannot write '" << output_file << "'" << endl;
+      return -1;
+    }
+  }
+  ostream &out = output_file == "-" ? cout : file;
+
+  vector<int> obstacle_counts;
+  for (int count = 10; count <= max_obstacles; count *= 10) obstacle_counts.push_back(count);
+
+  for (int count : obstacle_counts) {
+    for (const auto &scenario : all_scenarios(seed, {count})) {
+
+      cerr << scenario.name << " with " << scenario.motion_plan->obstacle_size() << " obstacles" << endl;
+
+      if (!bb8::simple::is_valid(*scenario.motion_plan)) {
+        cerr << "error: invalid scenario" << endl;
+        return -1;
+      }
+
+      benchmark_obstacle_index(out, scenario, repetitions);
+      benchmark_verification(out, scenario, repetitions);
+      benchmark_flat_map(out, scenario, repetitions);
+      benchmark_json(out, scenario, repetitions);
+      benchmark_building(out, scenario, repetitions);
+
+      if (count <= max_planning_obstacles) benchmark_planning(out, scenario, budget_seconds, repetitions);
+      if (count <= max_visibility_graph_obstacles) benchmark_visibility_graph(out, scenario, repetitions);
+      benchmark_replanning(out, scenario, budget_seconds, repetitions);
+      benchmark_path_cache(out, scenario, budget_seconds, repetitions);
+      if (count <= max_planning_obstacles) benchmark_fleet(out, scenario, budget_seconds, repetitions);
+
+    }
+  }
+
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+
+  Record peak_rss("peak_rss", "KiB", "all", max_obstacles);
+  peak_rss.samples.push_back(double(usage.ru_maxrss)); // KiB, on Linux
+  write(out, peak_rss);
+
+  return 0;
+
+}
@@ -0,0 +1,200 @@
+#include "scenarios.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <utility>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::benchmark;
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  const double droid_radius = 0.125;
+
+  // The side of a square holding about one obstacle per square unit
+  double side_for(int obstacle_count) {
+    return max(5.0, sqrt(double(obstacle_count)));
+  }
+
+  // Keeps the start and goal corners clear
+  bool near_corners(double x, double y, double size) {
+    return hypot(x, y) < 2.0 || hypot(size - x, size - y) < 2.0;
+  }
+
+  Scenario corner_to_corner(const string &name, MotionPlanPtr motion_plan, double size) {
+    return {name, move(motion_plan), 0.5, 0.5, size - 0.5, size - 0.5};
+  }
+
+}
+
+// ---------------------------------------------------------------------------
+
+Scenario sdmp::benchmark::random_scenario(unsigned seed, int obstacle_count) {
+
+  const double size = side_for(obstacle_count);
+  auto motion_plan = bb8::simple::create(droid_radius, size, size);
+  motion_plan->mutable_obstacle()->Reserve(obstacle_count);
+
+  mt19937 random(seed);
+  uniform_real_distribution<double> coordinate(0.0, size), radius(0.1, 0.4);
+
+  while (motion_plan->obstacle_size() < obstacle_count) {
+    const double x = coordinate(random), y = coordinate(random), r = radius(random);
+    if (near_corners(x, y, size)) continue;
+    add_circular_obstacle(*motion_plan, x, y, r);
+  }
+
+  return corner_to_corner("random", move(motion_plan), size);
+
+}
+
+Scenario sdmp::benchmark::clustered_scenario(unsigned seed, int obstacle_count) {
+
+  const double size = side_for(obstacle_count);
+  auto motion_plan = bb8::simple::create(droid_radius, size, size);
+  motion_plan->mutable_obstacle()->Reserve(obstacle_count);
+
+  mt19937 random(seed);
+  uniform_real_distribution<double> coordinate(2.0, size - 2.0), radius(0.1, 0.3);
+  normal_distribution<double> spread(0.0, 1.0);
+
+  const int cluster_count = max(1, obstacle_count / 50);
+  vector<pair<double, double>> centers(cluster_count);
+  for (auto &center : centers) center = {coordinate(random), coordinate(random)};
+
+  for (int i = 0; motion_plan->obstacle_size() < obstacle_count; i++) {
+    const auto &center = centers[i % cluster_count];
+    const double x = center.first + spread(random), y = center.second + spread(random), r = radius(random);
+    if (x < 0.0 || y < 0.0 || x > size || y > size || near_corners(x, y, size)) continue;
+    add_circular_obstacle(*motion_plan, x, y, r);
+  }
+
+  return corner_to_corner("clustered", move(motion_plan), size);
+
+}
+
+Scenario sdmp::benchmark::maze_scenario(unsigned seed, int obstacle_count) {
+
+  // Each cell is a unit square, and takes about five circles of wall
+
+  const int cells = max(2, int(round(sqrt(obstacle_count / 5.0))));
+  const double size = cells;
+  const double wall_radius = 0.12, posts_per_wall = 5;
+
+  auto motion_plan = bb8::simple::create(droid_radius, size, size);
+
+  // Carve a perfect maze, with a randomized depth-first search
+
+  const auto index = [cells](int column, int row) { return row * cells + column; };
+
+  vector<bool> visited(size_t(cells) * cells, false);
+  vector<bool> open_east(size_t(cells) * cells, false), open_north(size_t(cells) * cells, false);
+  vector<pair<int, int>> stack{{0, 0}};
+  visited[0] = true;
+
+  mt19937 random(seed);
+
+  while (!stack.empty()) {
+
+    const auto [column, row] = stack.back();
+
+    vector<pair<int, int>> neighbours;
+    for (const auto &[dc, dr] : {pair<int, int>{1, 0}, {-1, 0}, {0, 1}, {0, -1}}) {
+      const int c = column + dc, r = row + dr;
+      if (c >= 0 && r >= 0 && c < cells && r < cells && !visited[index(c, r)]) neighbours.emplace_back(c, r);
+    }
+
+    if (neighbours.empty()) {
+      stack.pop_back();
+      continue;
+    }
+
+    const auto [c, r] = neighbours[uniform_int_distribution<size_t>(0, neighbours.size() - 1)(random)];
+
+    if (c != column) open_east[index(min(c, column), r)] = true;
+    else open_north[index(c, min(r, row))] = true;
+
+    visited[index(c, r)] = true;
+    stack.emplace_back(c, r);
+
+  }
+
+  // A post at every inner corner, and circles along every closed inner wall
+
+  for (int column = 1; column < cells; column++) {
+    for (int row = 1; row < cells; row++) {
+      add_circular_obstacle(*motion_plan, column, row, wall_radius);
+    }
+  }
+
+  for (int column = 0; column < cells; column++) {
+    for (int row = 0; row < cells; row++) {
+      for (int k = 1; k < posts_per_wall; k++) {
+        const double t = k / double(posts_per_wall);
+        if (column + 1 < cells && !open_east[index(column, row)]) {
+          add_circular_obstacle(*motion_plan, column + 1.0, row + t, wall_radius);
+        }
+        if (row + 1 < cells && !open_north[index(column, row)]) {
+          add_circular_obstacle(*motion_plan, column + t, row + 1.0, wall_radius);
+        }
+      }
+    }
+  }
+
+  return corner_to_corner("maze", move(motion_plan), size);
+
+}
+
+Scenario sdmp::benchmark::narrow_passage_scenario(unsigned seed, int obstacle_count) {
+
+  const double size = side_for(obstacle_count);
+  auto motion_plan = bb8::simple::create(droid_radius, size, size);
+
+  // A wall of overlapping circles, with a gap 10% wider than the droid
+
+  const double wall_radius = 0.2, spacing = 0.3, gap = 1.1 * 2.0 * droid_radius;
+  const double x_wall = 0.5 * size, y_gap = 0.5 * size;
+
+  for (double y = 0.0; y <= size; y += spacing) {
+    if (y > y_gap - 0.5 * gap - wall_radius && y < y_gap + 0.5 * gap + wall_radius) continue;
+    add_circular_obstacle(*motion_plan, x_wall, y, wall_radius);
+  }
+
+  add_circular_obstacle(*motion_plan, x_wall, y_gap - 0.5 * gap - wall_radius, wall_radius);
+  add_circular_obstacle(*motion_plan, x_wall, y_gap + 0.5 * gap + wall_radius, wall_radius);
+
+  // Random clutter, on either side, away from the wall
+
+  mt19937 random(seed);
+  uniform_real_distribution<double> coordinate(0.0, size), radius(0.1, 0.3);
+
+  while (motion_plan->obstacle_size() < obstacle_count) {
+    const double x = coordinate(random), y = coordinate(random), r = radius(random);
+    if (fabs(x - x_wall) < 1.0 || near_corners(x, y, size)) continue;
+    add_circular_obstacle(*motion_plan, x, y, r);
+  }
+
+  return corner_to_corner("narrow_passage", move(motion_plan), size);
+
+}
+
+vector<Scenario> sdmp::benchmark::all_scenarios(unsigned seed, const vector<int> &obstacle_counts) {
+
+  vector<Scenario> scenarios;
+
+  for (int obstacle_count : obstacle_counts) {
+    scenarios.push_back(random_scenario(seed, obstacle_count));
+    scenarios.push_back(clustered_scenario(seed, obstacle_count));
+    scenarios.push_back(maze_scenario(seed, obstacle_count));
+    scenarios.push_back(narrow_passage_scenario(seed, obstacle_count));
+  }
+
+  return scenarios;
+
+}
+
+// ---------------------------------------------------------------------------
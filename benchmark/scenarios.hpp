@@ -0,0 +1,42 @@
+/*! \file
+ * Seeded, synthetic motion plans for the benchmarks
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include "sdmp.hpp"
+
+#include <string>
+#include <vector>
+
+namespace sdmp::benchmark {
+
+/**
+ * \brief A motion plan, with a query across it.
+ *
+ * The start and goal are always valid, and connected, but
+ * for (very) unlucky random fields. Obstacle counts are
+ * approximate, since walls take as many circles as needed.
+ */
+struct Scenario {
+  std::string name;
+  MotionPlanPtr motion_plan;
+  double x_init, y_init, x_goal, y_goal;
+};
+
+// Uniformly random circles, about one per square unit, keeping the corners clear
+Scenario random_scenario(unsigned seed, int obstacle_count);
+
+// Gaussian clusters of about 50 circles each, over the same area, keeping the corners clear
+Scenario clustered_scenario(unsigned seed, int obstacle_count);
+
+// A perfect maze (a single path between any two cells), with walls made of circles
+Scenario maze_scenario(unsigned seed, int obstacle_count);
+
+// A wall across the middle, with a single gap a fraction wider than the droid
+Scenario narrow_passage_scenario(unsigned seed, int obstacle_count);
+
+// All of the above, for each of the given obstacle counts
+std::vector<Scenario> all_scenarios(unsigned seed, const std::vector<int> &obstacle_counts);
+
+} // end namespace sdmp::benchmark
@@ -12,7 +12,12 @@ static_assert(__cplusplus >= 201703L, "c++17 support is required");
 
 #include "sdmp.pb.h" // https://developers.google.com/protocol-buffers/docs/reference/cpp-generated
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 // ---------------------------------------------------------------------------
 
@@ -22,6 +27,8 @@ static_assert(__cplusplus >= 201703L, "c++17 support is required");
  */
 namespace sdmp {
 
+namespace detail { struct Internals; } // private to the library
+
 /**
  * \var typedef std::shared_ptr<sdmp::MotionPlan> MotionPlanPtr
  * \brief A convenience `typedef` for shared ownership
@@ -54,6 +61,125 @@ MotionPlanPtr load_json(const std::string &json);
  */
 std::string save_json(const MotionPlan &motion_plan);
 
+/**
+ * \brief
+ * Load a binary representation of a `MotionPlan`
+ *
+ * Load the Protocol Buffers wire format of a `MotionPlan`,
+ * which is much smaller, and much faster to load, than JSON,
+ * especially for long lists of obstacles.
+ *
+ * @param binary the `string` to load from
+ * @return `nullptr` indicates failure
+ */
+MotionPlanPtr load_binary(const std::string &binary);
+
+/**
+ * \brief
+ * Load a binary representation of a `MotionPlan` from a stream
+ *
+ * As above, but reading the stream, up to its end, without
+ * first copying it into a `string`.
+ *
+ * @param in the stream to load from
+ * @return `nullptr` indicates failure
+ */
+MotionPlanPtr load_binary(std::istream &in);
+
+/**
+ * \brief
+ * Save a binary representation of a `MotionPlan`
+ *
+ * Save the Protocol Buffers wire format of a `MotionPlan`.
+ *
+ * @param motion_plan the `MotionPlan` to save
+ * @return the binary representation
+ */
+std::string save_binary(const MotionPlan &motion_plan);
+
+/**
+ * \brief
+ * Load a binary representation of a `MotionPlan` onto an arena
+ *
+ * As \ref load_binary "load_binary" above, but the plan, and
+ * all of its sub-messages, are allocated on the given arena,
+ * which owns them.
+ *
+ * @param arena the arena that owns the plan
+ * @param binary the `string` to load from
+ * @return `nullptr` indicates failure, owned by the arena otherwise
+ */
+MotionPlan *load_binary(google::protobuf::Arena &arena, const std::string &binary);
+
+/**
+ * \brief
+ * Write a `MotionPlan` to a stream of length-delimited messages
+ *
+ * Each message is prefixed with its size, as a varint, as with
+ * `writeDelimitedTo` in the other Protocol Buffers libraries, so
+ * that many plans can be piped through one stream. Read them
+ * back with a \ref MotionPlanReader "MotionPlanReader".
+ *
+ * @param motion_plan the `MotionPlan` to write
+ * @param out the stream to write to
+ * @return `false` indicates failure
+ */
+bool write_delimited(const MotionPlan &motion_plan, std::ostream &out);
+
+/**
+ * \brief Reads a stream of length-delimited `MotionPlan` messages.
+ *
+ * The reader buffers the stream, so nothing else should read
+ * from it while the reader is in use.
+ */
+class MotionPlanReader {
+
+ public:
+
+  struct Impl; // private to the library
+
+  explicit MotionPlanReader(std::istream &in);
+  ~MotionPlanReader();
+
+  MotionPlanReader(const MotionPlanReader &) = delete;
+  MotionPlanReader &operator=(const MotionPlanReader &) = delete;
+
+  /**
+   * \brief Read the next `MotionPlan`.
+   *
+   * Replaces the given plan, reusing its memory, so that
+   * reading many plans into the same one does not allocate.
+   *
+   * @param motion_plan the `MotionPlan` to replace
+   * @return `false` at the end of the stream, or on failure
+   */
+  bool read(MotionPlan &motion_plan);
+
+  /**
+   * \brief Whether reading stopped on a malformed message, rather than at the end of the stream.
+   */
+  bool failed() const;
+
+ private:
+
+  std::unique_ptr<Impl> impl;
+
+};
+
+/**
+ * \brief A content hash of a `MotionPlan` map
+ *
+ * A 64-bit hash of the droid, the bounds, and the obstacles
+ * of a `MotionPlan`, but **not** its `path`, so that data
+ * derived from a map, such as a roadmap, can be tied to it.
+ *
+ * The hash is stable across processes and platforms.
+ *
+ * @param motion_plan the `MotionPlan` to hash
+ * @return the hash
+ */
+std::uint64_t content_hash(const MotionPlan &motion_plan);
+
 /**
  * \brief Add a circular obstacle to a `MotionPlan`
  *
@@ -67,6 +193,8 @@ std::string save_json(const MotionPlan &motion_plan);
  * (Or another validity checker, depending on the
  * specific type of `MotionPlan` message.)
  *
+ * The obstacle is allocated on the arena of the plan, if any.
+ *
  * @param the motion plan to act on
  * @param location_x
  * @param location_y
@@ -90,6 +218,179 @@ namespace bb8 {
  */
 namespace simple {
 
+/**
+ * \var typedef std::function<void(const google::protobuf::RepeatedPtrField<Coordinates> &, double)> ImprovedPathCallback
+ * \brief Called with each improved path, and its length, as soon as it is found
+ */
+typedef std::function<void(const google::protobuf::RepeatedPtrField<Coordinates> &path, double length)> ImprovedPathCallback;
+
+class PathCache;
+
+/**
+ * \brief Options for the motion planner.
+ *
+ * The defaults reproduce the behaviour of the plain
+ * \ref find_path "find_path" overload.
+ */
+struct PlannerOptions {
+
+  /**
+   * \brief The path finding algorithms.
+   */
+  enum class Algorithm {
+
+    /**
+     * Sampling-based and asymptotically optimal: paths get
+     * shorter, towards the optimum, until the timeout or the
+     * length threshold.
+     */
+    rrt_star,
+
+    /**
+     * Exact and deterministic: A* over the graph of segments
+     * tangent to the obstacles, and arcs around them, which
+     * contains the shortest path. Best for up to hundreds of
+     * obstacles, where it returns (within 0.1%) the optimum in
+     * milliseconds. It keeps a clearance of a billionth of the
+     * rectangle, ignores the length threshold and the options
+     * below, and only fails at the timeout if there is no path,
+     * or the search is not done by then.
+     */
+    visibility_graph,
+
+    /**
+     * Sampling-based and not optimizing: two trees, from the
+     * start and from the goal, greedily grown towards each
+     * other. Usually the fastest to a first path, which it
+     * returns as soon as it is found, however long.
+     */
+    rrt_connect,
+
+    /**
+     * As `rrt_star`, but once a path is found, it only samples
+     * where a shorter path could be (an ellipse, with the start
+     * and goal as foci), so it converges faster.
+     */
+    informed_rrt_star,
+
+    /**
+     * Batch Informed Trees: asymptotically optimal, and searches
+     * batches of samples in order of their potential path length,
+     * so it tends to converge faster than `informed_rrt_star`.
+     */
+    bit_star,
+
+    /**
+     * A first path with `rrt_connect`, then `informed_rrt_star`
+     * for the rest of the budget, keeping the shorter of the two:
+     * about the latency of the one, with the refinement of the
+     * other. Stops after the first path if it satisfies the
+     * length threshold.
+     */
+    hybrid,
+
+  };
+
+  /**
+   * The algorithm used to find paths.
+   */
+  Algorithm algorithm = Algorithm::rrt_star;
+
+  /**
+   * The number of independently seeded planners to run
+   * in parallel, each on its own thread, keeping the
+   * shortest path found by any of them. Zero means one
+   * per hardware thread.
+   */
+  unsigned thread_count = 1;
+
+  /**
+   * The longest motion the `rrt_*` planners, and `hybrid`, add
+   * to their trees at once, or zero for their default (a fifth
+   * of the rectangle's diagonal). Shorter motions follow narrow
+   * passages better, longer ones cross open space faster.
+   */
+  double range = 0.0;
+
+  /**
+   * A budget, taken out of the timeout, for simplifying the
+   * path that planning found: removing its redundant vertices,
+   * and shortcutting it, until it stops getting shorter. Each
+   * change is checked as the planners check their motions, so
+   * the path stays clear. A little simplification often gets a
+   * shorter path than the same time spent on refinement. Zero
+   * for none, and ignored by the visibility graph, whose paths
+   * are already optimal.
+   */
+  double simplify_seconds = 0.0;
+
+  /**
+   * With simplification, also round the corners of the path
+   * with B-splines, for smoother motion, at the cost of more
+   * waypoints.
+   */
+  bool smooth_path = false;
+
+  /**
+   * Start from the path given to plan, such as the previous
+   * path of a motion plan, rather than clearing it first. It
+   * is moved onto the new start and goal, from its segments
+   * nearest to them, and checked against the obstacles, and
+   * any stretch of it that is now blocked is reconnected
+   * locally. The result is reported at once, as the first
+   * path, and every planner then spends the budget looking
+   * for a shorter one, keeping it if there is none. If the
+   * old path cannot be reused, planning starts from scratch.
+   * Ignored by the visibility graph, whose paths are quick
+   * to find anyway.
+   */
+  bool warm_start = false;
+
+  /**
+   * The node spacing of a precomputed clearance field, or
+   * zero for none. With a field, most validity checks are
+   * a bilinear lookup, and only those within the field's
+   * error margin (about `0.71 * field_resolution`) of an
+   * obstacle or boundary need the exact check, so results
+   * are unchanged. Fields are built in parallel, and shared
+   * by all sessions on the same map and resolution.
+   *
+   * See \ref distance_field_bytes "distance_field_bytes"
+   * to pick a resolution.
+   */
+  double field_resolution = 0.0;
+
+  /**
+   * If set, called with each improved path, and its length, as
+   * soon as any planner finds it, so that a droid may start
+   * moving on the first path, and take refinements as they come.
+   * Calls are serialized, with ever shorter paths, and are made
+   * from the planner threads while they wait, so the callback
+   * should be quick.
+   */
+  ImprovedPathCallback improved_path_callback = nullptr;
+
+  /**
+   * If not null, planning stops as soon as this flag is `true`,
+   * which another thread may set at any time, with the best path
+   * found so far, if any. Planning does not reset the flag.
+   */
+  const std::atomic<bool> *cancel = nullptr;
+
+  /**
+   * If not null, the paths of queries are looked up in, and
+   * kept in, this cache, which may be shared by any number of
+   * sessions and threads. A query whose start and goal are
+   * within the cache's quantum of a cached one, in the same
+   * map, returns the cached path at once, with its ends moved
+   * onto the new start and goal, if it is still clear, and
+   * only plans otherwise. A session stops using the cache once
+   * its obstacles are updated.
+   */
+  PathCache *path_cache = nullptr;
+
+};
+
 /**
  * \brief Create a simple `BB8` motion plan.
  *
@@ -111,6 +412,29 @@ namespace simple {
  */
 MotionPlanPtr create(double droid_radius, double bounds_length, double bounds_width);
 
+/**
+ * \brief Create a simple `BB8` motion plan on an arena.
+ *
+ * As \ref create "create" above, but the plan is allocated on
+ * the given arena, which owns it. So do its obstacles, and any
+ * path found for it, since sub-messages are allocated where
+ * their message lives: everything is freed at once, with the
+ * arena, rather than one sub-message at a time, which saves
+ * much allocator churn for maps of many obstacles, or for long
+ * paths.
+ *
+ * Reserve the obstacles first, with
+ * `motion_plan->mutable_obstacle()->Reserve(count)`,
+ * if their number is known.
+ *
+ * @param arena the arena that owns the plan
+ * @param droid_radius
+ * @param bounds_length
+ * @param bounds_width
+ * @return `nullptr` indicates failure, owned by the arena otherwise
+ */
+MotionPlan *create(google::protobuf::Arena &arena, double droid_radius, double bounds_length, double bounds_width);
+
 /**
  * \brief Check that a motion plan is valid.
  *
@@ -131,6 +455,52 @@ MotionPlanPtr create(double droid_radius, double bounds_length, double bounds_wi
  */
 bool is_valid(const MotionPlan &motion_plan);
 
+/**
+ * \brief Verify that the droid clears everything, all along the path.
+ *
+ * Unlike \ref is_valid "is_valid", which only checks that the
+ * waypoints are within the bounds, every segment of the path is
+ * checked exactly, as the disc of the droid swept along it,
+ * against every obstacle and the bounds, through a spatial index
+ * of the obstacles. A path of one waypoint is checked as a point.
+ *
+ * Long paths are checked in parallel, in chunks of segments.
+ *
+ * The map of the motion plan, but not its path, **is** checked
+ * as with \ref is_valid "is_valid(const MotionPlan &motion_plan)".
+ *
+ * @param motion_plan the `MotionPlan`, with the path to verify
+ * @param verification if not null, replaced with the first segment
+ *        that the droid does not clear, if any, and the smallest
+ *        clearance along the path
+ * @param thread_count the number of threads for long paths, zero
+ *        for one per hardware thread
+ * @return `true` if the path is clear, `false` if it is not, or it
+ *         is empty, or the map is not valid
+ */
+bool verify_path(const MotionPlan &motion_plan,
+                 PathVerification *verification = nullptr,
+                 unsigned thread_count = 0);
+
+class FlatMap;
+
+/**
+ * \brief Verify that the droid clears everything, all along the path, in a flat map.
+ *
+ * As \ref verify_path "verify_path" for a motion plan, whose
+ * map a \ref FlatMap "FlatMap" has already checked.
+ *
+ * @param map the `FlatMap` the path is in
+ * @param path the path to verify
+ * @param verification as for a motion plan
+ * @param thread_count as for a motion plan
+ * @return `true` if the path is clear, `false` if it is not, or it is empty
+ */
+bool verify_path(const FlatMap &map,
+                 const google::protobuf::RepeatedPtrField<Coordinates> &path,
+                 PathVerification *verification = nullptr,
+                 unsigned thread_count = 0);
+
 /**
  * \brief Find a path for the motion plan.
  *
@@ -161,16 +531,804 @@ int find_path(MotionPlan &motion_plan,
               double x_init, double y_init, double x_goal, double y_goal,
               double timeout_seconds, double length_threshold = 0.0);
 
+/**
+ * \brief Find a path for the motion plan, with options.
+ *
+ * As \ref find_path "find_path" above, but with the given
+ * planner options, such as the number of parallel planners.
+ *
+ * With several threads, all planners share the same wall-clock
+ * budget, and all of them stop as soon as any one of them finds
+ * a path satisfying the `length_threshold`.
+ *
+ * With a report, the planner also records what it did: the
+ * status, timings, tree size, validity checks, and the cost of
+ * each improved solution, over time. The time spent checking
+ * validity is only measured then, since measuring it costs
+ * about as much as the checks themselves.
+ *
+ * With \ref PlannerOptions::warm_start "warm_start", the
+ * previous `motion_plan.path` is where planning starts from,
+ * rather than being cleared.
+ *
+ * @param options the planner options
+ * @param report if not null, replaced with what the planner did
+ * @return zero for success
+ */
+int find_path(MotionPlan &motion_plan,
+              double x_init, double y_init, double x_goal, double y_goal,
+              double timeout_seconds, double length_threshold,
+              const PlannerOptions &options,
+              PlannerReport *report = nullptr);
+
+/**
+ * \brief A reusable planning session for one motion plan.
+ *
+ * A session prepares, once, everything that depends only on
+ * the map: the state space, the obstacle index, the validity
+ * checkers, and the planners. Each call to
+ * \ref PlannerSession::plan "plan" then only changes the
+ * start and goal, so many queries against the same map pay
+ * the setup cost once.
+ *
+ * A session does **not** refer to the `MotionPlan` it was
+ * created from, which may change or go away afterwards. To
+ * plan in a changing map, update the session's own copy of
+ * its obstacles, and repair paths with
+ * \ref PlannerSession::replan "replan".
+ *
+ * A session plans one query at a time. Use one session per
+ * thread to plan queries concurrently.
+ *
+ * Create sessions with
+ * \ref create_planner_session "create_planner_session".
+ */
+class PlannerSession {
+
+ public:
+
+  struct Impl; // private to the library
+
+  explicit PlannerSession(std::unique_ptr<Impl> impl);
+  ~PlannerSession();
+
+  PlannerSession(const PlannerSession &) = delete;
+  PlannerSession &operator=(const PlannerSession &) = delete;
+
+  /**
+   * \brief Find a path from a start to a goal.
+   *
+   * Compute (and **replace**) the given path, with the same
+   * arguments and results as \ref find_path "find_path".
+   *
+   * @param path the path to replace, such as `*motion_plan.mutable_path()`
+   * @param x_init the initial 'x' coordinate
+   * @param y_init the initial 'y' coordinate
+   * @param x_goal the 'x' goal coordinate
+   * @param y_goal the 'y' goal coordinate
+   * @param timeout_seconds take this long at most
+   * @param length_threshold return any path shorter than this,
+   *                       use zero for the shortest path found
+   *                       until timeout
+   * @param report if not null, replaced with what the planner did
+   * @return zero for success
+   */
+  int plan(google::protobuf::RepeatedPtrField<Coordinates> &path,
+           double x_init, double y_init, double x_goal, double y_goal,
+           double timeout_seconds, double length_threshold = 0.0,
+           PlannerReport *report = nullptr);
+
+  /**
+   * \brief Add an obstacle to the map of the session.
+   *
+   * Obstacles may be added, moved, and removed between
+   * queries, as the map changes, instead of creating a new
+   * session. Each update takes constant (amortized) time,
+   * whatever the size of the map, and later queries see the
+   * updated map.
+   *
+   * Sessions with a clearance field, or with the visibility
+   * graph, are precomputed for the whole map, so they cannot
+   * be updated.
+   *
+   * @param location_x
+   * @param location_y
+   * @param radius
+   * @return the identifier of the new obstacle, or -1 if the
+   *         arguments are not valid, or the session cannot be
+   *         updated
+   */
+  int add_obstacle(double location_x, double location_y, double radius);
+
+  /**
+   * \brief Move an obstacle of the map of the session.
+   *
+   * The obstacles of the motion plan the session was created
+   * from are identified by their index in it, and those added
+   * since by the identifier that
+   * \ref PlannerSession::add_obstacle "add_obstacle" returned.
+   *
+   * @param id the identifier of the obstacle
+   * @param location_x
+   * @param location_y
+   * @return zero for success, or -1 if the arguments are not
+   *         valid, there is no such obstacle, or the session
+   *         cannot be updated
+   */
+  int move_obstacle(int id, double location_x, double location_y);
+
+  /**
+   * \brief Remove an obstacle from the map of the session.
+   *
+   * @param id the identifier of the obstacle, as for
+   *           \ref PlannerSession::move_obstacle "move_obstacle"
+   * @return zero for success, or -1 if there is no such
+   *         obstacle, or the session cannot be updated
+   */
+  int remove_obstacle(int id);
+
+  /**
+   * \brief Repair a path after the map changed.
+   *
+   * Only the segments of the path that the obstacles added,
+   * or moved, since the last query could block are checked
+   * again, so the path must be the one that the last query
+   * of the session found. Each blocked stretch of the path is
+   * reconnected locally, with RRT-Connect, from the waypoint
+   * before it to the one after it, and then shortened, keeping
+   * the rest of the path. Should that fail, the path is planned
+   * again, from its start to its goal, with the rest of the
+   * budget, and the first path found is returned.
+   *
+   * So the time taken depends on how much of the path the
+   * changes block, not on the size of the map, and a path that
+   * nothing blocks is returned at once, unchanged.
+   *
+   * @param path the path to repair, as found by the last query
+   * @param timeout_seconds take this long at most
+   * @param report if not null, replaced with what the planner did
+   * @return zero for success, -1 for invalid arguments (such as
+   *         a path of fewer than two waypoints), and -2 if the
+   *         path cannot be repaired, which leaves it empty
+   */
+  int replan(google::protobuf::RepeatedPtrField<Coordinates> &path,
+             double timeout_seconds, PlannerReport *report = nullptr);
+
+  /**
+   * \brief Release the memory held by the planners.
+   *
+   * The planners are cleared before every query anyway,
+   * so this is only useful for idle sessions.
+   */
+  void clear();
+
+ private:
+
+  std::unique_ptr<Impl> impl;
+
+};
+
+/**
+ * \var typedef std::shared_ptr<PlannerSession> PlannerSessionPtr
+ * \brief A convenience `typedef` for shared ownership
+ */
+typedef std::shared_ptr<PlannerSession> PlannerSessionPtr;
+
+/**
+ * \brief The memory used by a clearance field.
+ *
+ * The memory used by the clearance field of the given
+ * resolution, for a motion plan, as selected by
+ * \ref PlannerOptions::field_resolution "PlannerOptions::field_resolution".
+ *
+ * @param motion_plan the `MotionPlan` to plan in
+ * @param resolution the node spacing of the field
+ * @return the size in bytes, or zero if the resolution
+ *         or motion plan is not valid
+ */
+std::size_t distance_field_bytes(const MotionPlan &motion_plan, double resolution);
+
+/**
+ * \brief Create a reusable planning session.
+ *
+ * The motion plan **is** checked with
+ * \ref is_valid "is_valid(const MotionPlan &motion_plan)".
+ *
+ * @param motion_plan the `MotionPlan` to plan in
+ * @param options the planner options
+ * @return `nullptr` indicates failure
+ */
+PlannerSessionPtr create_planner_session(const MotionPlan &motion_plan,
+                                         const PlannerOptions &options = PlannerOptions());
+
+/**
+ * \brief Create a reusable planning session in a flat map.
+ *
+ * As above, but the session indexes the obstacles of the map
+ * as they are sorted in it, without a `MotionPlan`. The
+ * `visibility_graph` algorithm, and clearance fields, are not
+ * supported.
+ *
+ * @param map the `FlatMap` to plan in, which may be closed afterwards
+ * @param options the planner options
+ * @return `nullptr` indicates failure
+ */
+PlannerSessionPtr create_planner_session(const FlatMap &map,
+                                         const PlannerOptions &options = PlannerOptions());
+
+/**
+ * \var typedef std::function<void(const PathResult &)> PathResultCallback
+ * \brief Called with each result of a batch, as soon as it is ready
+ */
+typedef std::function<void(const PathResult &result)> PathResultCallback;
+
+/**
+ * \brief Find paths for many queries against one motion plan.
+ *
+ * Plan every query, each with its own budget, on a pool of
+ * worker threads. Each worker plans with its own reusable
+ * \ref PlannerSession "PlannerSession", in the same index of
+ * the map, built once, and workers that run out of queries
+ * steal them from the others.
+ *
+ * The motion plan **is** checked with
+ * \ref is_valid "is_valid(const MotionPlan &motion_plan)",
+ * and its `path` is ignored.
+ *
+ * @param motion_plan the `MotionPlan` shared by all queries
+ * @param queries the start, goal, and budget of each query
+ * @param thread_count the number of workers, zero for one per hardware thread
+ * @param on_result if set, called with each result as soon as it is ready,
+ *                  from the worker threads, but never concurrently
+ * @param with_reports whether each result also has the `report` of what
+ *                     the planner did, as \ref find_path "find_path" gives
+ * @return the results, in the order of the queries, or an empty
+ *         vector if the motion plan is not valid
+ */
+std::vector<PathResult> batch_find_path(const MotionPlan &motion_plan,
+                                        const std::vector<PathQuery> &queries,
+                                        unsigned thread_count = 0,
+                                        const PathResultCallback &on_result = nullptr,
+                                        bool with_reports = false);
+
+/**
+ * \brief Find paths, in time, for a fleet of droids sharing a map.
+ *
+ * Droids are planned by priority, in the order given, so that
+ * each gives way to the droids before it. The path of each droid
+ * is planned around the obstacles, the starts of the droids after
+ * it, and the goals of the droids before it, which are where those
+ * droids wait, and then stay, so the paths do not depend on each
+ * other, and are planned in parallel, single-threaded, with an
+ * equal share of the budget each.
+ *
+ * Each path is then timed, at the speed of its droid, and its
+ * departure delayed until the droid, as a disc of its radius,
+ * clears every droid before it at all times, as reserved in a
+ * space-time table. Waiting for the droids before it to arrive
+ * always works, so a droid only fails when it has no path, or
+ * when a droid before it has none, and stays in its way.
+ *
+ * Droids that are not valid, or start where a droid before them
+ * does, are left out of the fleet.
+ *
+ * The map of the motion plan **is** checked, its droid is
+ * ignored, and its `path` too.
+ *
+ * @param motion_plan the `MotionPlan` whose map the droids share
+ * @param droids the start, goal, radius, and speed of each droid,
+ *               in order of priority
+ * @param timeout_seconds the budget of the whole fleet
+ * @param length_threshold for the path of each droid, as for
+ *                         \ref find_path "find_path"
+ * @param options the planner options of each droid
+ * @param thread_count the number of droids planned at once, zero
+ *                     for one per hardware thread
+ * @return the results, in the order of the droids, or an empty
+ *         vector if the map or the budget is not valid
+ */
+std::vector<FleetResult> find_fleet_paths(const MotionPlan &motion_plan,
+                                          const std::vector<FleetDroid> &droids,
+                                          double timeout_seconds,
+                                          double length_threshold,
+                                          const PlannerOptions &options = PlannerOptions(),
+                                          unsigned thread_count = 0);
+
+/**
+ * \brief A persistent multi-query roadmap for one motion plan.
+ *
+ * A roadmap is built once, with PRM*, against the obstacles
+ * of a motion plan, and can then answer many queries: each
+ * query only connects its start and goal to the roadmap and
+ * searches the graph, instead of growing a new tree.
+ *
+ * Roadmaps can be saved to, and loaded from, a compact binary
+ * stream, tied to the \ref content_hash "content_hash" of the
+ * motion plan, so that services can warm-start without
+ * rebuilding them.
+ *
+ * Queries on one roadmap are serialized, since each one may
+ * also grow the roadmap.
+ *
+ * Create roadmaps with \ref build_roadmap "build_roadmap"
+ * or \ref load_roadmap "load_roadmap".
+ */
+class Roadmap {
+
+ public:
+
+  struct Impl; // private to the library
+
+  explicit Roadmap(std::unique_ptr<Impl> impl);
+  ~Roadmap();
+
+  Roadmap(const Roadmap &) = delete;
+  Roadmap &operator=(const Roadmap &) = delete;
+
+  /**
+   * \brief Find a path from a start to a goal.
+   *
+   * Compute (and **replace**) the given path through the
+   * roadmap. If the start and goal cannot be connected
+   * through the roadmap, the roadmap keeps growing until
+   * they are, or until the timeout.
+   *
+   * @param path the path to replace, such as `*motion_plan.mutable_path()`
+   * @param x_init the initial 'x' coordinate
+   * @param y_init the initial 'y' coordinate
+   * @param x_goal the 'x' goal coordinate
+   * @param y_goal the 'y' goal coordinate
+   * @param timeout_seconds take this long at most
+   * @return zero for success
+   */
+  int plan(google::protobuf::RepeatedPtrField<Coordinates> &path,
+           double x_init, double y_init, double x_goal, double y_goal,
+           double timeout_seconds);
+
+  /**
+   * \brief Grow the roadmap for a while longer.
+   *
+   * @param seconds how long to grow the roadmap for
+   */
+  void grow(double seconds);
+
+  /**
+   * \brief The number of vertices in the roadmap.
+   */
+  std::size_t milestone_count() const;
+
+  /**
+   * \brief The number of edges in the roadmap.
+   */
+  std::size_t edge_count() const;
+
+  /**
+   * \brief The \ref content_hash "content_hash" of the motion plan of the roadmap.
+   */
+  std::uint64_t hash() const;
+
+ private:
+
+  std::unique_ptr<Impl> impl;
+
+  friend bool save_roadmap(const Roadmap &roadmap, std::ostream &out);
+
+};
+
+/**
+ * \var typedef std::shared_ptr<Roadmap> RoadmapPtr
+ * \brief A convenience `typedef` for shared ownership
+ */
+typedef std::shared_ptr<Roadmap> RoadmapPtr;
+
+/**
+ * \brief Build a multi-query roadmap for a motion plan.
+ *
+ * The motion plan **is** checked with
+ * \ref is_valid "is_valid(const MotionPlan &motion_plan)".
+ *
+ * @param motion_plan the `MotionPlan` to plan in
+ * @param build_seconds how long to grow the roadmap for
+ * @return `nullptr` indicates failure
+ */
+RoadmapPtr build_roadmap(const MotionPlan &motion_plan, double build_seconds);
+
+/**
+ * \brief Save a roadmap as a binary stream.
+ *
+ * @param roadmap the roadmap to save
+ * @param out the (binary) stream to save to
+ * @return `true` on success
+ */
+bool save_roadmap(const Roadmap &roadmap, std::ostream &out);
+
+/**
+ * \brief Load a roadmap from a binary stream.
+ *
+ * The roadmap must have been saved by
+ * \ref save_roadmap "save_roadmap" for a motion plan
+ * with the same \ref content_hash "content_hash".
+ *
+ * @param motion_plan the `MotionPlan` the roadmap was built for
+ * @param in the (binary) stream to load from
+ * @return `nullptr` indicates failure, including a different motion plan
+ */
+RoadmapPtr load_roadmap(const MotionPlan &motion_plan, std::istream &in);
+
+/**
+ * \brief A cache of the paths of repeated queries.
+ *
+ * Paths are cached by the \ref content_hash "content_hash" of
+ * their map, and their start and goal, each rounded to a
+ * multiple of a quantum, so that the same query, give or take
+ * the quantum, in the same map, finds the path again. A path
+ * found in the cache has its ends moved onto the exact start
+ * and goal, and is checked, all along, as by
+ * \ref verify_path "verify_path", before it is returned.
+ *
+ * The least recently used paths are evicted to keep the cache
+ * within its memory limit. Caches are thread-safe, and can be
+ * saved to, and loaded from, a compact binary stream, so that
+ * they survive restarts.
+ *
+ * Planning uses a cache through
+ * \ref PlannerOptions::path_cache "PlannerOptions::path_cache".
+ * Create caches with \ref create_path_cache "create_path_cache"
+ * or \ref load_path_cache "load_path_cache".
+ */
+class PathCache {
+
+ public:
+
+  struct Impl; // private to the library
+
+  explicit PathCache(std::unique_ptr<Impl> impl);
+  ~PathCache();
+
+  PathCache(const PathCache &) = delete;
+  PathCache &operator=(const PathCache &) = delete;
+
+  /**
+   * \brief Find the cached path of a query.
+   *
+   * Counts a hit, or a miss, including a cached path that is
+   * no longer clear.
+   *
+   * @param motion_plan the `MotionPlan` of the query
+   * @param path replaced with the cached path, on a hit only
+   * @return `true` on a hit
+   */
+  bool find(const MotionPlan &motion_plan,
+            double x_init, double y_init, double x_goal, double y_goal,
+            google::protobuf::RepeatedPtrField<Coordinates> &path);
+
+  /**
+   * \brief Find the cached path of a query, in a hashed map.
+   *
+   * As above, but with the \ref content_hash "content_hash" of
+   * the motion plan, computed once by the caller, so that many
+   * lookups in the same map do not hash it again.
+   *
+   * @param motion_plan the `MotionPlan` of the query
+   * @param map_hash the content hash of the motion plan
+   * @param path replaced with the cached path, on a hit only
+   * @return `true` on a hit
+   */
+  bool find(const MotionPlan &motion_plan, std::uint64_t map_hash,
+            double x_init, double y_init, double x_goal, double y_goal,
+            google::protobuf::RepeatedPtrField<Coordinates> &path);
+
+  /**
+   * \brief Cache the path of a query, replacing any.
+   *
+   * @param motion_plan the `MotionPlan` of the query
+   * @param path the path, which must run from the exact start
+   *        to the exact goal, as those that planning finds do
+   * @return `true` if the path was cached
+   */
+  bool insert(const MotionPlan &motion_plan,
+              double x_init, double y_init, double x_goal, double y_goal,
+              const google::protobuf::RepeatedPtrField<Coordinates> &path);
+
+  /**
+   * \brief Cache the path of a query, in a hashed map.
+   *
+   * As above, but with the \ref content_hash "content_hash" of
+   * the motion plan, computed once by the caller.
+   *
+   * @param map_hash the content hash of the motion plan of the query
+   * @param path the path, which must run from the exact start
+   *        to the exact goal, as those that planning finds do
+   * @return `true` if the path was cached
+   */
+  bool insert(std::uint64_t map_hash,
+              double x_init, double y_init, double x_goal, double y_goal,
+              const google::protobuf::RepeatedPtrField<Coordinates> &path);
+
+  /**
+   * \brief The number of lookups that found a clear path.
+   */
+  std::uint64_t hits() const;
+
+  /**
+   * \brief The number of lookups that did not.
+   */
+  std::uint64_t misses() const;
+
+  /**
+   * \brief The number of cached paths.
+   */
+  std::size_t size() const;
+
+  /**
+   * \brief The (approximate) memory used by the cached paths.
+   */
+  std::size_t memory_bytes() const;
+
+  /**
+   * \brief Forget every path, but keep the counters.
+   */
+  void clear();
+
+ private:
+
+  std::unique_ptr<Impl> impl;
+
+  friend struct detail::Internals;
+
+};
+
+/**
+ * \var typedef std::shared_ptr<PathCache> PathCachePtr
+ * \brief A convenience `typedef` for shared ownership
+ */
+typedef std::shared_ptr<PathCache> PathCachePtr;
+
+/**
+ * \brief Create an empty path cache.
+ *
+ * @param max_bytes the memory limit of the cached paths
+ * @param quantum the coordinates of the start and goal are
+ *        rounded to a multiple of this, in the units of the
+ *        maps, to key the cache
+ * @return `nullptr` indicates failure
+ */
+PathCachePtr create_path_cache(std::size_t max_bytes = std::size_t(64) << 20, double quantum = 1e-3);
+
+/**
+ * \brief Save a path cache as a binary stream.
+ *
+ * The counters are not saved.
+ *
+ * @param cache the cache to save
+ * @param out the (binary) stream to save to
+ * @return `true` on success
+ */
+bool save_path_cache(const PathCache &cache, std::ostream &out);
+
+/**
+ * \brief Load a path cache from a binary stream.
+ *
+ * The cache has the quantum it was saved with, and keeps the
+ * most recently used paths that fit in the memory limit.
+ *
+ * @param in the (binary) stream to load from
+ * @param max_bytes the memory limit of the cached paths
+ * @return `nullptr` indicates failure
+ */
+PathCachePtr load_path_cache(std::istream &in, std::size_t max_bytes = std::size_t(64) << 20);
+
 /**
  * \brief Save the motion plan as `GnuPlot` code.
  *
  * Save the motion plan as `GnuPlot` commands for visualization.
  *
+ * For large maps, prefer writing to a \ref ExportSink "ExportSink",
+ * which does not hold the whole script in memory.
+ *
  * @param motion_plan
  * @return
  */
 std::string save_gnuplot(const MotionPlan &motion_plan);
 
+/**
+ * \brief Where an exporter writes its output, a chunk at a time.
+ *
+ * A sink is a callback, given each chunk in turn, or a
+ * stream, or a file descriptor, which it writes to as is.
+ */
+class ExportSink {
+
+ public:
+
+  /**
+   * \brief The callback, given each chunk, which returns `false` to stop the export.
+   */
+  using Callback = std::function<bool(const char *data, std::size_t size)>;
+
+  ExportSink(Callback callback);
+  ExportSink(std::ostream &out);
+  explicit ExportSink(int file_descriptor);
+
+  bool write(const char *data, std::size_t size) const { return callback(data, size); }
+
+ private:
+
+  Callback callback;
+
+};
+
+/**
+ * \brief A window of the map to export, in its coordinates.
+ */
+struct Viewport {
+  double x_min, y_min, x_max, y_max;
+};
+
+/**
+ * \brief Write the motion plan as `GnuPlot` code.
+ *
+ * Writes the same commands as \ref save_gnuplot "save_gnuplot",
+ * but to the sink, in chunks, as they are formatted, with
+ * numbers in the shortest form that reads back exactly.
+ *
+ * With a viewport, only the obstacles, waypoints, and path
+ * segments that overlap it are written, and it is the range
+ * of the plot, so that a small window of a huge map is quick
+ * to export.
+ *
+ * @param motion_plan the `MotionPlan` to plot
+ * @param sink where to write the commands
+ * @param viewport if not null, the window of the map to plot
+ * @return `false` if the viewport is not finite, or empty, in which
+ *         case nothing is written, or if the sink failed, or stopped the export
+ */
+bool save_gnuplot(const MotionPlan &motion_plan, const ExportSink &sink, const Viewport *viewport = nullptr);
+
+/**
+ * \brief Write the motion plan as an `SVG` image.
+ *
+ * As \ref save_gnuplot "save_gnuplot", with the same colours,
+ * but as a standalone `SVG` document, with `y` pointing up.
+ *
+ * @param motion_plan the `MotionPlan` to draw
+ * @param sink where to write the document
+ * @param viewport if not null, the window of the map to draw
+ * @return `false` if the viewport is not finite, or empty, in which
+ *         case nothing is written, or if the sink failed, or stopped the export
+ */
+bool save_svg(const MotionPlan &motion_plan, const ExportSink &sink, const Viewport *viewport = nullptr);
+
+/**
+ * \brief A map, of a droid, bounds, and obstacles, mapped from a flat file.
+ *
+ * A flat map file holds the `BB8` radius and the `Rectangle`
+ * of a `MotionPlan`, in a versioned header, then its obstacles,
+ * as packed arrays of centers and radii, already sorted into a
+ * spatial index. Opening one maps it into memory, and checks
+ * it, but does not deserialize it, so that maps of millions of
+ * obstacles open in milliseconds, and take no heap of their own.
+ *
+ * Plan in a flat map with
+ * \ref create_planner_session "create_planner_session",
+ * check paths with \ref verify_path "verify_path", and export
+ * it with \ref save_svg "save_svg" or
+ * \ref save_gnuplot "save_gnuplot", all without a `MotionPlan`.
+ *
+ * Flat map files are written by
+ * \ref save_flat_map "save_flat_map", opened with
+ * \ref open_flat_map "open_flat_map", and converted back
+ * with \ref to_motion_plan "to_motion_plan".
+ */
+class FlatMap {
+
+ public:
+
+  struct Impl; // private to the library
+
+  explicit FlatMap(std::unique_ptr<Impl> impl);
+  ~FlatMap();
+
+  FlatMap(const FlatMap &) = delete;
+  FlatMap &operator=(const FlatMap &) = delete;
+
+  double droid_radius() const;
+  double length() const;
+  double width() const;
+
+  std::size_t obstacle_count() const;
+
+  /**
+   * \brief The \ref content_hash "content_hash" of the motion plan the map was saved from.
+   */
+  std::uint64_t content_hash() const;
+
+ private:
+
+  std::unique_ptr<Impl> impl;
+
+  friend struct detail::Internals;
+
+};
+
+/**
+ * \var typedef std::shared_ptr<const FlatMap> FlatMapPtr
+ * \brief A convenience `typedef` for shared ownership
+ */
+typedef std::shared_ptr<const FlatMap> FlatMapPtr;
+
+/**
+ * \brief Save the map of a motion plan as a flat map file.
+ *
+ * Saves the droid, the bounds, and the obstacles, but **not**
+ * the path. The motion plan **is** checked as with
+ * \ref is_valid "is_valid(const MotionPlan &motion_plan)",
+ * but for its path. The file is only readable on a host of
+ * the same byte order (little-endian).
+ *
+ * @param motion_plan the `MotionPlan` to save
+ * @param out the (binary) stream to save to
+ * @return `false` indicates failure
+ */
+bool save_flat_map(const MotionPlan &motion_plan, std::ostream &out);
+
+/**
+ * \brief Open, and map into memory, a flat map file.
+ *
+ * The file is checked, in full, but not copied. It must not
+ * be modified while the map is open.
+ *
+ * @param filename the file to open
+ * @return `nullptr` indicates failure, including a malformed
+ *         file, or one of another version of the format
+ */
+FlatMapPtr open_flat_map(const std::string &filename);
+
+/**
+ * \brief Convert a flat map back to a motion plan.
+ *
+ * The obstacles are in the order of the motion plan that
+ * the map was saved from, and the path is empty.
+ *
+ * @param map the `FlatMap` to convert
+ * @return the new `MotionPlan`
+ */
+MotionPlanPtr to_motion_plan(const FlatMap &map);
+
+/**
+ * \brief Write a flat map, and a path, as `GnuPlot` code.
+ *
+ * As \ref save_gnuplot "save_gnuplot" for a motion plan. With
+ * a viewport, only the cells of the map's index that overlap
+ * it are read.
+ *
+ * @param map the `FlatMap` to plot
+ * @param path the path to plot with it, possibly empty
+ * @param sink where to write the commands
+ * @param viewport if not null, the window of the map to plot
+ * @return `false` if the viewport is not finite, or empty, in which
+ *         case nothing is written, or if the sink failed, or stopped the export
+ */
+bool save_gnuplot(const FlatMap &map, const google::protobuf::RepeatedPtrField<Coordinates> &path,
+                  const ExportSink &sink, const Viewport *viewport = nullptr);
+
+/**
+ * \brief Write a flat map, and a path, as an `SVG` image.
+ *
+ * As \ref save_svg "save_svg" for a motion plan. With a
+ * viewport, only the cells of the map's index that overlap
+ * it are read.
+ *
+ * @param map the `FlatMap` to draw
+ * @param path the path to draw with it, possibly empty
+ * @param sink where to write the document
+ * @param viewport if not null, the window of the map to draw
+ * @return `false` if the viewport is not finite, or empty, in which
+ *         case nothing is written, or if the sink failed, or stopped the export
+ */
+bool save_svg(const FlatMap &map, const google::protobuf::RepeatedPtrField<Coordinates> &path,
+              const ExportSink &sink, const Viewport *viewport = nullptr);
+
 } // end namespace sdmp::bb8::simple
 
 } // end namespace sdmp::bb8
@@ -0,0 +1,60 @@
+#include "sdmp.hpp"
+#include "obstacle_index.hpp"
+#include "parallel.hpp"
+#include "planner_session.hpp"
+
+#include <mutex>
+#include <vector>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::bb8::simple;
+
+// ---------------------------------------------------------------------------
+
+vector<PathResult> sdmp::bb8::simple::batch_find_path(const MotionPlan &motion_plan,
+                                                      const vector<PathQuery> &queries,
+                                                      unsigned thread_count,
+                                                      const PathResultCallback &on_result,
+                                                      bool with_reports)
+{
+  if (!is_valid(motion_plan)) return {};
+
+  // Parallelism is across queries, so each session plans on a single thread
+
+  thread_count = detail::resolve_thread_count(thread_count);
+
+  // The map is indexed once, and each session plans in its own copy of the index
+  const detail::ObstacleIndex obstacles(motion_plan, 0.0, thread_count);
+
+  vector<PlannerSessionPtr> sessions(thread_count);
+  vector<PathResult> results(queries.size());
+  mutex callback_mutex;
+
+  detail::parallel_for(queries.size(), thread_count, [&](unsigned worker, size_t i) {
+
+    // Sessions are created lazily, by the worker that uses them
+    auto &session = sessions[worker];
+    if (session == nullptr) session = detail::create_planner_session(motion_plan, obstacles, PlannerOptions());
+
+    const auto &query = queries[i];
+    auto &result = results[i];
+
+    result.set_index(uint32_t(i));
+    result.set_status(session->plan(*result.mutable_path(),
+        query.init().x(), query.init().y(),
+        query.goal().x(), query.goal().y(),
+        query.timeout_seconds(), query.length_threshold(),
+        with_reports ? result.mutable_report() : nullptr));
+
+    if (on_result) {
+      lock_guard<mutex> lock(callback_mutex);
+      on_result(result);
+    }
+
+  });
+
+  return results;
+}
+
+// ---------------------------------------------------------------------------
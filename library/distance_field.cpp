@@ -0,0 +1,145 @@
+#include "distance_field.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::detail;
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  // Keep the node count addressable, and the field within reason
+  constexpr double max_nodes = double(numeric_limits<int32_t>::max());
+
+  // Returns the node counts of a field, which are zero if the resolution is not valid
+  pair<size_t, size_t> node_counts(const MotionPlan &motion_plan, double resolution) {
+    if (!isfinite(resolution) || resolution <= 0.0) return {0, 0};
+    const double columns = ceil(motion_plan.rectangle().length() / resolution) + 1.0;
+    const double rows = ceil(motion_plan.rectangle().width() / resolution) + 1.0;
+    if (!(columns * rows <= max_nodes)) return {0, 0};
+    return {size_t(columns), size_t(rows)};
+  }
+
+  // A field is cached by the content hash of its map, and by what the hash stands for, so that
+  // a collision is a miss, and not the field of another map: its resolution, the droid radius,
+  // the bounds, and the obstacle count
+  typedef tuple<uint64_t, double, double, double, double, int> Key;
+
+  // The field of a key, built by the first session that needs it, while the others wait on the
+  // entry, rather than on the whole cache, and kept for as long as any session uses it
+  struct Entry {
+    mutex building;
+    weak_ptr<const DistanceField> field;
+  };
+
+}
+
+// ---------------------------------------------------------------------------
+
+DistanceField::DistanceField(const MotionPlan &motion_plan, const ObstacleIndex &obstacles, double resolution,
+                             unsigned thread_count)
+    : resolution(resolution), inverse_resolution(1.0 / resolution)
+{
+  tie(columns, rows) = node_counts(motion_plan, resolution);
+
+  x_hi = (columns - 1) * resolution;
+  y_hi = (rows - 1) * resolution;
+
+  values.resize(columns * rows);
+
+  // Sample the exact clearance at every node, one row per task
+
+  parallel_for(rows, resolve_thread_count(thread_count), [&](unsigned, size_t row) {
+    const double y = row * resolution;
+    for (size_t column = 0; column < columns; column++) {
+      values[row * columns + column] = float(obstacles.clearance(column * resolution, y));
+    }
+  });
+
+  // Interpolation error (for a 1-Lipschitz function), plus the rounding to `float`
+
+  float largest = 0.0f;
+  for (float value : values) largest = max(largest, fabs(value));
+
+  error_margin = resolution / sqrt(2.0) + 2.0 * double(numeric_limits<float>::epsilon()) * largest;
+}
+
+// ---------------------------------------------------------------------------
+
+bool DistanceField::lookup(double x, double y, double &value) const {
+
+  if (!(x >= 0.0 && x <= x_hi && y >= 0.0 && y <= y_hi)) return false;
+
+  const double u = x * inverse_resolution, v = y * inverse_resolution;
+  const size_t column = min(size_t(u), columns - 2), row = min(size_t(v), rows - 2);
+  const double fx = u - column, fy = v - row;
+
+  const float *f = &values[row * columns + column];
+
+  const double bottom = f[0] + fx * (f[1] - f[0]);
+  const double top = f[columns] + fx * (f[columns + 1] - f[columns]);
+
+  value = bottom + fy * (top - bottom);
+
+  return true;
+
+}
+
+// ---------------------------------------------------------------------------
+
+size_t DistanceField::memory_bytes(const MotionPlan &motion_plan, double resolution) {
+  const auto [columns, rows] = node_counts(motion_plan, resolution);
+  return columns * rows * sizeof(float);
+}
+
+shared_ptr<const DistanceField> DistanceField::get(const MotionPlan &motion_plan,
+                                                   const ObstacleIndex &obstacles,
+                                                   double resolution,
+                                                   unsigned thread_count)
+{
+  if (memory_bytes(motion_plan, resolution) == 0) return nullptr;
+
+  static mutex cache_mutex;
+  static map<Key, shared_ptr<Entry>> cache;
+
+  const Key key(content_hash(motion_plan), resolution, motion_plan.bb8().radius(),
+                motion_plan.rectangle().length(), motion_plan.rectangle().width(), motion_plan.obstacle_size());
+
+  shared_ptr<Entry> entry;
+
+  {
+    lock_guard<mutex> lock(cache_mutex);
+
+    // Drop the entries whose field expired, unless a session is building it, or waiting for it
+    for (auto i = cache.begin(); i != cache.end();) {
+      if (i->second.use_count() == 1 && i->second->field.expired()) i = cache.erase(i); else ++i;
+    }
+
+    auto &cached = cache[key];
+    if (cached == nullptr) cached = make_shared<Entry>();
+    entry = cached;
+  }
+
+  lock_guard<mutex> lock(entry->building);
+
+  auto field = entry->field.lock();
+
+  if (field == nullptr) {
+    field = make_shared<const DistanceField>(motion_plan, obstacles, resolution, thread_count);
+    entry->field = field;
+  }
+
+  return field;
+}
+
+// ---------------------------------------------------------------------------
@@ -0,0 +1,76 @@
+/*! \file
+ * A precomputed signed distance field over a `MotionPlan`
+ *
+ * This is a private header of the library, it is **not** installed.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include "obstacle_index.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace sdmp::detail {
+
+/**
+ * \brief A sampled clearance field, for constant-time clearance lookups.
+ *
+ * The exact (signed) clearance of the droid, to the obstacles and
+ * boundary, is sampled on a regular grid of nodes over the bounding
+ * rectangle. Between nodes, the field is interpolated bilinearly.
+ *
+ * Since clearance is 1-Lipschitz, the interpolated value is within
+ * `h / sqrt(2)` of the exact value, for a node spacing `h`, and the
+ * \ref margin "margin" adds the rounding of the stored `float` values
+ * to that. Only lookups within the margin of zero need the exact check.
+ *
+ * Fields are immutable, so they are shared, through
+ * \ref DistanceField::get "get", by all sessions that plan on the
+ * same map at the same resolution.
+ */
+class DistanceField {
+
+ public:
+
+  // Assumption on input: assert(is_valid(motion_plan)), and a valid resolution
+  //
+  // Samples the field on (at most) the given number of threads, zero for one per hardware thread
+  DistanceField(const MotionPlan &motion_plan, const ObstacleIndex &obstacles, double resolution,
+                unsigned thread_count = 0);
+
+  // Returns the cached field for the map and resolution, building it (in parallel, on the
+  // threads of the session that builds it) if needed, while only the sessions that need the
+  // same field wait
+  static std::shared_ptr<const DistanceField> get(const MotionPlan &motion_plan,
+                                                  const ObstacleIndex &obstacles,
+                                                  double resolution,
+                                                  unsigned thread_count = 0);
+
+  // Returns the memory used by a field, or zero if the resolution is not valid for the map
+  static std::size_t memory_bytes(const MotionPlan &motion_plan, double resolution);
+
+  // Sets 'value' to the interpolated clearance at (x,y), and returns
+  // `false`, without setting it, if (x,y) is outside of the field
+  bool lookup(double x, double y, double &value) const;
+
+  // The largest possible difference between an interpolated and exact clearance
+  double margin() const { return error_margin; }
+
+  std::size_t memory_bytes() const { return values.size() * sizeof(float); }
+
+ private:
+
+  double resolution, inverse_resolution;
+  std::size_t columns, rows; // of nodes, row-major
+
+  double x_hi, y_hi; // the extent of the nodes
+
+  std::vector<float> values;
+
+  double error_margin;
+
+};
+
+} // end namespace sdmp::detail
@@ -0,0 +1,326 @@
+#include "sdmp.hpp"
+#include "flat_map.hpp"
+#include "internals.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <string_view>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::bb8::simple;
+
+// ---------------------------------------------------------------------------
+
+ExportSink::ExportSink(Callback callback) : callback(move(callback)) {}
+
+ExportSink::ExportSink(ostream &out)
+    : callback([&out](const char *data, size_t size) { return bool(out.write(data, streamsize(size))); }) {}
+
+ExportSink::ExportSink(int file_descriptor)
+    : callback([file_descriptor](const char *data, size_t size) {
+        while (size > 0) {
+          const ssize_t written = ::write(file_descriptor, data, size);
+          if (written < 0 && errno == EINTR) continue;
+          if (written <= 0) return false;
+          data += written;
+          size -= size_t(written);
+        }
+        return true;
+      }) {}
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  // Formats into a fixed buffer, handing it to the sink whenever it fills, so
+  // that an export never holds more than a chunk, whatever the size of the map
+  class Writer {
+
+   public:
+
+    explicit Writer(const ExportSink &sink) : sink(sink) {}
+
+    Writer &operator<<(string_view text) {
+      if (text.size() > sizeof(buffer) - used) flush();
+      if (text.size() > sizeof(buffer)) {
+        if (ok) ok = sink.write(text.data(), text.size());
+        return *this;
+      }
+      memcpy(buffer + used, text.data(), text.size());
+      used += text.size();
+      return *this;
+    }
+
+    // The shortest form that reads back exactly
+    Writer &operator<<(double value) {
+      if (sizeof(buffer) - used < max_number_size) flush();
+      used = size_t(to_chars(buffer + used, buffer + sizeof(buffer), value).ptr - buffer);
+      return *this;
+    }
+
+    Writer &operator<<(unsigned value) {
+      if (sizeof(buffer) - used < max_number_size) flush();
+      used = size_t(to_chars(buffer + used, buffer + sizeof(buffer), value).ptr - buffer);
+      return *this;
+    }
+
+    // Returns whether everything was written
+    bool finish() {
+      flush();
+      return ok;
+    }
+
+   private:
+
+    static constexpr size_t max_number_size = 32;
+
+    void flush() {
+      if (ok && used > 0) ok = sink.write(buffer, used);
+      used = 0;
+    }
+
+    const ExportSink &sink;
+    char buffer[64 * 1024];
+    size_t used = 0;
+    bool ok = true;
+
+  };
+
+  // What is exported: the droid and bounds, a path, and the obstacles, which are
+  // visited by a function given the window, and a callback for each obstacle that
+  // may overlap it (or more)
+  struct Scene {
+    double droid_radius, length, width;
+    const google::protobuf::RepeatedPtrField<Coordinates> &path;
+  };
+
+  // The whole map, or the given window of it
+  Viewport window_of(const Scene &scene, const Viewport *viewport) {
+    if (viewport != nullptr) return *viewport;
+    return {0.0, 0.0, scene.length, scene.width};
+  }
+
+  // Whether the window is finite, and not empty
+  bool is_valid_window(const Viewport &window) {
+    return isfinite(window.x_min) && isfinite(window.y_min) && isfinite(window.x_max) && isfinite(window.y_max) &&
+           window.x_min < window.x_max && window.y_min < window.y_max;
+  }
+
+  // Whether the disc, or the segment (grown by the radius), may overlap the window, by its bounding box
+  bool overlaps(const Viewport &window, double x0, double y0, double x1, double y1, double r) {
+    return min(x0, x1) - r <= window.x_max && max(x0, x1) + r >= window.x_min &&
+           min(y0, y1) - r <= window.y_max && max(y0, y1) + r >= window.y_min;
+  }
+
+  bool overlaps(const Viewport &window, double x, double y, double r) {
+    return overlaps(window, x, y, x, y, r);
+  }
+
+  const double alpha = 0.25;
+
+}
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  template <class EachObstacle>
+  bool write_gnuplot(const Scene &scene, EachObstacle &&each_obstacle, const ExportSink &sink, const Viewport *viewport) {
+
+    const Viewport window = window_of(scene, viewport);
+    if (!is_valid_window(window)) return false;
+
+    Writer commands(sink);
+
+    commands << "set termoption enhanced\n";
+    commands << "set title '{/:Bold Simple Droid Motion Plan}'\n";
+
+    commands << "set xlabel '{/:Bold length} / {/:Italic m} / {/:Italic x}'\n";
+    commands << "set ylabel '{/:Bold width} / {/:Italic n} / {/:Italic y}'\n";
+    commands << "set xrange [" << window.x_min << ":" << window.x_max << "]\n";
+    commands << "set yrange [" << window.y_min << ":" << window.y_max << "]\n";
+    commands << "set size ratio " << (window.y_max - window.y_min) / (window.x_max - window.x_min) << "\n";
+    commands << "set grid\n";
+
+    unsigned index = 0;
+
+    const double r_d = scene.droid_radius;
+
+    for (const auto &waypoint : scene.path) {
+      const double x(waypoint.x()), y(waypoint.y());
+      if (!overlaps(window, x, y, r_d)) continue;
+      commands << "set object " << (++index) << " circle at " << x << "," << y << " size " << r_d
+        << " fillcolor rgb 'dark-orange' fillstyle transparent solid " << alpha << "\n";
+    }
+
+    for (int i = 0; i + 1 < scene.path.size(); i++) {
+      const auto &from = scene.path.Get(i), &to = scene.path.Get(i + 1);
+      if (!overlaps(window, from.x(), from.y(), to.x(), to.y(), 0.0)) continue;
+      commands << "set arrow from " << from.x() << "," << from.y() << " to " << to.x() << "," << to.y()
+        << " linewidth 2 linecolor rgb 'dark-green'\n";
+    }
+
+    each_obstacle(window, [&](double x, double y, double r) {
+      if (!overlaps(window, x, y, r)) return;
+      commands << "set object " << (++index) << " circle at " << x << "," << y << " size " << r
+        << " fillcolor rgb 'black' fillstyle transparent solid " << alpha << "\n";
+    });
+
+    commands << "plot NaN notitle\n"; // this command generates the plot even though we technically have no data
+
+    return commands.finish();
+  }
+
+  template <class EachObstacle>
+  bool write_svg(const Scene &scene, EachObstacle &&each_obstacle, const ExportSink &sink, const Viewport *viewport) {
+
+    const Viewport window = window_of(scene, viewport);
+    if (!is_valid_window(window)) return false;
+
+    Writer svg(sink);
+
+    // The drawing is flipped, so that 'y' points up, as in the map, and the view box is flipped with it
+
+    svg << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    svg << "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\""
+        << window.x_min << " " << -window.y_max << " "
+        << window.x_max - window.x_min << " " << window.y_max - window.y_min << "\">\n";
+    svg << "<title>Simple Droid Motion Plan</title>\n";
+    svg << "<g transform=\"scale(1,-1)\">\n";
+
+    svg << "<rect x=\"0\" y=\"0\" width=\"" << scene.length
+        << "\" height=\"" << scene.width
+        << "\" fill=\"none\" stroke=\"gray\" stroke-width=\"1\" vector-effect=\"non-scaling-stroke\"/>\n";
+
+    const double r_d = scene.droid_radius;
+
+    svg << "<g fill=\"darkorange\" fill-opacity=\"" << alpha << "\">\n";
+    for (const auto &waypoint : scene.path) {
+      const double x(waypoint.x()), y(waypoint.y());
+      if (!overlaps(window, x, y, r_d)) continue;
+      svg << "<circle cx=\"" << x << "\" cy=\"" << y << "\" r=\"" << r_d << "\"/>\n";
+    }
+    svg << "</g>\n";
+
+    // Each run of segments that overlap the window is one polyline
+
+    svg << "<g fill=\"none\" stroke=\"darkgreen\" stroke-width=\"2\" stroke-linejoin=\"round\">\n";
+    bool in_run = false;
+    for (int i = 0; i + 1 < scene.path.size(); i++) {
+      const auto &from = scene.path.Get(i), &to = scene.path.Get(i + 1);
+      if (!overlaps(window, from.x(), from.y(), to.x(), to.y(), 0.0)) {
+        if (in_run) svg << "\" vector-effect=\"non-scaling-stroke\"/>\n";
+        in_run = false;
+        continue;
+      }
+      if (!in_run) svg << "<polyline points=\"" << from.x() << "," << from.y();
+      svg << " " << to.x() << "," << to.y();
+      in_run = true;
+    }
+    if (in_run) svg << "\" vector-effect=\"non-scaling-stroke\"/>\n";
+    svg << "</g>\n";
+
+    svg << "<g fill=\"black\" fill-opacity=\"" << alpha << "\">\n";
+    each_obstacle(window, [&](double x, double y, double r) {
+      if (!overlaps(window, x, y, r)) return;
+      svg << "<circle cx=\"" << x << "\" cy=\"" << y << "\" r=\"" << r << "\"/>\n";
+    });
+    svg << "</g>\n";
+
+    svg << "</g>\n";
+    svg << "</svg>\n";
+
+    return svg.finish();
+  }
+
+  // Every obstacle of the motion plan, in order
+  auto each_obstacle_of(const MotionPlan &motion_plan) {
+    return [&motion_plan](const Viewport &, auto &&obstacle) {
+      for (const auto &o : motion_plan.obstacle()) {
+        const auto &circle = o.circle();
+        obstacle(circle.coordinates().x(), circle.coordinates().y(), circle.radius());
+      }
+    };
+  }
+
+  // The obstacles of the cells of the flat map's grid that the window overlaps, grown by the largest radius
+  auto each_obstacle_of(const FlatMap &flat_map) {
+    return [&flat_map](const Viewport &window, auto &&obstacle) {
+
+      const auto &map = detail::Internals::of(flat_map);
+      const auto &header = *map.header;
+
+      const double inverse_cell_size = 1.0 / header.cell_size;
+      const auto cell_of = [inverse_cell_size](double value, double origin, uint32_t count) {
+        return uint32_t(clamp(floor((value - origin) * inverse_cell_size), 0.0, double(count - 1)));
+      };
+
+      const uint32_t column_lo = cell_of(window.x_min - map.r_max, header.origin_x, header.columns);
+      const uint32_t column_hi = cell_of(window.x_max + map.r_max, header.origin_x, header.columns);
+      const uint32_t row_lo = cell_of(window.y_min - map.r_max, header.origin_y, header.rows);
+      const uint32_t row_hi = cell_of(window.y_max + map.r_max, header.origin_y, header.rows);
+
+      for (uint32_t row = row_lo; row <= row_hi; row++) {
+        // The cells of a row are contiguous
+        const size_t c = size_t(row) * header.columns;
+        for (uint32_t j = map.cell_start[c + column_lo]; j < map.cell_start[c + column_hi + 1]; j++) {
+          obstacle(map.xs[j], map.ys[j], map.rs[j]);
+        }
+      }
+
+    };
+  }
+
+  Scene scene_of(const MotionPlan &motion_plan) {
+    return {motion_plan.bb8().radius(), motion_plan.rectangle().length(), motion_plan.rectangle().width(), motion_plan.path()};
+  }
+
+  Scene scene_of(const FlatMap &map, const google::protobuf::RepeatedPtrField<Coordinates> &path) {
+    return {map.droid_radius(), map.length(), map.width(), path};
+  }
+
+}
+
+// ---------------------------------------------------------------------------
+
+bool sdmp::bb8::simple::save_gnuplot(const MotionPlan &motion_plan, const ExportSink &sink, const Viewport *viewport)
+{
+  return write_gnuplot(scene_of(motion_plan), each_obstacle_of(motion_plan), sink, viewport);
+}
+
+bool sdmp::bb8::simple::save_gnuplot(const FlatMap &map, const google::protobuf::RepeatedPtrField<Coordinates> &path,
+                                     const ExportSink &sink, const Viewport *viewport)
+{
+  return write_gnuplot(scene_of(map, path), each_obstacle_of(map), sink, viewport);
+}
+
+string sdmp::bb8::simple::save_gnuplot(const MotionPlan &motion_plan)
+{
+  string commands;
+
+  save_gnuplot(motion_plan, ExportSink([&commands](const char *data, size_t size) {
+    commands.append(data, size);
+    return true;
+  }));
+
+  return commands;
+}
+
+// ---------------------------------------------------------------------------
+
+bool sdmp::bb8::simple::save_svg(const MotionPlan &motion_plan, const ExportSink &sink, const Viewport *viewport)
+{
+  return write_svg(scene_of(motion_plan), each_obstacle_of(motion_plan), sink, viewport);
+}
+
+bool sdmp::bb8::simple::save_svg(const FlatMap &map, const google::protobuf::RepeatedPtrField<Coordinates> &path,
+                                 const ExportSink &sink, const Viewport *viewport)
+{
+  return write_svg(scene_of(map, path), each_obstacle_of(map), sink, viewport);
+}
@@ -0,0 +1,280 @@
+#include "sdmp.hpp"
+#include "flat_map.hpp"
+#include "internals.hpp"
+#include "obstacle_index.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::bb8::simple;
+using namespace sdmp::detail;
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  // The arrays are used where they are mapped, so the file is in the byte order of the host
+  constexpr bool is_little_endian = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+  static_assert(sizeof(FlatMapHeader) == 136, "the header is part of the file format");
+
+  uint64_t aligned(uint64_t offset) {
+    return (offset + flat_map_alignment - 1) / flat_map_alignment * flat_map_alignment;
+  }
+
+  // The layout of the arrays after the header, which the header must match
+  struct Layout {
+
+    uint64_t x_offset, y_offset, radius_offset, id_offset, cell_start_offset, file_size;
+
+    Layout(uint64_t obstacle_count, uint64_t cell_count) {
+      x_offset = aligned(sizeof(FlatMapHeader));
+      y_offset = aligned(x_offset + obstacle_count * sizeof(double));
+      radius_offset = aligned(y_offset + obstacle_count * sizeof(double));
+      id_offset = aligned(radius_offset + obstacle_count * sizeof(double));
+      cell_start_offset = aligned(id_offset + obstacle_count * sizeof(uint32_t));
+      file_size = cell_start_offset + (cell_count + 1) * sizeof(uint32_t);
+    }
+
+  };
+
+  uint64_t cell_count_of(const FlatMapHeader &header) {
+    return uint64_t(header.columns) * uint64_t(header.rows);
+  }
+
+  // Whether the header is of this version of the format, and consistent with a file of the given size
+  bool is_valid_header(const FlatMapHeader &header, uint64_t file_size) {
+
+    if (memcmp(header.magic, flat_map_magic, sizeof(flat_map_magic)) != 0) return false;
+    if (header.version != flat_map_version) return false;
+    if (header.header_size != sizeof(FlatMapHeader)) return false;
+    if (header.file_size != file_size) return false;
+
+    // As for the map of a `MotionPlan`
+    if (!isfinite(header.droid_radius) || header.droid_radius <= 0.0) return false;
+    if (!isfinite(header.length) || header.length <= 0.0) return false;
+    if (!isfinite(header.width) || header.width <= 0.0) return false;
+
+    // Obstacles are identified by 31-bit indices, and the cells are bounded by their count, so
+    // that no array may overflow the file size, nor any offset wrap around, however large
+    if (!ObstacleIndex::is_valid_grid(header)) return false;
+
+    const Layout layout(header.obstacle_count, cell_count_of(header));
+
+    return header.x_offset == layout.x_offset &&
+           header.y_offset == layout.y_offset &&
+           header.radius_offset == layout.radius_offset &&
+           header.id_offset == layout.id_offset &&
+           header.cell_start_offset == layout.cell_start_offset &&
+           header.file_size == layout.file_size;
+
+  }
+
+  // Points the views of the map at the arrays of its header
+  void set_views(FlatMap::Impl &map, const char *base) {
+    const auto &header = *map.header;
+    map.xs = reinterpret_cast<const double *>(base + header.x_offset);
+    map.ys = reinterpret_cast<const double *>(base + header.y_offset);
+    map.rs = reinterpret_cast<const double *>(base + header.radius_offset);
+    map.ids = reinterpret_cast<const uint32_t *>(base + header.id_offset);
+    map.cell_start = reinterpret_cast<const uint32_t *>(base + header.cell_start_offset);
+  }
+
+  // Checks the arrays of a map with a valid header, in full, and finds the largest radius
+  bool is_valid_arrays(FlatMap::Impl &map) {
+
+    const auto &header = *map.header;
+    const size_t count = header.obstacle_count;
+    const uint64_t cell_count = cell_count_of(header);
+
+    map.r_max = 0.0;
+
+    for (size_t j = 0; j < count; j++) {
+      if (!isfinite(map.xs[j]) || !isfinite(map.ys[j])) return false;
+      if (!isfinite(map.rs[j]) || map.rs[j] <= 0.0) return false;
+      map.r_max = max(map.r_max, map.rs[j]);
+    }
+
+    // The identifiers are a permutation of the obstacles
+    vector<bool> seen(count, false);
+    for (size_t j = 0; j < count; j++) {
+      if (map.ids[j] >= count || seen[map.ids[j]]) return false;
+      seen[map.ids[j]] = true;
+    }
+
+    // The cells span the obstacles, in order
+    if (map.cell_start[0] != 0 || map.cell_start[cell_count] != count) return false;
+    for (uint64_t c = 0; c < cell_count; c++) {
+      if (map.cell_start[c] > map.cell_start[c + 1]) return false;
+    }
+
+    return ObstacleIndex::is_indexed(map);
+
+  }
+
+}
+
+// ---------------------------------------------------------------------------
+
+FlatMap::Impl::~Impl() {
+  if (mapping != nullptr) munmap(const_cast<void *>(mapping), mapping_size);
+}
+
+FlatMap::FlatMap(unique_ptr<Impl> impl)
+    : impl(move(impl)) { }
+
+FlatMap::~FlatMap() = default;
+
+double FlatMap::droid_radius() const { return impl->header->droid_radius; }
+double FlatMap::length() const { return impl->header->length; }
+double FlatMap::width() const { return impl->header->width; }
+
+size_t FlatMap::obstacle_count() const { return impl->header->obstacle_count; }
+
+uint64_t FlatMap::content_hash() const { return impl->header->content_hash; }
+
+// ---------------------------------------------------------------------------
+
+bool sdmp::bb8::simple::save_flat_map(const MotionPlan &motion_plan, ostream &out)
+{
+  if (!is_little_endian) return false;
+
+  if (!is_valid_map(motion_plan)) return false;
+  if (uint64_t(motion_plan.obstacle_size()) > numeric_limits<uint32_t>::max()) return false;
+
+  // Sort the obstacles into the grid of an index, and save that, with every obstacle, since
+  // culling depends on the margin, and an index adopting the grid culls it anyway
+
+  const ObstacleIndex index(motion_plan, 0.0, 0, false);
+
+  const size_t count = index.xs.size();
+  const uint64_t cell_count = index.cell_start.size() - 1;
+
+  vector<double> radii(count);
+  for (size_t j = 0; j < count; j++) radii[j] = motion_plan.obstacle(int(index.ids[j])).circle().radius();
+
+  const Layout layout(count, cell_count);
+
+  FlatMapHeader header;
+  memset(&header, 0, sizeof(header)); // so that the padding is saved as zeroes, too
+
+  memcpy(header.magic, flat_map_magic, sizeof(flat_map_magic));
+  header.version = flat_map_version;
+  header.header_size = sizeof(FlatMapHeader);
+  header.file_size = layout.file_size;
+  header.content_hash = sdmp::content_hash(motion_plan);
+
+  header.droid_radius = motion_plan.bb8().radius();
+  header.length = motion_plan.rectangle().length();
+  header.width = motion_plan.rectangle().width();
+
+  header.obstacle_count = count;
+
+  header.origin_x = index.origin_x;
+  header.origin_y = index.origin_y;
+  header.cell_size = index.cell_size;
+  header.columns = uint32_t(index.columns);
+  header.rows = uint32_t(index.rows);
+
+  header.x_offset = layout.x_offset;
+  header.y_offset = layout.y_offset;
+  header.radius_offset = layout.radius_offset;
+  header.id_offset = layout.id_offset;
+  header.cell_start_offset = layout.cell_start_offset;
+
+  // Check what is saved as it will be opened, so that anything saved can be
+
+  FlatMap::Impl view;
+  view.header = &header;
+  view.xs = index.xs.data();
+  view.ys = index.ys.data();
+  view.rs = radii.data();
+  view.ids = index.ids.data();
+  view.cell_start = index.cell_start.data();
+
+  if (!is_valid_header(header, layout.file_size) || !is_valid_arrays(view)) return false;
+
+  uint64_t written = 0;
+
+  const auto write = [&out, &written](uint64_t offset, const void *data, size_t size) {
+    static const char padding[flat_map_alignment] = {};
+    out.write(padding, streamsize(offset - written));
+    out.write(static_cast<const char *>(data), streamsize(size));
+    written = offset + size;
+  };
+
+  write(0, &header, sizeof(header));
+  write(layout.x_offset, index.xs.data(), count * sizeof(double));
+  write(layout.y_offset, index.ys.data(), count * sizeof(double));
+  write(layout.radius_offset, radii.data(), count * sizeof(double));
+  write(layout.id_offset, index.ids.data(), count * sizeof(uint32_t));
+  write(layout.cell_start_offset, index.cell_start.data(), (cell_count + 1) * sizeof(uint32_t));
+
+  return bool(out);
+}
+
+FlatMapPtr sdmp::bb8::simple::open_flat_map(const string &filename)
+{
+  if (!is_little_endian) return nullptr;
+
+  const int file_descriptor = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file_descriptor < 0) return nullptr;
+
+  struct stat status;
+  if (fstat(file_descriptor, &status) != 0 || size_t(status.st_size) < sizeof(FlatMapHeader)) {
+    close(file_descriptor);
+    return nullptr;
+  }
+
+  const size_t size = size_t(status.st_size);
+
+  // The mapping outlives the descriptor
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  close(file_descriptor);
+  if (mapping == MAP_FAILED) return nullptr;
+
+  auto impl = make_unique<FlatMap::Impl>();
+  impl->mapping = mapping;
+  impl->mapping_size = size;
+  impl->header = static_cast<const FlatMapHeader *>(mapping);
+
+  if (!is_valid_header(*impl->header, size)) return nullptr;
+
+  set_views(*impl, static_cast<const char *>(mapping));
+
+  if (!is_valid_arrays(*impl)) return nullptr;
+
+  return make_shared<const FlatMap>(move(impl));
+}
+
+MotionPlanPtr sdmp::bb8::simple::to_motion_plan(const FlatMap &flat_map)
+{
+  const auto &map = Internals::of(flat_map);
+  const size_t count = flat_map.obstacle_count();
+
+  auto motion_plan = create(flat_map.droid_radius(), flat_map.length(), flat_map.width());
+
+  // Back in the order they were saved in, by their identifiers
+  auto &obstacles = *motion_plan->mutable_obstacle();
+  obstacles.Reserve(int(count));
+  for (size_t j = 0; j < count; j++) obstacles.Add();
+
+  for (size_t j = 0; j < count; j++) {
+    auto *circle = obstacles.Mutable(int(map.ids[j]))->mutable_circle();
+    circle->set_radius(map.rs[j]);
+    auto *coordinates = circle->mutable_coordinates();
+    coordinates->set_x(map.xs[j]);
+    coordinates->set_y(map.ys[j]);
+  }
+
+  return motion_plan;
+}
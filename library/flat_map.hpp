@@ -0,0 +1,94 @@
+/*! \file
+ * The flat map file format, memory-mapped by `FlatMap`
+ *
+ * This is a private header of the library, it is **not** installed.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include "sdmp.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace sdmp::detail {
+
+class ObstacleIndex;
+
+/**
+ * \brief The header of a flat map file.
+ *
+ * The header is followed by the arrays it gives the offsets of,
+ * each aligned to \ref flat_map_alignment "flat_map_alignment"
+ * bytes: the `x`, `y`, and radius of each obstacle, sorted by
+ * the cells of a uniform grid, row-major, as the cells of an
+ * `ObstacleIndex` are, then the index of each obstacle in the
+ * `MotionPlan` it was saved from, and the start of each cell in
+ * the sorted arrays, plus their end.
+ *
+ * Everything is little-endian, as laid out in memory, so that
+ * the arrays are used where they are mapped.
+ */
+struct FlatMapHeader {
+
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t header_size;
+  std::uint64_t file_size;
+  std::uint64_t content_hash;
+
+  double droid_radius;
+  double length, width;
+
+  std::uint64_t obstacle_count;
+
+  // The grid, as built by `ObstacleIndex`
+  double origin_x, origin_y;
+  double cell_size;
+  std::uint32_t columns, rows;
+
+  // From the start of the file
+  std::uint64_t x_offset, y_offset, radius_offset, id_offset, cell_start_offset;
+
+};
+
+constexpr char flat_map_magic[8] = {'S', 'D', 'M', 'P', 'F', 'L', 'A', 'T'};
+constexpr std::uint32_t flat_map_version = 1;
+constexpr std::size_t flat_map_alignment = 64; // a cache line, and enough for any vector load
+
+// Whether everything but the path of a motion plan is valid, as a map
+bool is_valid_map(const MotionPlan &motion_plan);
+
+} // end namespace sdmp::detail
+
+namespace sdmp::bb8::simple {
+
+struct FlatMap::Impl {
+
+  const void *mapping = nullptr;
+  std::size_t mapping_size = 0;
+
+  const detail::FlatMapHeader *header = nullptr;
+
+  // Views of the mapping
+  const double *xs = nullptr, *ys = nullptr, *rs = nullptr;
+  const std::uint32_t *ids = nullptr;
+  const std::uint32_t *cell_start = nullptr; // cell 'c' spans [cell_start[c], cell_start[c+1])
+
+  double r_max = 0.0; // the largest obstacle radius, found when the map is checked
+
+  // The index adopting the grid, see `ObstacleIndex::of`
+  mutable std::once_flag indexed;
+  mutable std::unique_ptr<const detail::ObstacleIndex> index;
+
+  Impl() = default;
+  ~Impl();
+
+  Impl(const Impl &) = delete;
+  Impl &operator=(const Impl &) = delete;
+
+};
+
+} // end namespace sdmp::bb8::simple
@@ -0,0 +1,353 @@
+#include "sdmp.hpp"
+#include "flat_map.hpp"
+#include "obstacle_index.hpp"
+#include "parallel.hpp"
+#include "planner_session.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::bb8::simple;
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  const double forever = numeric_limits<double>::infinity();
+
+  // The table never has more slots than this, over the whole plan, however long the waits
+  const double max_slots = 4096.0;
+
+  // Nor does a droid try more departures than this
+  const double max_delays = 1024.0;
+
+  // The disc of a droid, moving in a straight line at a constant speed, from the first point at the
+  // start to the second at the end, or staying at the first, from the start on, if the end is `forever`
+  struct Motion {
+
+    double start, end;
+    double x0, y0, x1, y1;
+    double radius;
+
+    double vx() const { return end > start && end < forever ? (x1 - x0) / (end - start) : 0.0; }
+    double vy() const { return end > start && end < forever ? (y1 - y0) / (end - start) : 0.0; }
+
+    double x(double t) const { return x0 + vx() * (t - start); }
+    double y(double t) const { return y0 + vy() * (t - start); }
+
+  };
+
+  // Whether the discs of two motions touch while both are under way, where they are closest
+  bool collide(const Motion &a, const Motion &b) {
+
+    const double from = max(a.start, b.start), to = min(a.end, b.end);
+    if (from > to) return false;
+
+    const double dx = a.x(from) - b.x(from), dy = a.y(from) - b.y(from);
+    const double dvx = a.vx() - b.vx(), dvy = a.vy() - b.vy();
+
+    // Motions that never end stay put, so a relative velocity always comes with a finite overlap
+    const double dv2 = dvx * dvx + dvy * dvy;
+    const double s = dv2 > 0.0 ? clamp(-(dx * dvx + dy * dvy) / dv2, 0.0, to - from) : 0.0;
+
+    return hypot(dx + s * dvx, dy + s * dvy) <= a.radius + b.radius;
+
+  }
+
+  // The motions of the droids planned so far, by the slots of time they span, so that a motion is
+  // only checked against those that overlap it in time, and the motions that never end, apart
+  class ReservationTable {
+
+   public:
+
+    explicit ReservationTable(double slot_seconds) : slot_seconds(slot_seconds) {}
+
+    void reserve(const Motion &motion) {
+      const auto index = uint32_t(motions.size());
+      motions.push_back(motion);
+      checked.push_back(0);
+      if (motion.end == forever) {
+        staying.push_back(index);
+        return;
+      }
+      for (int64_t s = slot_of(motion.start); s <= slot_of(motion.end); s++) slots[s].push_back(index);
+      last_end = max(last_end, motion.end);
+    }
+
+    // Whether the motion clears every motion reserved
+    bool is_clear(const Motion &motion) {
+
+      for (const uint32_t m : staying) {
+        if (collide(motion, motions[m])) return false;
+      }
+
+      if (motion.end == forever) {
+        // Only motions that end are left, and they all end by the last
+        return motion.start > last_end || is_clear_between(motion, motion.start, last_end);
+      }
+
+      return is_clear_between(motion, motion.start, motion.end);
+
+    }
+
+    // When every motion that ends has ended
+    double last_arrival() const { return last_end; }
+
+    double slot_length() const { return slot_seconds; }
+
+   private:
+
+    int64_t slot_of(double t) const { return int64_t(floor(t / slot_seconds)); }
+
+    bool is_clear_between(const Motion &motion, double start, double end) {
+      stamp++; // so that a motion spanning many slots is only checked once
+      for (int64_t s = slot_of(start); s <= slot_of(end); s++) {
+        const auto found = slots.find(s);
+        if (found == slots.end()) continue;
+        for (const uint32_t m : found->second) {
+          if (checked[m] == stamp) continue;
+          checked[m] = stamp;
+          if (collide(motion, motions[m])) return false;
+        }
+      }
+      return true;
+    }
+
+    const double slot_seconds;
+
+    vector<Motion> motions;
+    unordered_map<int64_t, vector<uint32_t>> slots;
+    vector<uint32_t> staying; // motions that never end
+    double last_end = 0.0;
+
+    vector<uint32_t> checked; // the stamp of the last check of each motion
+    uint32_t stamp = 0;
+
+  };
+
+  // A droid of the fleet, as planned
+  struct Droid {
+    double x_init, y_init, x_goal, y_goal, radius, speed;
+    google::protobuf::RepeatedPtrField<Coordinates> path;
+    vector<double> arrival; // at each waypoint, from the departure
+  };
+
+  // The motions of the droid, leaving at the given delay: waiting at its start until then, along
+  // its path, and staying at its goal
+  void motions_of(const Droid &droid, double delay, vector<Motion> &motions) {
+
+    const auto &path = droid.path;
+    const double r = droid.radius;
+
+    motions.clear();
+    motions.push_back({0.0, delay, droid.x_init, droid.y_init, droid.x_init, droid.y_init, r});
+    for (int i = 0; i + 1 < path.size(); i++) {
+      const auto &from = path.Get(i), &to = path.Get(i + 1);
+      motions.push_back({delay + droid.arrival[size_t(i)], delay + droid.arrival[size_t(i) + 1],
+                         from.x(), from.y(), to.x(), to.y(), r});
+    }
+    const auto &goal = path.Get(path.size() - 1);
+    motions.push_back({delay + droid.arrival.back(), forever, goal.x(), goal.y(), goal.x(), goal.y(), r});
+
+  }
+
+}
+
+// ---------------------------------------------------------------------------
+
+vector<FleetResult> sdmp::bb8::simple::find_fleet_paths(const MotionPlan &motion_plan,
+                                                        const vector<FleetDroid> &fleet,
+                                                        double timeout_seconds,
+                                                        double length_threshold,
+                                                        const PlannerOptions &options,
+                                                        unsigned thread_count)
+{
+  if (!detail::is_valid_map(motion_plan)) return {};
+  if (!isfinite(timeout_seconds) || timeout_seconds <= 0.0) return {};
+  if (!isfinite(length_threshold) || length_threshold < 0.0) return {};
+
+  vector<FleetResult> results(fleet.size());
+  vector<Droid> droids(fleet.size());
+  vector<size_t> planned; // the droids that are part of the fleet, in order
+
+  for (size_t i = 0; i < fleet.size(); i++) {
+
+    const auto &droid = fleet[i];
+    auto &result = results[i];
+    result.set_index(uint32_t(i));
+    result.set_status(-1);
+
+    const double x_init = droid.init().x(), y_init = droid.init().y();
+    const double x_goal = droid.goal().x(), y_goal = droid.goal().y();
+    const double speed = droid.speed() == 0.0 ? 1.0 : droid.speed();
+
+    if (!isfinite(x_init) || !isfinite(y_init) || !isfinite(x_goal) || !isfinite(y_goal)) continue;
+    if (!isfinite(droid.radius()) || droid.radius() <= 0.0) continue;
+    if (!isfinite(speed) || speed <= 0.0) continue;
+
+    const bool overlaps = any_of(planned.begin(), planned.end(), [&](size_t j) {
+      return hypot(x_init - droids[j].x_init, y_init - droids[j].y_init) <= droid.radius() + droids[j].radius;
+    });
+    if (overlaps) continue;
+
+    droids[i] = {x_init, y_init, x_goal, y_goal, droid.radius(), speed, {}, {}};
+    planned.push_back(i);
+
+  }
+
+  // Each path avoids where the droids after it wait, and where the droids before it stay, which
+  // is all it needs to avoid for good, so the paths are planned independently, in parallel
+
+  thread_count = detail::resolve_thread_count(thread_count);
+  const size_t rounds = (planned.size() + thread_count - 1) / max<size_t>(1, thread_count);
+  const double droid_seconds = timeout_seconds / double(max<size_t>(1, rounds));
+
+  PlannerOptions droid_options = options;
+  droid_options.thread_count = 1;
+  droid_options.improved_path_callback = nullptr; // which could not tell the droids apart
+  droid_options.path_cache = nullptr;             // whose paths are of the map without the other droids
+
+  // The map is indexed once per droid radius, and each droid plans in a copy of the index, with the
+  // other droids added as loose obstacles. The visibility graph, and clearance fields, are computed
+  // for a whole map, and cannot be updated, so droids that use them plan in a copy of the map instead
+
+  const bool updatable = options.algorithm != PlannerOptions::Algorithm::visibility_graph &&
+                         options.field_resolution == 0.0;
+
+  struct Sized {
+    MotionPlanPtr bounds; // only the droid and the bounds, which is all a session uses of its map
+    unique_ptr<const detail::ObstacleIndex> obstacles;
+  };
+
+  map<double, Sized> by_radius;
+
+  for (const size_t i : planned) {
+    auto &sized = by_radius[droids[i].radius];
+    if (!updatable || sized.bounds != nullptr) continue;
+    const double radius = droids[i].radius;
+    sized.bounds = create(radius, motion_plan.rectangle().length(), motion_plan.rectangle().width());
+    if (radius == motion_plan.bb8().radius()) {
+      sized.obstacles = make_unique<const detail::ObstacleIndex>(motion_plan, 0.0, thread_count);
+    } else {
+      MotionPlan resized(motion_plan);
+      resized.mutable_bb8()->set_radius(radius);
+      sized.obstacles = make_unique<const detail::ObstacleIndex>(resized, 0.0, thread_count);
+    }
+  }
+
+  detail::parallel_for(planned.size(), thread_count, [&](unsigned, size_t p) {
+
+    auto &droid = droids[planned[p]];
+
+    // Where each other droid is in the way
+    const auto each_other = [&](auto &&add) {
+      for (size_t q = 0; q < planned.size(); q++) {
+        if (q == p) continue;
+        const auto &other = droids[planned[q]];
+        if (q > p) add(other.x_init, other.y_init, other.radius);
+        else add(other.x_goal, other.y_goal, other.radius);
+      }
+    };
+
+    PlannerSessionPtr session;
+
+    if (updatable) {
+      const auto &sized = by_radius.at(droid.radius);
+      session = detail::create_planner_session(*sized.bounds, *sized.obstacles, droid_options);
+      if (session != nullptr) each_other([&session](double x, double y, double r) { session->add_obstacle(x, y, r); });
+    } else {
+      MotionPlan plan(motion_plan);
+      plan.clear_path();
+      plan.mutable_bb8()->set_radius(droid.radius);
+      each_other([&plan](double x, double y, double r) { add_circular_obstacle(plan, x, y, r); });
+      session = create_planner_session(plan, droid_options);
+    }
+
+    if (session == nullptr) return; // the options are not valid, as reported by the status
+
+    const int status = session->plan(droid.path, droid.x_init, droid.y_init, droid.x_goal, droid.y_goal,
+                                     droid_seconds, length_threshold);
+    results[planned[p]].set_status(status);
+    if (status != 0) return;
+
+    double length = 0.0;
+    const auto &path = droid.path;
+    droid.arrival.push_back(0.0);
+    for (int i = 0; i + 1 < path.size(); i++) {
+      length += hypot(path.Get(i + 1).x() - path.Get(i).x(), path.Get(i + 1).y() - path.Get(i).y());
+      droid.arrival.push_back(length / droid.speed);
+    }
+
+  });
+
+  // Then each droid, in turn, leaves as soon as it clears the droids before it, all the way,
+  // as reserved in the table, which slots the time by the typical segment
+
+  double total_seconds = 0.0;
+  size_t segments = 0;
+  for (const size_t i : planned) {
+    if (results[i].status() != 0) continue;
+    total_seconds += droids[i].arrival.back();
+    segments += droids[i].arrival.size() - 1;
+  }
+
+  const double mean_seconds = segments > 0 ? total_seconds / double(segments) : 1.0;
+  ReservationTable table(max({mean_seconds, total_seconds / max_slots, numeric_limits<double>::min()}));
+
+  vector<Motion> motions;
+
+  for (const size_t i : planned) {
+
+    auto &droid = droids[i];
+    auto &result = results[i];
+
+    // A droid without a path stays where it is, in the way of those after it
+    if (result.status() != 0) {
+      table.reserve({0.0, forever, droid.x_init, droid.y_init, droid.x_init, droid.y_init, droid.radius});
+      continue;
+    }
+
+    // Leaving once the droids before it have all arrived always works, unless one of them has no path
+    const double last = table.last_arrival();
+    const double step = max(table.slot_length(), last / max_delays);
+
+    bool clear = false;
+    double delay = 0.0;
+    for (;; delay = min(delay + step, last)) {
+      motions_of(droid, delay, motions);
+      clear = all_of(motions.begin(), motions.end(), [&table](const Motion &motion) { return table.is_clear(motion); });
+      if (clear || delay >= last) break;
+    }
+
+    if (!clear) {
+      result.set_status(-2);
+      table.reserve({0.0, forever, droid.x_init, droid.y_init, droid.x_init, droid.y_init, droid.radius});
+      continue;
+    }
+
+    for (const auto &motion : motions) table.reserve(motion);
+
+    const auto &path = droid.path;
+    auto &timed = *result.mutable_path();
+    timed.Reserve(path.size());
+    for (int w = 0; w < path.size(); w++) {
+      auto *waypoint = timed.Add();
+      waypoint->set_x(path.Get(w).x());
+      waypoint->set_y(path.Get(w).y());
+      waypoint->set_seconds(delay + droid.arrival[size_t(w)]);
+    }
+
+  }
+
+  return results;
+}
+
+// ---------------------------------------------------------------------------
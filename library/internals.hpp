@@ -0,0 +1,23 @@
+/*! \file
+ * The private state of the classes of the public header
+ *
+ * This is a private header of the library, it is **not** installed.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include "sdmp.hpp"
+
+namespace sdmp::detail {
+
+// The only way into the `Impl` of a public class, which is a friend of it
+struct Internals {
+
+  static const bb8::simple::FlatMap::Impl &of(const bb8::simple::FlatMap &flat_map) { return *flat_map.impl; }
+
+  static const bb8::simple::PathCache::Impl &of(const bb8::simple::PathCache &cache) { return *cache.impl; }
+  static bb8::simple::PathCache::Impl &of(bb8::simple::PathCache &cache) { return *cache.impl; }
+
+};
+
+} // end namespace sdmp::detail
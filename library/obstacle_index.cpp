@@ -0,0 +1,983 @@
+#include "obstacle_index.hpp"
+#include "internals.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::detail;
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  // Keep the grid within a small multiple of the obstacle count,
+  // no matter how elongated the bounding box of the obstacles is
+  constexpr double max_cells_per_obstacle = 4.0;
+  constexpr double max_cells_overhead = 16.0;
+
+  // The relative rounding slack used when pruning whole rings of cells
+  constexpr double relative_slack = 1.0e-12;
+
+  // The grid is rebuilt once there are more loose obstacles than this, since every query scans them
+  constexpr size_t max_loose = 64;
+
+  // Where erased obstacles are left, with a zero radius: far enough that no query can
+  // reach them, yet near enough that every kernel below stays finite (no overflow, and
+  // so no NaN) for any segment shorter than about 1e50
+  constexpr double far_away = 1.0e100;
+
+  int cell_of(double value, double origin, double inverse_cell_size, int count) {
+    const double cell = floor((value - origin) * inverse_cell_size);
+    return int(clamp(cell, 0.0, double(count - 1)));
+  }
+
+  // -------------------------------------------------------------------------
+  // Kernels over the structure-of-arrays obstacle buffers.
+  //
+  // Clearance values keep the expression of the brute-force scan, `hypot`
+  // included, so that they are bit-for-bit the same, which `sqrt` is not;
+  // the vectorized kernels are only used where the answer is boolean. Their
+  // AVX path (which AVX2 implies) handles four obstacles per step, the SSE2
+  // path two, and the scalar loop the rest, with the same arithmetic, so the
+  // results do not depend on the instruction set.
+
+  // Returns the minimum of 'clearance' and the clearance to the discs [0, n)
+  double scan_clearance(const double *xs, const double *ys, const double *rs, size_t n,
+                        double x, double y, double clearance) {
+
+    for (size_t i = 0; i < n; i++) {
+      const double distance = hypot(x - xs[i], y - ys[i]); // compute sqrt(x*x+y*y) without undue overflow or underflow
+      clearance = min(clearance, distance - rs[i]);
+    }
+
+    return clearance;
+
+  }
+
+  // Returns whether any of the discs [0, n) contains (x,y), comparing squared distances
+  bool scan_collision(const double *xs, const double *ys, const double *rs, size_t n,
+                      double x, double y) {
+
+    size_t i = 0;
+
+#if defined(__AVX__)
+    const __m256d px = _mm256_set1_pd(x), py = _mm256_set1_pd(y);
+    for (; i + 4 <= n; i += 4) {
+      const __m256d dx = _mm256_sub_pd(px, _mm256_loadu_pd(xs + i));
+      const __m256d dy = _mm256_sub_pd(py, _mm256_loadu_pd(ys + i));
+      const __m256d r = _mm256_loadu_pd(rs + i);
+      const __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+      if (_mm256_movemask_pd(_mm256_cmp_pd(d2, _mm256_mul_pd(r, r), _CMP_LE_OQ))) return true;
+    }
+#elif defined(__SSE2__)
+    const __m128d px = _mm_set1_pd(x), py = _mm_set1_pd(y);
+    for (; i + 2 <= n; i += 2) {
+      const __m128d dx = _mm_sub_pd(px, _mm_loadu_pd(xs + i));
+      const __m128d dy = _mm_sub_pd(py, _mm_loadu_pd(ys + i));
+      const __m128d r = _mm_loadu_pd(rs + i);
+      const __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+      if (_mm_movemask_pd(_mm_cmple_pd(d2, _mm_mul_pd(r, r)))) return true;
+    }
+#endif
+
+    for (; i < n; i++) {
+      const double dx = x - xs[i];
+      const double dy = y - ys[i];
+      if (dx * dx + dy * dy <= rs[i] * rs[i]) return true;
+    }
+
+    return false;
+
+  }
+
+  // Returns whether any of the discs [0, n) meets the segment from (x0,y0) to (x0+dx,y0+dy),
+  // where 'inverse_length2' is the inverse of the squared segment length
+  bool scan_segment_collision(const double *xs, const double *ys, const double *rs, size_t n,
+                              double x0, double y0, double dx, double dy, double inverse_length2) {
+
+    for (size_t i = 0; i < n; i++) {
+      const double cx = xs[i] - x0;
+      const double cy = ys[i] - y0;
+      const double t = clamp((cx * dx + cy * dy) * inverse_length2, 0.0, 1.0); // the closest point
+      const double ex = cx - t * dx;
+      const double ey = cy - t * dy;
+      if (ex * ex + ey * ey <= rs[i] * rs[i]) return true;
+    }
+
+    return false;
+
+  }
+
+  // Returns the minimum of 'clearance' and the clearance to the discs [0, n) of the segment from
+  // (x0,y0) to (x0+dx,y0+dy), where 'inverse_length2' is the inverse of the squared segment length
+  double scan_segment_clearance(const double *xs, const double *ys, const double *rs, size_t n,
+                                double x0, double y0, double dx, double dy, double inverse_length2,
+                                double clearance) {
+
+    for (size_t i = 0; i < n; i++) {
+      const double cx = xs[i] - x0;
+      const double cy = ys[i] - y0;
+      const double t = clamp((cx * dx + cy * dy) * inverse_length2, 0.0, 1.0); // the closest point
+      const double ex = cx - t * dx;
+      const double ey = cy - t * dy;
+      clearance = min(clearance, sqrt(ex * ex + ey * ey) - rs[i]);
+    }
+
+    return clearance;
+
+  }
+
+  // Returns the minimum of 't' and the first fraction along the segment from (x0,y0)
+  // to (x0+dx,y0+dy) at which it meets any of the discs [0, n)
+  double scan_segment_contact(const double *xs, const double *ys, const double *rs, size_t n,
+                              double x0, double y0, double dx, double dy, double t) {
+
+    // Solve |(x0,y0) + s (dx,dy) - c|^2 = r^2 for the smallest root 's'
+
+    const double a = dx * dx + dy * dy;
+
+    for (size_t i = 0; i < n; i++) {
+      const double px = x0 - xs[i];
+      const double py = y0 - ys[i];
+      const double c = px * px + py * py - rs[i] * rs[i];
+      if (c <= 0.0) return 0.0; // the segment starts in contact
+      const double b = px * dx + py * dy;
+      if (b >= 0.0) continue; // moving away from the center
+      const double discriminant = b * b - a * c;
+      if (discriminant < 0.0) continue; // the line misses the disc
+      const double s = c / (-b + sqrt(discriminant)); // the smaller root, without cancellation
+      t = min(t, s);
+    }
+
+    return t;
+
+  }
+
+  // Returns the first fraction in [0, 1] at which the linear function with the given
+  // end values becomes non-positive, or infinity if it never does
+  double linear_contact(double value_0, double value_1) {
+    if (!(value_0 > 0.0)) return 0.0;
+    if (value_1 > 0.0) return numeric_limits<double>::infinity();
+    return value_0 / (value_0 - value_1);
+  }
+
+}
+
+// ---------------------------------------------------------------------------
+
+ObstacleIndex::ObstacleIndex(const MotionPlan &motion_plan, double margin, unsigned thread_count)
+    : ObstacleIndex(motion_plan, margin, thread_count, true) { }
+
+ObstacleIndex::ObstacleIndex(const MotionPlan &motion_plan, double margin, unsigned thread_count, bool culls)
+    : thread_count(thread_count),
+      r_d(motion_plan.bb8().radius() + margin),
+      x_max(motion_plan.rectangle().length()),
+      y_max(motion_plan.rectangle().width())
+{
+  const int count = motion_plan.obstacle_size();
+
+  vector<double> x(count), y(count), r(count);
+  vector<uint32_t> id(count);
+
+  for (int i = 0; i < count; i++) {
+    const auto &circle(motion_plan.obstacle(i).circle());
+    x[i] = circle.coordinates().x();
+    y[i] = circle.coordinates().y();
+    r[i] = r_d + circle.radius();
+    id[i] = uint32_t(i);
+  }
+
+  slots.assign(count, no_slot);
+
+  build(std::move(x), std::move(y), std::move(r), std::move(id));
+
+  if (culls) cull();
+}
+
+ObstacleIndex::ObstacleIndex(const bb8::simple::FlatMap &flat_map, double margin, unsigned thread_count)
+    : thread_count(thread_count),
+      r_d(flat_map.droid_radius() + margin),
+      x_max(flat_map.length()),
+      y_max(flat_map.width())
+{
+  const auto &map = Internals::of(flat_map);
+  const auto &header = *map.header;
+
+  const size_t count = header.obstacle_count;
+
+  // The arrays are copied, since updates change them, but not sorted again
+
+  xs.assign(map.xs, map.xs + count);
+  ys.assign(map.ys, map.ys + count);
+  ids.assign(map.ids, map.ids + count);
+  rs.resize(count);
+  for (size_t j = 0; j < count; j++) rs[j] = r_d + map.rs[j];
+
+  slots.assign(count, no_slot);
+  for (size_t j = 0; j < count; j++) slots[ids[j]] = uint32_t(j);
+
+  live_count = count;
+
+  if (count == 0) {
+    cell_start.assign(2, 0);
+    return;
+  }
+
+  origin_x = header.origin_x;
+  origin_y = header.origin_y;
+  cell_size = header.cell_size;
+  inverse_cell_size = 1.0 / cell_size;
+  columns = int(header.columns);
+  rows = int(header.rows);
+  cell_start.assign(map.cell_start, map.cell_start + size_t(columns) * size_t(rows) + 1);
+
+  r_max = r_d + map.r_max;
+
+  // The grid spans at least the extent it was built for, which only makes the slack larger
+  slack = relative_slack * (fabs(origin_x) + fabs(origin_y) + (columns + rows) * cell_size + r_max);
+
+  cull();
+}
+
+const ObstacleIndex &ObstacleIndex::of(const bb8::simple::FlatMap &flat_map) {
+  const auto &map = Internals::of(flat_map);
+  call_once(map.indexed, [&]() { map.index = make_unique<const ObstacleIndex>(flat_map); });
+  return *map.index;
+}
+
+bool ObstacleIndex::is_valid_grid(const FlatMapHeader &header) {
+
+  // The slots of culled obstacles are tagged with the culled bit, which no identifier may reach
+  if (header.obstacle_count >= culled_bit) return false;
+
+  // Even without obstacles, since the grid is still walked, as a single empty cell at least
+  if (!isfinite(header.origin_x) || !isfinite(header.origin_y)) return false;
+  if (!isfinite(header.cell_size) || header.cell_size <= 0.0) return false;
+
+  // The same limit on the number of cells as when building the grid, which also keeps the cells countable
+  const double cell_count = double(header.columns) * double(header.rows);
+  if (header.columns == 0 || header.rows == 0) return false;
+  if (cell_count > max_cells_per_obstacle * double(header.obstacle_count) + max_cells_overhead) return false;
+
+  return true;
+
+}
+
+bool ObstacleIndex::is_indexed(const bb8::simple::FlatMap::Impl &map) {
+
+  const auto &header = *map.header;
+
+  const double inverse_cell_size = 1.0 / header.cell_size;
+  const int columns = int(header.columns), rows = int(header.rows);
+
+  for (int row = 0, c = 0; row < rows; row++) {
+    for (int column = 0; column < columns; column++, c++) {
+      for (uint32_t j = map.cell_start[c]; j < map.cell_start[c + 1]; j++) {
+        // Centers are within the grid (up to its upper edges, which fall in the last cells), and in their own cell
+        const double x = floor((map.xs[j] - header.origin_x) * inverse_cell_size);
+        const double y = floor((map.ys[j] - header.origin_y) * inverse_cell_size);
+        if (!(x >= 0.0 && x <= columns && y >= 0.0 && y <= rows)) return false;
+        if (cell_of(map.xs[j], header.origin_x, inverse_cell_size, columns) != column) return false;
+        if (cell_of(map.ys[j], header.origin_y, inverse_cell_size, rows) != row) return false;
+      }
+    }
+  }
+
+  return true;
+
+}
+
+void ObstacleIndex::build(vector<double> &&x, vector<double> &&y, vector<double> &&r, vector<uint32_t> &&id) {
+
+  const size_t count = x.size();
+
+  live_count = count;
+  erased_count = 0;
+
+  loose_xs.clear();
+  loose_ys.clear();
+  loose_rs.clear();
+  loose_ids.clear();
+
+  origin_x = origin_y = 0.0;
+  cell_size = inverse_cell_size = 1.0;
+  columns = rows = 1;
+  r_max = slack = 0.0;
+
+  if (count == 0) {
+    xs.clear();
+    ys.clear();
+    rs.clear();
+    ids.clear();
+    cell_start.assign(2, 0);
+    return;
+  }
+
+  // The grid covers the bounding rectangle and every obstacle center
+
+  double x_lo = 0.0, y_lo = 0.0, x_hi = x_max, y_hi = y_max;
+
+  for (size_t i = 0; i < count; i++) {
+    x_lo = min(x_lo, x[i]);
+    y_lo = min(y_lo, y[i]);
+    x_hi = max(x_hi, x[i]);
+    y_hi = max(y_hi, y[i]);
+    r_max = max(r_max, r[i]);
+  }
+
+  // Aim for about one obstacle per cell
+
+  const double width = x_hi - x_lo, height = y_hi - y_lo;
+
+  cell_size = sqrt((width * height) / count);
+
+  const double max_cells = max_cells_per_obstacle * count + max_cells_overhead;
+  while (ceil(width / cell_size) * ceil(height / cell_size) > max_cells) {
+    cell_size *= 2.0;
+  }
+
+  origin_x = x_lo;
+  origin_y = y_lo;
+  inverse_cell_size = 1.0 / cell_size;
+  columns = max(1, int(ceil(width / cell_size)));
+  rows = max(1, int(ceil(height / cell_size)));
+  slack = relative_slack * (fabs(x_lo) + fabs(y_lo) + width + height + r_max);
+
+  // Counting sort of the obstacles by cell
+
+  vector<int> cell(count);
+  cell_start.assign(size_t(columns) * size_t(rows) + 1, 0);
+
+  for (size_t i = 0; i < count; i++) {
+    const int column = cell_of(x[i], origin_x, inverse_cell_size, columns);
+    const int row = cell_of(y[i], origin_y, inverse_cell_size, rows);
+    cell[i] = row * columns + column;
+    cell_start[cell[i] + 1]++;
+  }
+
+  for (size_t c = 1; c < cell_start.size(); c++) {
+    cell_start[c] += cell_start[c - 1];
+  }
+
+  vector<uint32_t> next(cell_start.begin(), cell_start.end() - 1);
+  xs.resize(count);
+  ys.resize(count);
+  rs.resize(count);
+  ids.resize(count);
+
+  for (size_t i = 0; i < count; i++) {
+    const uint32_t j = next[cell[i]]++;
+    xs[j] = x[i];
+    ys[j] = y[i];
+    rs[j] = r[i];
+    ids[j] = id[i];
+    slots[id[i]] = j;
+  }
+
+}
+
+void ObstacleIndex::cull() {
+
+  culled_xs.clear();
+  culled_ys.clear();
+  culled_rs.clear();
+  culled_ids.clear();
+  dominators.clear();
+  out_of_bounds = dominated = 0;
+
+  const size_t count = xs.size();
+  if (count == 0) return;
+
+  // The slot of the dominator of each obstacle, `count` for a boundary, or `no_slot` to keep it.
+  // Each test holds by more than rounding, so that culling never changes a result, except for
+  // duplicates, which are bit-for-bit the same, and so dominate each other exactly
+  const uint32_t boundary = uint32_t(count);
+  vector<uint32_t> dominator(count, no_slot);
+
+  const auto test = [&](uint32_t i) {
+
+    const double x = xs[i], y = ys[i], r = rs[i];
+    const double tolerance = slack + relative_slack * (fabs(x) + fabs(y) + r);
+
+    // Beyond a boundary, the clearance of the boundary is never larger
+    const double radius = r - r_d;
+    if (x + radius < -tolerance || y + radius < -tolerance ||
+        x - radius > x_max + tolerance || y - radius > y_max + tolerance) {
+      dominator[i] = boundary;
+      return;
+    }
+
+    // Inside another obstacle, its clearance is never larger. Only obstacles within
+    // '-r' of the center (beyond their radius) can contain it
+    visit(x, y, -r, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t j = begin; j < end; j++) {
+        if (j == i) continue;
+        const double dx = x - xs[j], dy = y - ys[j];
+        const bool duplicate = dx == 0.0 && dy == 0.0 && r == rs[j] && ids[j] < ids[i];
+        if (duplicate || sqrt(dx * dx + dy * dy) + r + tolerance <= rs[j]) {
+          dominator[i] = j;
+          return false;
+        }
+      }
+      return true;
+    });
+
+  };
+
+  // Each obstacle is tested on its own, so those of large maps are tested in chunks, in parallel
+  const size_t chunk_size = 1 << 14, chunk_count = (count + chunk_size - 1) / chunk_size;
+  parallel_for(chunk_count, resolve_thread_count(thread_count), [&](unsigned, size_t c) {
+    for (size_t i = c * chunk_size; i < min(count, (c + 1) * chunk_size); i++) test(uint32_t(i));
+  });
+
+  // Containment is transitive, and strict (but for duplicates, which are ordered by
+  // identifier), so following dominators ends at an obstacle that is kept, or a boundary
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t j = dominator[i];
+    if (j == no_slot || j == boundary) continue;
+    while (dominator[j] != no_slot && dominator[j] != boundary) j = dominator[j];
+    dominator[i] = dominator[j] == boundary ? boundary : j;
+  }
+
+  // Set the culled obstacles aside, by dominator, before the grid is compacted
+
+  vector<uint32_t> culled;
+  for (uint32_t i = 0; i < count; i++) {
+    if (dominator[i] != no_slot) culled.push_back(i);
+  }
+
+  if (culled.empty()) return;
+
+  const auto dominator_id = [&](uint32_t i) { return dominator[i] == boundary ? no_slot : ids[dominator[i]]; };
+  stable_sort(culled.begin(), culled.end(), [&](uint32_t a, uint32_t b) { return dominator_id(a) < dominator_id(b); });
+
+  for (const uint32_t i : culled) {
+    slots[ids[i]] = culled_bit | uint32_t(culled_ids.size());
+    culled_xs.push_back(xs[i]);
+    culled_ys.push_back(ys[i]);
+    culled_rs.push_back(rs[i]);
+    culled_ids.push_back(ids[i]);
+    dominators.push_back(dominator_id(i));
+    if (dominator[i] == boundary) out_of_bounds++; else dominated++;
+  }
+
+  // Compact the grid, cell by cell, and find the largest radius of what is left
+
+  uint32_t kept = 0, begin = 0;
+  r_max = 0.0;
+
+  for (size_t c = 0; c + 1 < cell_start.size(); c++) {
+    const uint32_t end = cell_start[c + 1];
+    cell_start[c] = kept;
+    for (uint32_t j = begin; j < end; j++) {
+      if (dominator[j] != no_slot) continue;
+      xs[kept] = xs[j];
+      ys[kept] = ys[j];
+      rs[kept] = rs[j];
+      ids[kept] = ids[j];
+      slots[ids[kept]] = kept;
+      r_max = max(r_max, rs[kept]);
+      kept++;
+    }
+    begin = end;
+  }
+
+  cell_start.back() = kept;
+
+  xs.resize(kept);
+  ys.resize(kept);
+  rs.resize(kept);
+  ids.resize(kept);
+
+}
+
+// ---------------------------------------------------------------------------
+
+uint32_t ObstacleIndex::insert(double x, double y, double radius) {
+
+  const uint32_t id = uint32_t(slots.size());
+
+  slots.push_back(uint32_t(xs.size() + loose_xs.size()));
+  loose_xs.push_back(x);
+  loose_ys.push_back(y);
+  loose_rs.push_back(r_d + radius);
+  loose_ids.push_back(id);
+
+  live_count++;
+
+  maybe_rebuild();
+
+  return id;
+
+}
+
+bool ObstacleIndex::move(uint32_t id, double x, double y) {
+
+  if (id >= slots.size() || slots[id] == no_slot) return false;
+
+  const uint32_t slot = slots[id];
+
+  // A loose obstacle moves in place, and one in the grid, or culled, becomes loose
+  if ((slot & culled_bit) == 0 && slot >= xs.size()) {
+    loose_xs[slot - xs.size()] = x;
+    loose_ys[slot - xs.size()] = y;
+    return true;
+  }
+
+  double r;
+  if ((slot & culled_bit) != 0) {
+    r = forget_culled(slot);
+  } else {
+    r = rs[slot];
+    bury(slot);
+    restore_dominated(id);
+  }
+
+  slots[id] = uint32_t(xs.size() + loose_xs.size());
+  loose_xs.push_back(x);
+  loose_ys.push_back(y);
+  loose_rs.push_back(r);
+  loose_ids.push_back(id);
+
+  maybe_rebuild();
+
+  return true;
+
+}
+
+bool ObstacleIndex::erase(uint32_t id) {
+
+  if (id >= slots.size() || slots[id] == no_slot) return false;
+
+  const uint32_t slot = slots[id];
+  slots[id] = no_slot;
+  live_count--;
+
+  if ((slot & culled_bit) != 0) {
+    forget_culled(slot);
+  } else if (slot < xs.size()) {
+    bury(slot);
+    restore_dominated(id);
+  } else {
+    // Swap the last loose obstacle into the hole
+    const size_t i = slot - xs.size(), last = loose_xs.size() - 1;
+    if (i != last) {
+      loose_xs[i] = loose_xs[last];
+      loose_ys[i] = loose_ys[last];
+      loose_rs[i] = loose_rs[last];
+      loose_ids[i] = loose_ids[last];
+      slots[loose_ids[i]] = slot;
+    }
+    loose_xs.pop_back();
+    loose_ys.pop_back();
+    loose_rs.pop_back();
+    loose_ids.pop_back();
+  }
+
+  maybe_rebuild();
+
+  return true;
+
+}
+
+double ObstacleIndex::inflated_radius(uint32_t id) const {
+  if (id >= slots.size() || slots[id] == no_slot) return 0.0;
+  const uint32_t slot = slots[id];
+  if ((slot & culled_bit) != 0) return culled_rs[slot & ~culled_bit];
+  return slot < xs.size() ? rs[slot] : loose_rs[slot - xs.size()];
+}
+
+void ObstacleIndex::bury(uint32_t slot) {
+  xs[slot] = ys[slot] = far_away;
+  rs[slot] = 0.0;
+  ids[slot] = no_slot;
+  erased_count++;
+}
+
+void ObstacleIndex::restore_dominated(uint32_t id) {
+
+  const auto range = equal_range(dominators.begin(), dominators.end(), id);
+
+  for (auto k = size_t(range.first - dominators.begin()); k < size_t(range.second - dominators.begin()); k++) {
+    if (culled_ids[k] == no_slot) continue;
+    slots[culled_ids[k]] = uint32_t(xs.size() + loose_xs.size());
+    loose_xs.push_back(culled_xs[k]);
+    loose_ys.push_back(culled_ys[k]);
+    loose_rs.push_back(culled_rs[k]);
+    loose_ids.push_back(culled_ids[k]);
+    culled_ids[k] = no_slot;
+    dominated--;
+  }
+
+}
+
+double ObstacleIndex::forget_culled(uint32_t slot) {
+  const uint32_t k = slot & ~culled_bit;
+  culled_ids[k] = no_slot;
+  if (dominators[k] == no_slot) out_of_bounds--; else dominated--;
+  return culled_rs[k];
+}
+
+void ObstacleIndex::maybe_rebuild() {
+
+  // Loose obstacles slow down every query, erased ones only those near where they were
+  if (loose_xs.size() <= max_loose && erased_count <= xs.size() / 2) return;
+
+  vector<double> x, y, r;
+  vector<uint32_t> id;
+
+  x.reserve(live_count);
+  y.reserve(live_count);
+  r.reserve(live_count);
+  id.reserve(live_count);
+
+  for (size_t j = 0; j < xs.size(); j++) {
+    if (ids[j] == no_slot) continue;
+    x.push_back(xs[j]);
+    y.push_back(ys[j]);
+    r.push_back(rs[j]);
+    id.push_back(ids[j]);
+  }
+
+  x.insert(x.end(), loose_xs.begin(), loose_xs.end());
+  y.insert(y.end(), loose_ys.begin(), loose_ys.end());
+  r.insert(r.end(), loose_rs.begin(), loose_rs.end());
+  id.insert(id.end(), loose_ids.begin(), loose_ids.end());
+
+  for (size_t k = 0; k < culled_xs.size(); k++) {
+    if (culled_ids[k] == no_slot) continue;
+    x.push_back(culled_xs[k]);
+    y.push_back(culled_ys[k]);
+    r.push_back(culled_rs[k]);
+    id.push_back(culled_ids[k]);
+  }
+
+  build(std::move(x), std::move(y), std::move(r), std::move(id));
+  cull();
+
+}
+
+// ---------------------------------------------------------------------------
+
+double ObstacleIndex::boundary_clearance(double x, double y) const {
+
+  const double x_min = 0.0, y_min = 0.0;
+
+  double clearance = numeric_limits<double>::infinity();
+
+  clearance = min(clearance, (x - r_d) - x_min);
+  clearance = min(clearance, (y - r_d) - y_min);
+  clearance = min(clearance, x_max - (x + r_d));
+  clearance = min(clearance, y_max - (y + r_d));
+
+  return clearance;
+
+}
+
+template <class Scan>
+void ObstacleIndex::visit(double x, double y, const double &limit, Scan &&scan) const {
+
+  // Locate the query point, projected onto the grid. Projecting onto
+  // the (convex) grid never increases the distance to an obstacle
+  // center, so the ring bounds below remain valid lower bounds.
+
+  const double x_hi = origin_x + columns * cell_size;
+  const double y_hi = origin_y + rows * cell_size;
+  const double px = clamp(x, origin_x, x_hi);
+  const double py = clamp(y, origin_y, y_hi);
+
+  const int cx = cell_of(px, origin_x, inverse_cell_size, columns);
+  const int cy = cell_of(py, origin_y, inverse_cell_size, rows);
+
+  const int k_max = max(max(cx, columns - 1 - cx), max(cy, rows - 1 - cy));
+
+  // Distance from the projected point to the edges of its own cell
+  const double d0 = max(0.0, min(
+      min(px - (origin_x + cx * cell_size), (origin_x + (cx + 1) * cell_size) - px),
+      min(py - (origin_y + cy * cell_size), (origin_y + (cy + 1) * cell_size) - py)));
+
+  const double tolerance = slack + relative_slack * (fabs(x) + fabs(y));
+
+  // Scans the cells [column_lo, column_hi] of a row, which are contiguous
+  const auto scan_row = [&](int row, int column_lo, int column_hi) {
+    const size_t c = size_t(row) * size_t(columns);
+    const uint32_t begin = cell_start[c + column_lo], end = cell_start[c + column_hi + 1];
+    return begin == end || scan(begin, end);
+  };
+
+  // Visit rings of cells around the query point, nearest first, until no
+  // obstacle in the remaining rings can have a clearance below the limit
+
+  for (int k = 0; k <= k_max; k++) {
+
+    if (k > 0) {
+      const double lower_bound = (k - 1) * cell_size + d0 - r_max;
+      if (lower_bound > limit + tolerance) return;
+    }
+
+    const int row_lo = max(0, cy - k), row_hi = min(rows - 1, cy + k);
+    const int column_lo = max(0, cx - k), column_hi = min(columns - 1, cx + k);
+
+    for (int row = row_lo; row <= row_hi; row++) {
+      if (row == cy - k || row == cy + k) {
+        if (!scan_row(row, column_lo, column_hi)) return;
+      } else {
+        if (cx - k >= 0 && !scan_row(row, cx - k, cx - k)) return;
+        if (cx + k < columns && !scan_row(row, cx + k, cx + k)) return;
+      }
+    }
+
+  }
+
+}
+
+double ObstacleIndex::clearance(double x, double y) const {
+
+  double clearance = boundary_clearance(x, y);
+
+  if (!loose_xs.empty()) {
+    clearance = scan_clearance(loose_xs.data(), loose_ys.data(), loose_rs.data(), loose_xs.size(), x, y, clearance);
+  }
+
+  if (xs.empty()) return clearance;
+
+  visit(x, y, clearance, [&](uint32_t begin, uint32_t end) {
+    clearance = scan_clearance(&xs[begin], &ys[begin], &rs[begin], end - begin, x, y, clearance);
+    return true;
+  });
+
+  return clearance;
+
+}
+
+bool ObstacleIndex::is_valid(double x, double y) const {
+
+  if (!(boundary_clearance(x, y) > 0.0)) return false;
+
+  if (!loose_xs.empty() && scan_collision(loose_xs.data(), loose_ys.data(), loose_rs.data(), loose_xs.size(), x, y)) {
+    return false;
+  }
+
+  if (xs.empty()) return true;
+
+  // Only obstacles with a non-positive clearance matter
+  const double limit = 0.0;
+
+  bool collision = false;
+
+  visit(x, y, limit, [&](uint32_t begin, uint32_t end) {
+    collision = scan_collision(&xs[begin], &ys[begin], &rs[begin], end - begin, x, y);
+    return !collision;
+  });
+
+  return !collision;
+
+}
+
+// ---------------------------------------------------------------------------
+
+template <class Scan>
+void ObstacleIndex::visit(double x0, double y0, double x1, double y1, double extra_reach, Scan &&scan) const {
+
+  // Scans the cells [column_lo, column_hi] of a row, which are contiguous
+  const auto scan_row = [&](int row, int column_lo, int column_hi) {
+    const size_t c = size_t(row) * size_t(columns);
+    const uint32_t begin = cell_start[c + column_lo], end = cell_start[c + column_hi + 1];
+    return begin == end || scan(begin, end);
+  };
+
+  if (columns == 1 && rows == 1) {
+    scan_row(0, 0, 0);
+    return;
+  }
+
+  // Only obstacles whose center is within 'reach' of the segment can meet it
+  // (or come within the extra reach of it), so for each row of cells, visit
+  // only the columns spanned by the part of the segment within 'reach' of that row
+
+  const double reach = r_max + extra_reach + slack + relative_slack * (fabs(x0) + fabs(y0) + fabs(x1) + fabs(y1));
+  const double dx = x1 - x0, dy = y1 - y0;
+
+  const int row_lo = cell_of(min(y0, y1) - reach, origin_y, inverse_cell_size, rows);
+  const int row_hi = cell_of(max(y0, y1) + reach, origin_y, inverse_cell_size, rows);
+
+  for (int row = row_lo; row <= row_hi; row++) {
+
+    const double band_lo = origin_y + row * cell_size - reach;
+    const double band_hi = origin_y + (row + 1) * cell_size + reach;
+
+    double t_lo = 0.0, t_hi = 1.0;
+    if (dy != 0.0) {
+      const double t_a = (band_lo - y0) / dy, t_b = (band_hi - y0) / dy;
+      t_lo = max(t_lo, min(t_a, t_b));
+      t_hi = min(t_hi, max(t_a, t_b));
+      if (t_lo > t_hi) continue;
+    } else if (y0 < band_lo || y0 > band_hi) {
+      continue;
+    }
+
+    const double x_a = x0 + t_lo * dx, x_b = x0 + t_hi * dx;
+    const int column_lo = cell_of(min(x_a, x_b) - reach, origin_x, inverse_cell_size, columns);
+    const int column_hi = cell_of(max(x_a, x_b) + reach, origin_x, inverse_cell_size, columns);
+
+    if (!scan_row(row, column_lo, column_hi)) return;
+
+  }
+
+}
+
+bool ObstacleIndex::is_valid(double x0, double y0, double x1, double y1) const {
+
+  // The boundary clearance is concave along the segment, so checking the end points suffices
+  if (!is_valid(x0, y0) || !is_valid(x1, y1)) return false;
+
+  const double dx = x1 - x0, dy = y1 - y0;
+  const double length2 = dx * dx + dy * dy;
+
+  if (length2 == 0.0) return true;
+
+  if (!loose_xs.empty() && scan_segment_collision(loose_xs.data(), loose_ys.data(), loose_rs.data(), loose_xs.size(),
+                                                  x0, y0, dx, dy, 1.0 / length2)) {
+    return false;
+  }
+
+  if (xs.empty()) return true;
+
+  bool collision = false;
+
+  visit(x0, y0, x1, y1, 0.0, [&](uint32_t begin, uint32_t end) {
+    collision = scan_segment_collision(&xs[begin], &ys[begin], &rs[begin], end - begin,
+                                       x0, y0, dx, dy, 1.0 / length2);
+    return !collision;
+  });
+
+  return !collision;
+
+}
+
+bool ObstacleIndex::is_valid_path(const vector<double> &waypoints) const {
+  if (waypoints.size() == 2) return is_valid(waypoints[0], waypoints[1]);
+  for (size_t i = 0; i + 3 < waypoints.size(); i += 2) {
+    if (!is_valid(waypoints[i], waypoints[i + 1], waypoints[i + 2], waypoints[i + 3])) return false;
+  }
+  return true;
+}
+
+bool ObstacleIndex::is_valid_path(const MotionPlan &motion_plan, const vector<double> &waypoints) {
+
+  const double r_d = motion_plan.bb8().radius();
+  const double x_max = motion_plan.rectangle().length(), y_max = motion_plan.rectangle().width();
+
+  const size_t n = waypoints.size() / 2;
+
+  // The boundary clearance is concave along each segment, so checking the waypoints suffices
+  for (size_t i = 0; i < n; i++) {
+    const double x = waypoints[2 * i], y = waypoints[2 * i + 1];
+    const double clearance = min({(x - r_d) - 0.0, (y - r_d) - 0.0, x_max - (x + r_d), y_max - (y + r_d)});
+    if (!(clearance > 0.0)) return false;
+  }
+
+  if (n == 0) return true;
+
+  // Each obstacle is read once, and checked against every waypoint, and every segment
+  for (const auto &obstacle : motion_plan.obstacle()) {
+
+    const auto &circle = obstacle.circle();
+    const double cx = circle.coordinates().x(), cy = circle.coordinates().y(), r = r_d + circle.radius();
+
+    if (scan_collision(&cx, &cy, &r, 1, waypoints[0], waypoints[1])) return false;
+
+    for (size_t i = 1; i < n; i++) {
+      const double x0 = waypoints[2 * i - 2], y0 = waypoints[2 * i - 1];
+      const double x1 = waypoints[2 * i], y1 = waypoints[2 * i + 1];
+      if (scan_collision(&cx, &cy, &r, 1, x1, y1)) return false;
+      const double dx = x1 - x0, dy = y1 - y0;
+      const double length2 = dx * dx + dy * dy;
+      if (length2 > 0.0 && scan_segment_collision(&cx, &cy, &r, 1, x0, y0, dx, dy, 1.0 / length2)) return false;
+    }
+
+  }
+
+  return true;
+
+}
+
+double ObstacleIndex::clearance(double x0, double y0, double x1, double y1) const {
+
+  // The boundary clearance is concave along the segment, so it is smallest at an end point,
+  // and the smaller end point clearance bounds the clearance of the segment from above
+
+  const double limit = min(clearance(x0, y0), clearance(x1, y1));
+
+  const double dx = x1 - x0, dy = y1 - y0;
+  const double length2 = dx * dx + dy * dy;
+
+  if (length2 == 0.0) return limit;
+
+  double clearance = limit;
+
+  if (!loose_xs.empty()) {
+    clearance = scan_segment_clearance(loose_xs.data(), loose_ys.data(), loose_rs.data(), loose_xs.size(),
+                                       x0, y0, dx, dy, 1.0 / length2, clearance);
+  }
+
+  if (xs.empty()) return clearance;
+
+  // Only obstacles within the limit of the segment (beyond their radius) can lower it
+
+  visit(x0, y0, x1, y1, max(0.0, limit), [&](uint32_t begin, uint32_t end) {
+    clearance = scan_segment_clearance(&xs[begin], &ys[begin], &rs[begin], end - begin,
+                                       x0, y0, dx, dy, 1.0 / length2, clearance);
+    return true;
+  });
+
+  return clearance;
+
+}
+
+double ObstacleIndex::first_contact(double x0, double y0, double x1, double y1) const {
+
+  const double x_min = 0.0, y_min = 0.0;
+
+  // The boundary clearance terms are linear along the segment
+
+  double t = numeric_limits<double>::infinity();
+
+  t = min(t, linear_contact((x0 - r_d) - x_min, (x1 - r_d) - x_min));
+  t = min(t, linear_contact((y0 - r_d) - y_min, (y1 - r_d) - y_min));
+  t = min(t, linear_contact(x_max - (x0 + r_d), x_max - (x1 + r_d)));
+  t = min(t, linear_contact(y_max - (y0 + r_d), y_max - (y1 + r_d)));
+
+  const double dx = x1 - x0, dy = y1 - y0;
+
+  if (t == 0.0) return t;
+
+  if (dx == 0.0 && dy == 0.0) return is_valid(x0, y0) ? t : 0.0;
+
+  if (!loose_xs.empty()) {
+    t = scan_segment_contact(loose_xs.data(), loose_ys.data(), loose_rs.data(), loose_xs.size(), x0, y0, dx, dy, t);
+  }
+
+  if (xs.empty() || t == 0.0) return t;
+
+  visit(x0, y0, x1, y1, 0.0, [&](uint32_t begin, uint32_t end) {
+    t = scan_segment_contact(&xs[begin], &ys[begin], &rs[begin], end - begin, x0, y0, dx, dy, t);
+    return t > 0.0;
+  });
+
+  return t;
+
+}
+
+// ---------------------------------------------------------------------------
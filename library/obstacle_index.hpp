@@ -0,0 +1,203 @@
+/*! \file
+ * A spatial index over the circular obstacles of a `MotionPlan`
+ *
+ * This is a private header of the library, it is **not** installed.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include "sdmp.hpp"
+#include "flat_map.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace sdmp::detail {
+
+/**
+ * \brief A uniform grid over the circular obstacles of a `BB8` motion plan.
+ *
+ * The obstacles are bucketed by the cell containing their center,
+ * and stored contiguously, cell by cell, as flat structure-of-arrays
+ * buffers (`x`, `y`, and radius inflated by the droid radius), so
+ * that a query only visits the cells near the query point, and scans
+ * each row of cells with a vectorized kernel. The grid is built once
+ * (per `find_path` call), and may be queried concurrently.
+ *
+ * Obstacles may also be inserted, moved, and erased afterwards, but
+ * not concurrently with queries. Each update takes constant time:
+ * an erased obstacle is left in its cell, far out of reach, and an
+ * inserted (or moved) one is appended to a short list of "loose"
+ * obstacles, which every query scans in full. The grid is rebuilt
+ * once that list, or the erased obstacles, grow too many.
+ *
+ * Obstacles that cannot change any clearance are culled when the
+ * grid is built, and never checked: those wholly beyond a boundary
+ * (by more than rounding), whose clearance is never below that of
+ * the boundary, and those inside another obstacle (by more than
+ * rounding), or duplicates of one, whose clearance is never below
+ * that of the obstacle containing them, their dominator. A culled
+ * obstacle is restored, as loose, when its dominator is moved or
+ * erased.
+ *
+ * Cell pruning and culling are conservative, so clearance values are
+ * **exactly** those of the brute-force computation over all obstacles,
+ * since the same expression is evaluated for every obstacle that could
+ * be the nearest; only the boolean checks are vectorized.
+ */
+class ObstacleIndex {
+
+ public:
+
+  // Assumption on input: assert(is_valid(motion_plan))
+  //
+  // A positive margin inflates the droid by that much, so that anything the
+  // index accepts clears every obstacle and boundary by more than the margin.
+  // Culling runs on (at most) the given number of threads, zero for one per
+  // hardware thread, whenever the grid is built
+  explicit ObstacleIndex(const MotionPlan &motion_plan, double margin = 0.0, unsigned thread_count = 0);
+
+  // Adopts the grid of a flat map, as it is sorted in it, instead of building one
+  explicit ObstacleIndex(const bb8::simple::FlatMap &map, double margin = 0.0, unsigned thread_count = 0);
+
+  // Sets the number of threads of later rebuilds, such as that of a copy, in a session of its own
+  void set_thread_count(unsigned count) { thread_count = count; }
+
+  // The index adopting the grid of a flat map, without a margin, built the first time it
+  // is needed, and kept with the map, since the map never changes
+  static const ObstacleIndex &of(const bb8::simple::FlatMap &map);
+
+  // Whether the grid of a flat map header is one the index could have built, for as
+  // many obstacles as it could index, which bounds the cells before they are counted
+  static bool is_valid_grid(const FlatMapHeader &header);
+
+  // Whether the obstacles of a flat map, with a valid grid, are sorted into it by the
+  // rules of the index, within its cells, so that it can be adopted
+  static bool is_indexed(const bb8::simple::FlatMap::Impl &map);
+
+  // Returns the distance from the droid at (x,y) to the nearest obstacle or boundary
+  double clearance(double x, double y) const;
+
+  // Returns whether the droid at (x,y) is clear of every obstacle and boundary, by
+  // comparing squared distances, so it is cheaper than `clearance(x, y) > 0.0`, and
+  // may return early, but may disagree with it within rounding of contact
+  bool is_valid(double x, double y) const;
+
+  // Returns whether the droid, swept along the segment from (x0,y0) to (x1,y1),
+  // is clear of every obstacle and boundary, exactly (not by sampling)
+  bool is_valid(double x0, double y0, double x1, double y1) const;
+
+  // Returns whether the droid, swept along the path, given by the 'x' and 'y' of each
+  // waypoint in turn, is clear of every obstacle and boundary, at each waypoint and along each segment
+  bool is_valid_path(const std::vector<double> &waypoints) const;
+
+  // As above, but by one scan of the obstacles of the motion plan, with the same arithmetic,
+  // which is much quicker than indexing them, for a path of a few segments
+  //
+  // Assumption on input: assert(is_valid_map(motion_plan))
+  static bool is_valid_path(const MotionPlan &motion_plan, const std::vector<double> &waypoints);
+
+  // Returns the smallest distance from the droid, swept along the segment from
+  // (x0,y0) to (x1,y1), to any obstacle or boundary, exactly
+  double clearance(double x0, double y0, double x1, double y1) const;
+
+  // Returns the fraction along the segment from (x0,y0) to (x1,y1) at which the
+  // swept droid first touches an obstacle or boundary, or a value above one if
+  // it never does
+  double first_contact(double x0, double y0, double x1, double y1) const;
+
+  // Inserts an obstacle, and returns its identifier; the obstacles of the motion
+  // plan are identified by their index in it
+  std::uint32_t insert(double x, double y, double radius);
+
+  // Moves, or erases, the obstacle with the given identifier, and returns
+  // `false` if there is none
+  bool move(std::uint32_t id, double x, double y);
+  bool erase(std::uint32_t id);
+
+  // Returns the radius of the obstacle with the given identifier, inflated by the
+  // droid radius, or zero if there is none
+  double inflated_radius(std::uint32_t id) const;
+
+  std::size_t size() const { return live_count; }
+
+  // Returns how many of the obstacles are culled, and not checked, as beyond a boundary, or inside another
+  std::size_t out_of_bounds_count() const { return out_of_bounds; }
+  std::size_t dominated_count() const { return dominated; }
+
+  // Writes the grid, with every obstacle, as sorted into it
+  friend bool bb8::simple::save_flat_map(const MotionPlan &motion_plan, std::ostream &out);
+
+ private:
+
+  // Without culling, so that the grid holds every obstacle
+  ObstacleIndex(const MotionPlan &motion_plan, double margin, unsigned thread_count, bool culls);
+
+  unsigned thread_count; // of culling, zero for one per hardware thread
+
+  double r_d;          // the droid radius, plus the margin
+  double x_max, y_max; // the bounding rectangle, with origin (0,0)
+
+  // The obstacles, sorted by cell, row-major, with radii inflated by the droid radius
+  std::vector<double> xs, ys, rs;
+
+  // The obstacles inserted, or moved, since the grid was built, in no particular order
+  std::vector<double> loose_xs, loose_ys, loose_rs;
+
+  // The identifier of each obstacle, in the grid, and loose
+  std::vector<std::uint32_t> ids, loose_ids;
+
+  // The culled obstacles, sorted by the identifier of their dominator, or `no_slot` for
+  // those beyond a boundary; the identifier of one that was moved, or erased, is `no_slot`
+  std::vector<double> culled_xs, culled_ys, culled_rs;
+  std::vector<std::uint32_t> culled_ids, dominators;
+
+  // Where each identifier is: a slot of the grid, a loose slot after those, a culled slot
+  // (with the `culled_bit` set), or `no_slot`
+  std::vector<std::uint32_t> slots;
+  static constexpr std::uint32_t no_slot = ~std::uint32_t(0);
+  static constexpr std::uint32_t culled_bit = std::uint32_t(1) << 31;
+
+  std::size_t live_count = 0;
+  std::size_t erased_count = 0; // left in the grid
+  std::size_t out_of_bounds = 0, dominated = 0; // culled
+
+  std::vector<std::uint32_t> cell_start; // cell 'c' spans [cell_start[c], cell_start[c+1])
+
+  double origin_x = 0.0, origin_y = 0.0;
+  double cell_size = 1.0, inverse_cell_size = 1.0;
+  int columns = 1, rows = 1;
+
+  double r_max = 0.0; // the largest inflated obstacle radius
+  double slack = 0.0; // absorbs rounding when pruning cells, so pruning never changes the result
+
+  // Sorts the given obstacles into a new grid, replacing the current one
+  void build(std::vector<double> &&x, std::vector<double> &&y, std::vector<double> &&r,
+             std::vector<std::uint32_t> &&id);
+
+  // Takes the obstacles that cannot change any clearance out of the grid
+  void cull();
+
+  // Rebuilds the grid from the live obstacles, if it has too many loose or erased ones
+  void maybe_rebuild();
+
+  // Makes the live obstacles that the given one dominates loose, before it moves, or goes
+  void restore_dominated(std::uint32_t id);
+
+  // Forgets the culled obstacle in the given culled slot, and returns its inflated radius
+  double forget_culled(std::uint32_t slot);
+
+  // Leaves the obstacle in the given slot of the grid, out of reach of any query
+  void bury(std::uint32_t slot);
+
+  double boundary_clearance(double x, double y) const;
+
+  template <class Scan>
+  void visit(double x, double y, const double &limit, Scan &&scan) const;
+
+  template <class Scan>
+  void visit(double x0, double y0, double x1, double y1, double extra_reach, Scan &&scan) const;
+
+};
+
+} // end namespace sdmp::detail
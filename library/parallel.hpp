@@ -0,0 +1,276 @@
+/*! \file
+ * A small work-stealing parallel loop, and the pooled teams of threads it runs on
+ *
+ * This is a private header of the library, it is **not** installed.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace sdmp::detail {
+
+// Returns the given thread count, or one per hardware thread if zero
+inline unsigned resolve_thread_count(unsigned thread_count) {
+  return thread_count > 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * \brief A team of threads, parked between runs, that each run the same body.
+ *
+ * The calling thread is worker zero, so a team of one has no thread
+ * of its own. Work that runs again and again, such as the lanes of a
+ * planner session, or the queries of a batch, is then handed to the
+ * same threads each time, instead of spawning new ones.
+ *
+ * Runs are serialized, so a team can be shared between callers.
+ */
+class ThreadTeam {
+
+ public:
+
+  explicit ThreadTeam(unsigned thread_count) {
+    for (unsigned w = 1; w < std::max(1u, thread_count); w++) threads.emplace_back(&ThreadTeam::work, this, w);
+  }
+
+  ~ThreadTeam() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    ready.notify_all();
+    for (auto &thread : threads) thread.join();
+  }
+
+  ThreadTeam(const ThreadTeam &) = delete;
+  ThreadTeam &operator=(const ThreadTeam &) = delete;
+
+  unsigned size() const { return unsigned(threads.size()) + 1; }
+
+  // Calls `body(worker)` for every worker, and returns once they all have
+  template <class Body>
+  void run(Body &&body) {
+    typedef std::remove_reference_t<Body> Type;
+    std::lock_guard<std::mutex> running(run_mutex);
+    if (threads.empty()) {
+      body(0u);
+      return;
+    }
+    dispatch(const_cast<void *>(static_cast<const void *>(&body)), [](void *context, unsigned w) {
+      (*static_cast<Type *>(context))(w);
+    });
+  }
+
+ private:
+
+  // Hands the body to the threads, without allocating, runs it as worker zero, and waits for the threads
+  void dispatch(void *context, void (*call)(void *, unsigned)) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      body_context = context;
+      body_call = call;
+      busy = threads.size();
+      generation++;
+    }
+    ready.notify_all();
+    call(context, 0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return busy == 0; });
+  }
+
+  void work(unsigned w) {
+    std::uint64_t seen = 0;
+    for (;;) {
+      void *context;
+      void (*call)(void *, unsigned);
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [&]() { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        context = body_context;
+        call = body_call;
+      }
+      call(context, w);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy == 0) done.notify_one();
+    }
+  }
+
+  std::mutex run_mutex; // held for a whole run
+
+  std::mutex mutex;
+  std::condition_variable ready, done;
+  std::uint64_t generation = 0; // of the runs, which the threads count to notice a new one
+  std::size_t busy = 0;         // threads yet to finish the current run
+  bool stopping = false;
+  void *body_context = nullptr;
+  void (*body_call)(void *, unsigned) = nullptr;
+
+  std::vector<std::thread> threads;
+
+};
+
+/**
+ * \brief The teams parked between calls, lent to one caller at a time.
+ *
+ * Calls that each run in parallel, one after another, such as the
+ * batches of a server, then reuse the same threads, instead of
+ * spawning new ones every time, while concurrent calls each get a
+ * team of their own. Only a few idle teams are kept.
+ */
+class TeamPool {
+
+ public:
+
+  // Returns a team to the pool, or ends it if the pool is full
+  struct Release {
+    void operator()(ThreadTeam *team) const {
+      std::unique_ptr<ThreadTeam> owned(team);
+      auto &pool = idle();
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      if (pool.teams.size() < max_idle) pool.teams.push_back(std::move(owned));
+    }
+  };
+
+  typedef std::unique_ptr<ThreadTeam, Release> Lease;
+
+  // A parked team of the given size, or a new one
+  static Lease lend(unsigned thread_count) {
+    thread_count = std::max(1u, thread_count);
+    auto &pool = idle();
+    {
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      for (auto &team : pool.teams) {
+        if (team->size() != thread_count) continue;
+        Lease lease(team.release());
+        team.swap(pool.teams.back());
+        pool.teams.pop_back();
+        return lease;
+      }
+    }
+    return Lease(new ThreadTeam(thread_count));
+  }
+
+ private:
+
+  static constexpr std::size_t max_idle = 8;
+
+  struct Idle {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadTeam>> teams;
+  };
+
+  static Idle &idle() {
+    static Idle pool;
+    return pool;
+  }
+
+};
+
+/**
+ * \brief Calls `body(worker, i)` for every `i` in `[0, count)`, in parallel.
+ *
+ * The indices are split evenly between the workers, the calling
+ * thread being worker zero. Each worker takes indices from the
+ * front of its own range, and when that runs out, steals the back
+ * half of the largest remaining range, so that uneven work (such
+ * as queries that finish early) stays balanced.
+ *
+ * The `worker` argument is in `[0, team.size())`, so it can
+ * index per-worker state, such as a planner session.
+ */
+template <class Body>
+void parallel_for(ThreadTeam &team, std::size_t count, Body &&body) {
+
+  const unsigned thread_count = team.size();
+
+  if (thread_count == 1 || count <= 1) {
+    for (std::size_t i = 0; i < count; i++) body(0u, i);
+    return;
+  }
+
+  struct Range {
+    std::mutex mutex;
+    std::size_t begin = 0, end = 0;
+  };
+
+  std::unique_ptr<Range[]> ranges(new Range[thread_count]);
+
+  for (unsigned w = 0; w < thread_count; w++) {
+    ranges[w].begin = count * w / thread_count;
+    ranges[w].end = count * (w + 1) / thread_count;
+  }
+
+  // Takes the next index of the worker's own range
+  const auto take = [&](unsigned w, std::size_t &i) {
+    std::lock_guard<std::mutex> lock(ranges[w].mutex);
+    if (ranges[w].begin == ranges[w].end) return false;
+    i = ranges[w].begin++;
+    return true;
+  };
+
+  // Moves the back half of the largest other range into the worker's own range
+  const auto steal = [&](unsigned w) {
+    for (;;) {
+      unsigned victim = w;
+      std::size_t largest = 0;
+      for (unsigned v = 0; v < thread_count; v++) {
+        if (v == w) continue;
+        std::lock_guard<std::mutex> lock(ranges[v].mutex);
+        const std::size_t size = ranges[v].end - ranges[v].begin;
+        if (size > largest) { largest = size; victim = v; }
+      }
+      if (victim == w) return false;
+      std::scoped_lock lock(ranges[w].mutex, ranges[victim].mutex);
+      const std::size_t size = ranges[victim].end - ranges[victim].begin;
+      if (size == 0) continue; // someone else got there first
+      const std::size_t middle = ranges[victim].end - (size + 1) / 2;
+      ranges[w].begin = middle;
+      ranges[w].end = ranges[victim].end;
+      ranges[victim].end = middle;
+      return true;
+    }
+  };
+
+  const auto work = [&](unsigned w) {
+    std::size_t i;
+    do {
+      while (take(w, i)) body(w, i);
+    } while (steal(w));
+  };
+
+  team.run(work);
+
+}
+
+/**
+ * \brief Calls `body(worker, i)` for every `i` in `[0, count)`, in parallel,
+ * on a team of (at most) `thread_count` threads, lent by the pool.
+ *
+ * The `worker` argument is in `[0, thread_count)`.
+ */
+template <class Body>
+void parallel_for(std::size_t count, unsigned thread_count, Body &&body) {
+
+  thread_count = unsigned(std::min<std::size_t>(std::max(1u, thread_count), std::max<std::size_t>(1, count)));
+
+  if (thread_count == 1) {
+    for (std::size_t i = 0; i < count; i++) body(0u, i);
+    return;
+  }
+
+  const auto team = TeamPool::lend(thread_count);
+  parallel_for(*team, count, body);
+
+}
+
+} // end namespace sdmp::detail
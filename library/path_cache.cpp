@@ -0,0 +1,350 @@
+#include "sdmp.hpp"
+#include "internals.hpp"
+#include "path_cache.hpp"
+
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::bb8::simple;
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  // The path cache stream header: magic, format version, and quantum
+  const char path_cache_magic[8] = {'S', 'D', 'M', 'P', 'P', 'A', 'T', 'H'};
+  const uint32_t path_cache_version = 1;
+
+  // Quantized coordinates stay well within 64 bits
+  const double max_quantized = 0x1p62;
+
+  // What an entry costs besides its waypoints: the entry, and the nodes of the list and of the map
+  const size_t entry_overhead = sizeof(PathCache::Impl::Entry) + 8 * sizeof(void *);
+
+  void write_word(ostream &out, uint64_t word, int bytes) {
+    for (int i = 0; i < bytes; i++) out.put(char((word >> (8 * i)) & 0xff)); // little-endian
+  }
+
+  bool read_word(istream &in, uint64_t &word, int bytes) {
+    word = 0;
+    for (int i = 0; i < bytes; i++) {
+      const int c = in.get();
+      if (c == char_traits<char>::eof()) return false;
+      word |= uint64_t(uint8_t(c)) << (8 * i);
+    }
+    return true;
+  }
+
+  uint64_t bits_of(double value) {
+    uint64_t word;
+    memcpy(&word, &value, sizeof(word));
+    return word;
+  }
+
+  double double_of(uint64_t word) {
+    double value;
+    memcpy(&value, &word, sizeof(value));
+    return value;
+  }
+
+}
+
+// ---------------------------------------------------------------------------
+
+bool PathCache::Impl::Key::operator==(const Key &other) const {
+  return map_hash == other.map_hash &&
+         x_init == other.x_init && y_init == other.y_init &&
+         x_goal == other.x_goal && y_goal == other.y_goal;
+}
+
+size_t PathCache::Impl::KeyHash::operator()(const Key &key) const {
+  uint64_t hash = key.map_hash; // already well mixed
+  for (const int64_t value : {key.x_init, key.y_init, key.x_goal, key.y_goal}) {
+    hash = (hash ^ uint64_t(value)) * 0x100000001b3ull;
+    hash ^= hash >> 29;
+  }
+  return size_t(hash);
+}
+
+bool PathCache::Impl::key_of(uint64_t map_hash, double x_init, double y_init, double x_goal, double y_goal,
+                             Key &key) const {
+
+  int64_t quantized[4];
+  const double coordinates[4] = {x_init, y_init, x_goal, y_goal};
+
+  for (int i = 0; i < 4; i++) {
+    const double q = coordinates[i] / quantum;
+    if (!(fabs(q) < max_quantized)) return false; // and not NaN
+    quantized[i] = llround(q);
+  }
+
+  key = {map_hash, quantized[0], quantized[1], quantized[2], quantized[3]};
+  return true;
+
+}
+
+bool PathCache::Impl::find(const Key &key, double x_init, double y_init, double x_goal, double y_goal,
+                           const function<bool(const vector<double> &waypoints)> &is_clear,
+                           google::protobuf::RepeatedPtrField<Coordinates> &path) {
+
+  vector<double> waypoints;
+
+  {
+    lock_guard<mutex> lock(cache_mutex);
+    const auto found = by_key.find(key);
+    if (found != by_key.end()) {
+      recent.splice(recent.begin(), recent, found->second);
+      waypoints = found->second->waypoints;
+    }
+  }
+
+  if (waypoints.empty()) {
+    misses++;
+    return false;
+  }
+
+  // Within a quantum of the cached query, so the ends move a little, and the path is checked
+  // in full, outside the lock, as `verify_path` does
+
+  const size_t n = waypoints.size();
+  waypoints[0] = x_init;
+  waypoints[1] = y_init;
+  waypoints[n - 2] = x_goal;
+  waypoints[n - 1] = y_goal;
+
+  if (!is_clear(waypoints)) {
+    misses++;
+    return false;
+  }
+
+  path.Clear();
+  path.Reserve(int(n / 2));
+  for (size_t i = 0; i < n; i += 2) {
+    auto *coordinates = path.Add();
+    coordinates->set_x(waypoints[i]);
+    coordinates->set_y(waypoints[i + 1]);
+  }
+
+  hits++;
+  return true;
+
+}
+
+bool PathCache::Impl::insert(const Key &key, double x_init, double y_init, double x_goal, double y_goal,
+                             const google::protobuf::RepeatedPtrField<Coordinates> &path) {
+
+  // Only whole paths, and not approximate ones, which stop short of the goal
+  if (path.size() < 2) return false;
+  const auto &first = path.Get(0), &last = path.Get(path.size() - 1);
+  if (first.x() != x_init || first.y() != y_init || last.x() != x_goal || last.y() != y_goal) return false;
+
+  vector<double> waypoints;
+  waypoints.reserve(2 * size_t(path.size()));
+  for (const auto &coordinates : path) {
+    if (!isfinite(coordinates.x()) || !isfinite(coordinates.y())) return false;
+    waypoints.push_back(coordinates.x());
+    waypoints.push_back(coordinates.y());
+  }
+
+  lock_guard<mutex> lock(cache_mutex);
+  return store(key, std::move(waypoints));
+
+}
+
+bool PathCache::Impl::store(const Key &key, vector<double> &&waypoints) {
+
+  const size_t entry_bytes = entry_overhead + waypoints.size() * sizeof(double);
+  if (entry_bytes > max_bytes) return false;
+
+  const auto found = by_key.find(key);
+  if (found != by_key.end()) {
+    bytes -= found->second->bytes;
+    recent.erase(found->second);
+    by_key.erase(found);
+  }
+
+  recent.push_front({key, std::move(waypoints), entry_bytes});
+  by_key.emplace(key, recent.begin());
+  bytes += entry_bytes;
+
+  // The new entry fits on its own, so it is never the one evicted
+  while (bytes > max_bytes) {
+    bytes -= recent.back().bytes;
+    by_key.erase(recent.back().key);
+    recent.pop_back();
+  }
+
+  return true;
+
+}
+
+double sdmp::detail::path_length(const google::protobuf::RepeatedPtrField<Coordinates> &path) {
+  double length = 0.0;
+  for (int i = 0; i + 1 < path.size(); i++) {
+    length += hypot(path.Get(i + 1).x() - path.Get(i).x(), path.Get(i + 1).y() - path.Get(i).y());
+  }
+  return length;
+}
+
+void sdmp::detail::report_cached_path(PlannerReport &report, const google::protobuf::RepeatedPtrField<Coordinates> &path,
+                                      double seconds) {
+  const double cost = path_length(path);
+  report.Clear();
+  report.set_status(PlannerReport::EXACT_SOLUTION);
+  report.set_first_solution_seconds(seconds);
+  report.set_planning_seconds(seconds);
+  report.set_motion_checks(uint64_t(path.size() - 1));
+  report.set_cost(cost);
+  report.set_cached(true);
+  auto *point = report.add_convergence();
+  point->set_seconds(seconds);
+  point->set_cost(cost);
+}
+
+// ---------------------------------------------------------------------------
+
+PathCache::PathCache(unique_ptr<Impl> impl)
+    : impl(move(impl)) { }
+
+PathCache::~PathCache() = default;
+
+bool PathCache::find(const MotionPlan &motion_plan,
+    double x_init, double y_init, double x_goal, double y_goal,
+    google::protobuf::RepeatedPtrField<Coordinates> &path)
+{
+  return find(motion_plan, content_hash(motion_plan), x_init, y_init, x_goal, y_goal, path);
+}
+
+bool PathCache::find(const MotionPlan &motion_plan, uint64_t map_hash,
+    double x_init, double y_init, double x_goal, double y_goal,
+    google::protobuf::RepeatedPtrField<Coordinates> &path)
+{
+  if (!detail::is_valid_map(motion_plan)) return false;
+
+  Impl::Key key;
+  if (!impl->key_of(map_hash, x_init, y_init, x_goal, y_goal, key)) return false;
+
+  // A cached path has few segments, so scanning the obstacles once beats indexing them
+  return impl->find(key, x_init, y_init, x_goal, y_goal, [&motion_plan](const vector<double> &waypoints) {
+    return detail::ObstacleIndex::is_valid_path(motion_plan, waypoints);
+  }, path);
+}
+
+bool PathCache::insert(const MotionPlan &motion_plan,
+    double x_init, double y_init, double x_goal, double y_goal,
+    const google::protobuf::RepeatedPtrField<Coordinates> &path)
+{
+  return insert(content_hash(motion_plan), x_init, y_init, x_goal, y_goal, path);
+}
+
+bool PathCache::insert(uint64_t map_hash,
+    double x_init, double y_init, double x_goal, double y_goal,
+    const google::protobuf::RepeatedPtrField<Coordinates> &path)
+{
+  Impl::Key key;
+  if (!impl->key_of(map_hash, x_init, y_init, x_goal, y_goal, key)) return false;
+
+  return impl->insert(key, x_init, y_init, x_goal, y_goal, path);
+}
+
+uint64_t PathCache::hits() const { return impl->hits; }
+uint64_t PathCache::misses() const { return impl->misses; }
+
+size_t PathCache::size() const {
+  lock_guard<mutex> lock(impl->cache_mutex);
+  return impl->recent.size();
+}
+
+size_t PathCache::memory_bytes() const {
+  lock_guard<mutex> lock(impl->cache_mutex);
+  return impl->bytes;
+}
+
+void PathCache::clear() {
+  lock_guard<mutex> lock(impl->cache_mutex);
+  impl->recent.clear();
+  impl->by_key.clear();
+  impl->bytes = 0;
+}
+
+// ---------------------------------------------------------------------------
+
+PathCachePtr sdmp::bb8::simple::create_path_cache(size_t max_bytes, double quantum)
+{
+  if (!isfinite(quantum) || quantum <= 0.0) return nullptr;
+
+  return make_shared<PathCache>(make_unique<PathCache::Impl>(max_bytes, quantum));
+}
+
+bool sdmp::bb8::simple::save_path_cache(const PathCache &cache, ostream &out)
+{
+  const auto &impl = detail::Internals::of(cache);
+
+  lock_guard<mutex> lock(impl.cache_mutex);
+
+  out.write(path_cache_magic, sizeof(path_cache_magic));
+  write_word(out, path_cache_version, 4);
+  write_word(out, bits_of(impl.quantum), 8);
+  write_word(out, impl.recent.size(), 8);
+
+  // Least recently used first, so that loading them in turn restores the order
+  for (auto entry = impl.recent.rbegin(); entry != impl.recent.rend(); ++entry) {
+    const auto &key = entry->key;
+    write_word(out, key.map_hash, 8);
+    for (const int64_t value : {key.x_init, key.y_init, key.x_goal, key.y_goal}) write_word(out, uint64_t(value), 8);
+    write_word(out, entry->waypoints.size() / 2, 4);
+    for (const double value : entry->waypoints) write_word(out, bits_of(value), 8);
+  }
+
+  return bool(out);
+}
+
+PathCachePtr sdmp::bb8::simple::load_path_cache(istream &in, size_t max_bytes)
+{
+  char magic[sizeof(path_cache_magic)];
+  if (!in.read(magic, sizeof(magic))) return nullptr;
+  if (memcmp(magic, path_cache_magic, sizeof(magic)) != 0) return nullptr;
+
+  uint64_t version, quantum, count;
+  if (!read_word(in, version, 4) || version != path_cache_version) return nullptr;
+  if (!read_word(in, quantum, 8)) return nullptr;
+  if (!read_word(in, count, 8)) return nullptr;
+
+  auto cache = create_path_cache(max_bytes, double_of(quantum));
+  if (cache == nullptr) return nullptr;
+
+  auto &impl = detail::Internals::of(*cache);
+  lock_guard<mutex> lock(impl.cache_mutex);
+
+  // Paths that no longer fit are evicted as the more recently used ones come in
+  for (uint64_t e = 0; e < count; e++) {
+
+    PathCache::Impl::Key key;
+    uint64_t words[4], waypoint_count;
+    if (!read_word(in, key.map_hash, 8)) return nullptr;
+    for (auto &word : words) if (!read_word(in, word, 8)) return nullptr;
+    key.x_init = int64_t(words[0]);
+    key.y_init = int64_t(words[1]);
+    key.x_goal = int64_t(words[2]);
+    key.y_goal = int64_t(words[3]);
+
+    if (!read_word(in, waypoint_count, 4) || waypoint_count < 2) return nullptr;
+
+    vector<double> waypoints;
+    for (uint64_t i = 0; i < 2 * waypoint_count; i++) {
+      uint64_t word;
+      if (!read_word(in, word, 8)) return nullptr;
+      waypoints.push_back(double_of(word));
+      if (!isfinite(waypoints.back())) return nullptr;
+    }
+
+    impl.store(key, std::move(waypoints));
+
+  }
+
+  return cache;
+}
+
+// ---------------------------------------------------------------------------
@@ -0,0 +1,87 @@
+/*! \file
+ * The paths of repeated queries, cached by map and quantized query
+ *
+ * This is a private header of the library, it is **not** installed.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include "sdmp.hpp"
+#include "obstacle_index.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace sdmp::bb8::simple {
+
+struct PathCache::Impl {
+
+  // The content hash of the map, and the start and goal, in multiples of the quantum
+  struct Key {
+    std::uint64_t map_hash;
+    std::int64_t x_init, y_init, x_goal, y_goal;
+    bool operator==(const Key &other) const;
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const;
+  };
+
+  struct Entry {
+    Key key;
+    std::vector<double> waypoints; // 'x' and 'y' of each, in turn
+    std::size_t bytes;             // as counted against the limit
+  };
+
+  typedef std::list<Entry> Recent;
+
+  const std::size_t max_bytes;
+  const double quantum;
+
+  mutable std::mutex cache_mutex;
+  Recent recent; // most recently used first
+  std::unordered_map<Key, Recent::iterator, KeyHash> by_key;
+  std::size_t bytes = 0;
+
+  std::atomic<std::uint64_t> hits{0}, misses{0};
+
+  Impl(std::size_t max_bytes, double quantum) : max_bytes(max_bytes), quantum(quantum) {}
+
+  // Makes the key of a query, or returns `false` if its coordinates are too far out to quantize
+  bool key_of(std::uint64_t map_hash, double x_init, double y_init, double x_goal, double y_goal, Key &key) const;
+
+  // Replaces the path with the one cached for the key, with its ends moved onto the exact start
+  // and goal, if the droid clears the obstacles all along it, and counts a hit, or else a miss;
+  // the path is checked by `is_clear`, given the 'x' and 'y' of each waypoint in turn
+  bool find(const Key &key, double x_init, double y_init, double x_goal, double y_goal,
+            const std::function<bool(const std::vector<double> &waypoints)> &is_clear,
+            google::protobuf::RepeatedPtrField<Coordinates> &path);
+
+  // Caches the path for the key, replacing any, if it runs from the exact start to the exact goal,
+  // evicting the least recently used paths to stay within the limit
+  bool insert(const Key &key, double x_init, double y_init, double x_goal, double y_goal,
+              const google::protobuf::RepeatedPtrField<Coordinates> &path);
+
+  // Caches the waypoints for the key, as the most recently used, under the lock
+  bool store(const Key &key, std::vector<double> &&waypoints);
+
+};
+
+} // end namespace sdmp::bb8::simple
+
+namespace sdmp::detail {
+
+// The sum of the lengths of the segments of a path
+double path_length(const google::protobuf::RepeatedPtrField<Coordinates> &path);
+
+// Replaces the report with that of a query answered from a cache, in the given time
+void report_cached_path(PlannerReport &report, const google::protobuf::RepeatedPtrField<Coordinates> &path,
+                        double seconds);
+
+} // end namespace sdmp::detail
@@ -0,0 +1,1090 @@
+#include "sdmp.hpp"
+#include "internals.hpp"
+#include "obstacle_index.hpp"
+#include "parallel.hpp"
+#include "path_cache.hpp"
+#include "planner_session.hpp"
+#include "planning.hpp"
+#include "visibility_graph.hpp"
+
+// Adapted from https://ompl.kavrakilab.org/optimalPlanningTutorial.html
+
+#include <ompl/base/spaces/RealVectorStateSpace.h>
+#include <ompl/base/objectives/PathLengthOptimizationObjective.h>
+#include <ompl/base/PlannerData.h>
+#include <ompl/geometric/planners/informedtrees/BITstar.h>
+#include <ompl/geometric/planners/rrt/InformedRRTstar.h>
+#include <ompl/geometric/planners/rrt/RRTConnect.h>
+#include <ompl/geometric/planners/rrt/RRTstar.h>
+#include <ompl/geometric/PathGeometric.h>
+#include <ompl/geometric/PathSimplifier.h>
+
+namespace ob = ompl::base;
+namespace og = ompl::geometric;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::bb8::simple;
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+// Planners that can be told the cost of a path found before they start, so that they only look
+// for (and report) shorter ones, and, when informed, only sample where those can be
+class CostBounded {
+ public:
+  virtual ~CostBounded() = default;
+  virtual void bound_cost(const ob::Cost &cost) = 0;
+};
+
+// An RRT* planner, informed or not, whose best cost so far starts at the bound, rather than
+// at infinity (`solve` would set it up again, and so reset it, if it were not set up already)
+template <class Planner>
+class Bounded : public Planner, public CostBounded {
+ public:
+  using Planner::Planner;
+  void bound_cost(const ob::Cost &cost) override {
+    if (!this->isSetup()) this->setup();
+    this->bestCost_ = cost;
+  }
+};
+
+// Each thread runs an independent planner, with its own (independently seeded)
+// sampler, and its own space information, since the validators count their calls
+
+struct Lane {
+  ob::SpaceInformationPtr si;
+  ob::ProblemDefinitionPtr pdef;
+  ob::OptimizationObjectivePtr obj;
+  ob::PlannerPtr planner;
+  CostBounded *bounded = nullptr; // the planner, if it can be bounded by the seed
+  ob::PlannerPtr seeder; // optional, finds a first path, for the planner to refine
+  ob::ProblemDefinitionPtr seed_pdef; // of the seeder, apart from the planner's
+  unique_ptr<og::PathGeometric> seed; // found before the planner started, if any
+  ob::PlannerStatus solved;
+  detail::Telemetry telemetry;
+};
+
+// The shortest exact solution of a lane, by length: its seed, or the planner's, if shorter,
+// and never by the ranking of the problem, which puts the solutions of an optimizing
+// planner ahead of any other, however long
+const og::PathGeometric *exact_solution(const Lane &lane) {
+  const og::PathGeometric *solution = lane.pdef->hasExactSolution()
+      ? lane.pdef->getSolutionPath()->as<og::PathGeometric>()
+      : nullptr;
+  if (lane.seed != nullptr && (solution == nullptr || !(solution->length() < lane.seed->length()))) return lane.seed.get();
+  return solution;
+}
+
+// The planner of a sampling-based algorithm, with the given range, if any
+ob::PlannerPtr create_planner(PlannerOptions::Algorithm algorithm, const ob::SpaceInformationPtr &si, double range) {
+
+  using Algorithm = PlannerOptions::Algorithm;
+
+  switch (algorithm) {
+    case Algorithm::rrt_connect: {
+      auto planner = make_shared<og::RRTConnect>(si);
+      if (range > 0.0) planner->setRange(range);
+      return planner;
+    }
+    case Algorithm::informed_rrt_star:
+    case Algorithm::hybrid: {
+      auto planner = make_shared<Bounded<og::InformedRRTstar>>(si);
+      if (range > 0.0) planner->setRange(range);
+      return planner;
+    }
+    case Algorithm::bit_star:
+      return make_shared<og::BITstar>(si);
+    default: {
+      auto planner = make_shared<Bounded<og::RRTstar>>(si);
+      if (range > 0.0) planner->setRange(range);
+      return planner;
+    }
+  }
+
+}
+
+// Whether the planners of an algorithm report each improved solution themselves
+bool reports_improvements(PlannerOptions::Algorithm algorithm) {
+  return algorithm != PlannerOptions::Algorithm::rrt_connect;
+}
+
+// Shortens the path until it stops getting shorter, or until the termination condition: skips
+// the vertices it can, collapses close ones, and shortcuts between points along its segments,
+// then, optionally, rounds its corners (every change is checked by the space information)
+void simplify_path(og::PathSimplifier &simplifier, og::PathGeometric &path,
+                   const ob::PlannerTerminationCondition &terminate, bool smooth) {
+
+  const double min_improvement = 1e-3; // relative, below which another round is not worth it
+
+  while (!terminate()) {
+    const double length = path.length();
+    simplifier.reduceVertices(path);
+    simplifier.collapseCloseVertices(path);
+    simplifier.shortcutPath(path);
+    if (!(path.length() < (1.0 - min_improvement) * length)) break;
+  }
+
+  if (smooth && !terminate()) simplifier.smoothBSpline(path, 3, path.length() / 100.0);
+
+}
+
+PlannerReport::Status to_report_status(const ob::PlannerStatus &status) {
+  switch (ob::PlannerStatus::StatusType(status)) {
+    case ob::PlannerStatus::INVALID_START: return PlannerReport::INVALID_START;
+    case ob::PlannerStatus::INVALID_GOAL: return PlannerReport::INVALID_GOAL;
+    case ob::PlannerStatus::UNRECOGNIZED_GOAL_TYPE: return PlannerReport::UNRECOGNIZED_GOAL_TYPE;
+    case ob::PlannerStatus::TIMEOUT: return PlannerReport::TIMEOUT;
+    case ob::PlannerStatus::APPROXIMATE_SOLUTION: return PlannerReport::APPROXIMATE_SOLUTION;
+    case ob::PlannerStatus::EXACT_SOLUTION: return PlannerReport::EXACT_SOLUTION;
+    case ob::PlannerStatus::CRASH: return PlannerReport::CRASH;
+    case ob::PlannerStatus::ABORT: return PlannerReport::ABORT;
+    default: return PlannerReport::UNKNOWN;
+  }
+}
+
+double seconds_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Replaces the path with an intermediate solution, whose states planners report from the
+// goal back to the start, with or without the start and goal themselves (as does RRT*)
+void copy_intermediate_path(const vector<const ob::State *> &states,
+                            double x_init, double y_init, double x_goal, double y_goal,
+                            google::protobuf::RepeatedPtrField<Coordinates> &path) {
+
+  path.Clear();
+  path.Reserve(int(states.size()) + 2);
+
+  const auto add = [&path](double x, double y) {
+    if (path.size() > 0 && path.Get(path.size() - 1).x() == x && path.Get(path.size() - 1).y() == y) return;
+    auto *coordinates = path.Add();
+    coordinates->set_x(x);
+    coordinates->set_y(y);
+  };
+
+  add(x_init, y_init);
+  for (auto it = states.rbegin(); it != states.rend(); ++it) {
+    const auto &values = *(*it)->as<ob::RealVectorStateSpace::StateType>();
+    add(values[0], values[1]);
+  }
+  add(x_goal, y_goal);
+
+}
+
+// The waypoints of a path being repaired, or reused
+typedef vector<pair<double, double>> Points;
+
+// The distance from 'p' to the segment from 'a' to 'b'
+double segment_distance(const pair<double, double> &p, const pair<double, double> &a, const pair<double, double> &b) {
+  const double dx = b.first - a.first, dy = b.second - a.second;
+  const double cx = p.first - a.first, cy = p.second - a.second;
+  const double length2 = dx * dx + dy * dy;
+  const double t = length2 > 0.0 ? clamp((cx * dx + cy * dy) / length2, 0.0, 1.0) : 0.0;
+  return hypot(cx - t * dx, cy - t * dy);
+}
+
+// The waypoints of a path, or none if any of them is not finite
+Points points_of(const google::protobuf::RepeatedPtrField<Coordinates> &path) {
+  Points points;
+  points.reserve(path.size());
+  for (const auto &point : path) {
+    if (!isfinite(point.x()) || !isfinite(point.y())) return {};
+    points.emplace_back(point.x(), point.y());
+  }
+  return points;
+}
+
+// A previous path, moved onto a new start and goal: from the start, to the end of the segment
+// of the previous path nearest to it, then along the previous path, from there to the start
+// of the segment nearest to the goal, and on to the goal (or none, if the path is not valid)
+Points reanchor(const google::protobuf::RepeatedPtrField<Coordinates> &previous,
+                double x_init, double y_init, double x_goal, double y_goal) {
+
+  const Points waypoints = points_of(previous);
+  const int count = int(waypoints.size());
+  if (count < 2) return {};
+
+  const auto nearest_segment = [&](const pair<double, double> &p, int first) {
+    int nearest = first;
+    double distance = numeric_limits<double>::infinity();
+    for (int i = first; i + 1 < count; i++) {
+      const double d = segment_distance(p, waypoints[i], waypoints[i + 1]);
+      if (d < distance) { distance = d; nearest = i; }
+    }
+    return nearest;
+  };
+
+  const int first = nearest_segment({x_init, y_init}, 0);
+  const int last = nearest_segment({x_goal, y_goal}, first);
+
+  Points points;
+  points.reserve(last - first + 2);
+  points.emplace_back(x_init, y_init);
+  points.insert(points.end(), waypoints.begin() + first + 1, waypoints.begin() + last + 1);
+  points.emplace_back(x_goal, y_goal);
+
+  return points;
+
+}
+
+// Replaces the path with the waypoints, reusing the elements that `Clear` kept allocated
+void copy_points(const Points &points, google::protobuf::RepeatedPtrField<Coordinates> &path) {
+  path.Clear();
+  path.Reserve(int(points.size()));
+  for (const auto &[x, y] : points) {
+    auto *coordinates = path.Add();
+    coordinates->set_x(x);
+    coordinates->set_y(y);
+  }
+}
+
+// An obstacle added, or moved, since the last query, inflated by the droid radius
+struct Change {
+  double x, y, r;
+};
+
+// Beyond this many changes between queries, every segment of the path is checked again
+constexpr size_t max_tracked_changes = 1024;
+
+// Whether the obstacle of a change may block the segment from 'a' to 'b', conservatively
+bool may_block(const Change &change, const pair<double, double> &a, const pair<double, double> &b) {
+  return segment_distance({change.x, change.y}, a, b) <= (1.0 + 1e-6) * change.r;
+}
+
+} // end anonymous namespace -------------------------------------------------
+
+struct PlannerSession::Impl {
+
+  // Declared first, so that they outlive the validators that refer to them
+  detail::ObstacleIndex obstacles; // updated in place, between queries
+  shared_ptr<const detail::DistanceField> field; // optional
+
+  unique_ptr<const detail::VisibilityGraph> graph; // when selected, in place of the planners
+
+  ob::StateSpacePtr space;
+
+  vector<Lane> lanes;
+
+  bool reports_improvements; // or only their final solutions, which the session reports instead
+
+  double simplify_seconds; // zero for none
+  bool smooth_path;
+
+  bool warm_start;
+
+  ImprovedPathCallback improved_path_callback; // optional
+  const atomic<bool> *cancel;                  // optional
+
+  PathCache *path_cache; // optional
+  uint64_t map_hash = 0; // the content hash of the map, for the cache
+  bool map_changed = false; // since the session was created, so its paths are no longer those of the hashed map
+
+  // The obstacles added, or moved, since the last query, whose path `replan` checks against them
+  vector<Change> changes;
+  bool too_many_changes = false; // to track, so every segment is checked
+
+  // Reconnects the blocked stretches of paths, created when first needed
+  double range;
+  ob::PlannerPtr repairer;
+  ob::ProblemDefinitionPtr repair_pdef;
+
+  // The query being planned, which the lanes, and the callbacks of their planners, share
+  struct Query {
+    chrono::steady_clock::time_point started, deadline;
+    double x_init, y_init, x_goal, y_goal;
+    PlannerReport *report = nullptr;
+    bool watched = false; // by a report, or the callback, so that improvements are recorded
+    bool warm = false;    // started from the previous path
+    atomic<bool> satisfied{false}; // by any lane, which stops them all
+    mutex improvement_mutex;
+    double best_cost;
+    google::protobuf::RepeatedPtrField<Coordinates> improved_path; // for the callback, reused across queries
+  } query;
+
+  // Created once, rather than per query, since they only refer to the query
+  ob::ReportIntermediateSolutionFn on_improvement;
+  ob::PlannerTerminationCondition stop; // at the deadline, on cancellation, or once the query is satisfied
+
+  // A thread per lane, but the first, which the calling thread plans on, parked between queries
+  unique_ptr<detail::ThreadTeam> team;
+
+  // Records a change, unless there are too many
+  void changed(double x, double y, double r);
+
+  // Adds how many obstacles the index culled, in the current map, to a report
+  void report_culled(PlannerReport &report) const;
+
+  // Replaces each blocked stretch of segments of the path with a local reconnection, with
+  // RRT-Connect, on the first lane, adding to the tree size, or returns `false` if it fails
+  bool reconnect(Points &points, const vector<bool> &blocked,
+                 const ob::PlannerTerminationCondition &terminate, uint64_t &tree_size);
+
+  // Records an improvement of the best solution, over all lanes, and passes it on, in order,
+  // having `copy` write its path only if there is a callback to pass it to
+  template <class Copy>
+  void improved(double cost, const Copy &copy);
+
+  // Reports the solution of a lane whose planner does not report its own improvements
+  void report_solution(const Lane &lane);
+
+  // Whether the solution of a lane satisfies the length threshold, which stops every lane
+  bool check_satisfied(const Lane &lane);
+
+  // Plans the query on a lane, after its seeder, if any, and unless the query is warm
+  void solve(Lane &lane);
+
+  // Assumption on input: assert(is_valid(motion_plan)), where only the droid and bounds
+  // of the motion plan are used, but for the visibility graph and the clearance field
+  Impl(const MotionPlan &motion_plan, detail::ObstacleIndex &&index, const PlannerOptions &options);
+
+};
+
+PlannerSession::Impl::Impl(const MotionPlan &motion_plan, detail::ObstacleIndex &&index, const PlannerOptions &options)
+    : obstacles(std::move(index)), // indexed once, since every validity check queries them
+      reports_improvements(::reports_improvements(options.algorithm)),
+      simplify_seconds(options.simplify_seconds),
+      smooth_path(options.smooth_path),
+      warm_start(options.warm_start),
+      improved_path_callback(options.improved_path_callback),
+      cancel(options.cancel),
+      path_cache(options.path_cache),
+      range(options.range),
+      stop([this]() {
+        return query.satisfied.load() || (cancel != nullptr && cancel->load()) || chrono::steady_clock::now() >= query.deadline;
+      })
+{
+  // The index, which may be a copy, rebuilds its grid, as the map changes, on the threads of the session
+  obstacles.set_thread_count(options.thread_count);
+
+  if (options.algorithm == PlannerOptions::Algorithm::visibility_graph) {
+    graph = make_unique<const detail::VisibilityGraph>(motion_plan, options.thread_count);
+    return;
+  }
+
+  const unsigned thread_count = detail::resolve_thread_count(options.thread_count);
+
+  // Sample the clearance once per map and resolution, if requested
+  if (options.field_resolution > 0.0) {
+    field = detail::DistanceField::get(motion_plan, obstacles, options.field_resolution, thread_count);
+  }
+
+  // Construct the robot state space in which we're planning.
+  space = detail::create_state_space(motion_plan);
+
+  assert(space->getDimension() == 2);
+
+  lanes.resize(thread_count);
+
+  for (auto &lane : lanes) {
+
+    // Construct a space information instance for this state space
+    lane.si = detail::create_space_information(space, obstacles, field.get(), &lane.telemetry);
+
+    // Create a problem instance, whose start and goal are set per query
+    lane.pdef = ob::ProblemDefinitionPtr(new ob::ProblemDefinition(lane.si));
+
+    // Set the optimization objective, whose threshold is set per query
+    lane.obj = ob::OptimizationObjectivePtr(new ob::PathLengthOptimizationObjective(lane.si));
+    lane.pdef->setOptimizationObjective(lane.obj);
+
+    // Construct the planner of the requested algorithm
+    lane.planner = create_planner(options.algorithm, lane.si, options.range);
+
+    // Set the problem instance for our planner to solve
+    lane.planner->setProblemDefinition(lane.pdef);
+    lane.planner->setup();
+    lane.bounded = dynamic_cast<CostBounded *>(lane.planner.get());
+
+    // A hybrid first finds a path with RRT-Connect, on a problem of its own, which the lane
+    // keeps as its seed, while the planner, bounded by its length, looks for a shorter one
+    if (options.algorithm == PlannerOptions::Algorithm::hybrid) {
+      lane.seed_pdef = ob::ProblemDefinitionPtr(new ob::ProblemDefinition(lane.si));
+      lane.seeder = create_planner(PlannerOptions::Algorithm::rrt_connect, lane.si, options.range);
+      lane.seeder->setProblemDefinition(lane.seed_pdef);
+      lane.seeder->setup();
+    }
+
+  }
+
+  on_improvement = [this](const ob::Planner *, const vector<const ob::State *> &states, const ob::Cost cost) {
+    improved(cost.value(), [this, &states](google::protobuf::RepeatedPtrField<Coordinates> &path) {
+      copy_intermediate_path(states, query.x_init, query.y_init, query.x_goal, query.y_goal, path);
+    });
+  };
+
+  team = make_unique<detail::ThreadTeam>(unsigned(lanes.size()));
+}
+
+void PlannerSession::Impl::changed(double x, double y, double r) {
+  if (changes.size() < max_tracked_changes) changes.push_back({x, y, r});
+  else too_many_changes = true;
+}
+
+void PlannerSession::Impl::report_culled(PlannerReport &report) const {
+  report.set_out_of_bounds_obstacles(obstacles.out_of_bounds_count());
+  report.set_dominated_obstacles(obstacles.dominated_count());
+}
+
+bool PlannerSession::Impl::reconnect(Points &points, const vector<bool> &blocked,
+                                     const ob::PlannerTerminationCondition &terminate, uint64_t &tree_size) {
+
+  Lane &lane = lanes.front();
+
+  if (repairer == nullptr) {
+    repair_pdef = ob::ProblemDefinitionPtr(new ob::ProblemDefinition(lane.si));
+    repairer = create_planner(PlannerOptions::Algorithm::rrt_connect, lane.si, range);
+    repairer->setProblemDefinition(repair_pdef);
+    repairer->setup();
+  }
+
+  const int segment_count = int(points.size()) - 1;
+
+  Points repaired;
+  repaired.reserve(points.size());
+  repaired.push_back(points.front());
+
+  for (int i = 0; i < segment_count; ) {
+
+    if (!blocked[i]) {
+      repaired.push_back(points[i + 1]);
+      i++;
+      continue;
+    }
+
+    // The waypoints at either end of a blocked stretch are clear, or the segments
+    // next to them would be blocked too, and the stretch would extend past them,
+    // except for the start and goal, which the planner checks
+
+    int end = i + 1;
+    while (end < segment_count && blocked[end]) end++;
+
+    ob::ScopedState<> from(space), to(space);
+    detail::set_state(from.get(), points[i].first, points[i].second);
+    detail::set_state(to.get(), points[end].first, points[end].second);
+
+    repairer->clear();
+    repair_pdef->clearSolutionPaths();
+    repair_pdef->clearStartStates();
+    repair_pdef->setStartAndGoalStates(from, to);
+
+    repairer->solve(terminate);
+
+    ob::PlannerData data(lane.si);
+    repairer->getPlannerData(data);
+    tree_size += data.numVertices();
+
+    if (!repair_pdef->hasExactSolution()) return false;
+
+    og::PathGeometric bridge(*repair_pdef->getSolutionPath()->as<og::PathGeometric>());
+    og::PathSimplifier simplifier(lane.si, repair_pdef->getGoal(), lane.obj);
+    simplify_path(simplifier, bridge, terminate, false);
+
+    // Splice the bridge in, without its first state, which is already in
+    const auto &states = bridge.getStates();
+    for (size_t k = 1; k + 1 < states.size(); k++) {
+      const auto &values = *states[k]->as<ob::RealVectorStateSpace::StateType>();
+      repaired.emplace_back(values[0], values[1]);
+    }
+    repaired.push_back(points[end]);
+
+    i = end;
+
+  }
+
+  points.swap(repaired);
+
+  return true;
+
+}
+
+template <class Copy>
+void PlannerSession::Impl::improved(double cost, const Copy &copy) {
+  const double seconds = seconds_since(query.started);
+  lock_guard<mutex> lock(query.improvement_mutex);
+  if (!(cost < query.best_cost)) return;
+  query.best_cost = cost;
+  if (query.report != nullptr) {
+    auto *point = query.report->add_convergence();
+    point->set_seconds(seconds);
+    point->set_cost(cost);
+  }
+  if (improved_path_callback) {
+    copy(query.improved_path);
+    improved_path_callback(query.improved_path, cost);
+  }
+}
+
+void PlannerSession::Impl::report_solution(const Lane &lane) {
+  const og::PathGeometric *solution = query.watched ? exact_solution(lane) : nullptr;
+  if (solution == nullptr) return;
+  improved(solution->length(), [solution](google::protobuf::RepeatedPtrField<Coordinates> &path) {
+    detail::copy_path(*solution, path);
+  });
+}
+
+bool PlannerSession::Impl::check_satisfied(const Lane &lane) {
+  const og::PathGeometric *solution = exact_solution(lane);
+  if (solution == nullptr) return false;
+  if (lane.obj->isSatisfied(ob::Cost(solution->length()))) query.satisfied = true;
+  return query.satisfied.load();
+}
+
+void PlannerSession::Impl::solve(Lane &lane) {
+  if (lane.seeder && !query.warm) {
+    lane.solved = lane.seeder->solve(stop);
+    if (lane.seed_pdef->hasExactSolution()) {
+      lane.seed = make_unique<og::PathGeometric>(*lane.seed_pdef->getSolutionPath()->as<og::PathGeometric>());
+    }
+    report_solution(lane);
+    if (check_satisfied(lane) || stop()) return;
+  }
+  if (lane.seed != nullptr && lane.bounded != nullptr) lane.bounded->bound_cost(ob::Cost(lane.seed->length()));
+  const ob::PlannerStatus refined = lane.planner->solve(stop);
+  if (!reports_improvements) report_solution(lane);
+  // The refinement may time out, yet the lane keeps its seed, from the seeder or the warm start
+  if (lane.seed == nullptr) lane.solved = refined;
+  check_satisfied(lane);
+}
+
+// ---------------------------------------------------------------------------
+
+PlannerSession::PlannerSession(unique_ptr<Impl> impl)
+    : impl(move(impl)) { }
+
+PlannerSession::~PlannerSession() = default;
+
+void PlannerSession::clear() {
+  for (auto &lane : impl->lanes) {
+    lane.planner->clear();
+    if (lane.seeder) {
+      lane.seeder->clear();
+      lane.seed_pdef->clearSolutionPaths();
+    }
+    lane.seed.reset();
+    lane.pdef->clearSolutionPaths();
+  }
+}
+
+int PlannerSession::plan(google::protobuf::RepeatedPtrField<Coordinates> &path,
+    double x_init, double y_init, double x_goal, double y_goal,
+    double timeout_seconds, double length_threshold, PlannerReport *report)
+{
+  const auto started = chrono::steady_clock::now();
+
+  // Keep the previous path, to start from, before it is replaced
+  Points previous;
+  if (impl->warm_start && impl->graph == nullptr) previous = reanchor(path, x_init, y_init, x_goal, y_goal);
+
+  path.Clear();
+  if (report != nullptr) report->Clear();
+
+  const auto invalid = [report]() {
+    if (report != nullptr) report->set_status(PlannerReport::INVALID_ARGUMENTS);
+    return -1;
+  };
+
+  if (!isfinite(x_init)) return invalid();
+  if (!isfinite(y_init)) return invalid();
+  if (!isfinite(x_goal)) return invalid();
+  if (!isfinite(y_goal)) return invalid();
+  if (!isfinite(timeout_seconds)) return invalid();
+  if (timeout_seconds <= 0.0) return invalid(); // timeout must be positive
+  if (!isfinite(length_threshold)) return invalid();
+  if (length_threshold < 0.0) return invalid(); // zero means 'keep trying'
+
+  // The new path is found in the current map, so it need not be checked against earlier changes
+  impl->changes.clear();
+  impl->too_many_changes = false;
+
+  // A cached path of the same query, in the same map, is only checked, and not planned again
+
+  PathCache::Impl *cache = impl->path_cache != nullptr && !impl->map_changed ? &detail::Internals::of(*impl->path_cache) : nullptr;
+  PathCache::Impl::Key key;
+  if (cache != nullptr && !cache->key_of(impl->map_hash, x_init, y_init, x_goal, y_goal, key)) cache = nullptr;
+
+  const auto &obstacles = impl->obstacles;
+  if (cache != nullptr &&
+      cache->find(key, x_init, y_init, x_goal, y_goal, [&obstacles](const vector<double> &waypoints) {
+        return obstacles.is_valid_path(waypoints);
+      }, path)) {
+    if (impl->improved_path_callback) impl->improved_path_callback(path, detail::path_length(path));
+    if (report != nullptr) {
+      detail::report_cached_path(*report, path, seconds_since(started));
+      impl->report_culled(*report);
+    }
+    return 0;
+  }
+
+  if (impl->graph != nullptr) {
+    const auto deadline = started + chrono::duration_cast<chrono::steady_clock::duration>(
+        chrono::duration<double>(timeout_seconds));
+    const int result = impl->graph->find_path(path, x_init, y_init, x_goal, y_goal, deadline, impl->cancel, report);
+    if (report != nullptr) impl->report_culled(*report);
+    if (result == 0 && impl->improved_path_callback) impl->improved_path_callback(path, detail::path_length(path));
+    if (result == 0 && cache != nullptr) cache->insert(key, x_init, y_init, x_goal, y_goal, path);
+    return result;
+  }
+
+  // Simplification takes its budget out of the timeout
+  if (impl->simplify_seconds >= timeout_seconds) return invalid();
+
+  // The `ValidityChecker` object will verify that initial and goal coordinates are valid
+
+  // Set our robot's starting state
+  ob::ScopedState<> start(impl->space);
+  detail::set_state(start.get(), x_init, y_init);
+
+  // Set our robot's goal state
+  ob::ScopedState<> goal(impl->space);
+  detail::set_state(goal.get(), x_goal, y_goal);
+
+  // Record each improvement of the best solution, over all planners, and pass it on, in order
+
+  auto &query = impl->query;
+
+  query.started = started;
+  query.x_init = x_init;
+  query.y_init = y_init;
+  query.x_goal = x_goal;
+  query.y_goal = y_goal;
+  query.report = report;
+  query.watched = report != nullptr || impl->improved_path_callback;
+  query.warm = false;
+  query.best_cost = numeric_limits<double>::infinity();
+
+  // All planners stop at the timeout, on cancellation, or as soon as any of them satisfies the length threshold
+
+  query.deadline = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(
+      chrono::duration<double>(timeout_seconds - impl->simplify_seconds));
+  query.satisfied = false;
+
+  // Reset each planner (and its tree) for the new query
+  for (auto &lane : impl->lanes) {
+    lane.planner->clear();
+    if (lane.seeder) {
+      lane.seeder->clear();
+      lane.seed_pdef->clearSolutionPaths();
+      lane.seed_pdef->clearStartStates();
+      lane.seed_pdef->setStartAndGoalStates(start, goal);
+    }
+    lane.seed.reset();
+    lane.pdef->clearSolutionPaths();
+    lane.pdef->clearStartStates();
+    lane.pdef->setStartAndGoalStates(start, goal);
+    lane.pdef->setIntermediateSolutionCallback(query.watched ? impl->on_improvement : nullptr);
+    lane.obj->setCostThreshold(ob::Cost(length_threshold));
+    lane.solved = ob::PlannerStatus();
+    lane.telemetry.reset(report != nullptr);
+  }
+
+  // Start from the previous path, if it is still clear, or can be made so locally, as the
+  // seed of every lane, which the planners then try to improve upon
+
+  uint64_t warm_tree_size = 0;
+
+  if (!previous.empty()) {
+
+    Lane &lane = impl->lanes.front();
+
+    vector<bool> blocked(previous.size() - 1);
+    for (size_t i = 0; i + 1 < previous.size(); i++) {
+      lane.telemetry.motion_checks++;
+      blocked[i] = !impl->obstacles.is_valid(previous[i].first, previous[i].second,
+                                             previous[i + 1].first, previous[i + 1].second);
+    }
+
+    query.warm = none_of(blocked.begin(), blocked.end(), [](bool b) { return b; }) ||
+                 impl->reconnect(previous, blocked, impl->stop, warm_tree_size);
+
+  }
+
+  if (query.warm) {
+
+    ob::ScopedState<> state(impl->space);
+
+    // Kept apart from the problem, which would rank any solution of the planner ahead of it
+    for (auto &lane : impl->lanes) {
+      lane.seed = make_unique<og::PathGeometric>(lane.si);
+      for (const auto &[x, y] : previous) {
+        detail::set_state(state.get(), x, y);
+        lane.seed->append(state.get());
+      }
+      lane.solved = ob::PlannerStatus(ob::PlannerStatus::EXACT_SOLUTION);
+    }
+
+    const Lane &lane = impl->lanes.front();
+    impl->report_solution(lane);
+    impl->check_satisfied(lane);
+
+  }
+
+  // The first lane plans on the calling thread, and the others on the threads of the session
+  impl->team->run([this](unsigned lane) { impl->solve(impl->lanes[lane]); });
+
+  // Keep the shortest path, preferring exact solutions over approximate ones
+
+  const Lane *best = nullptr;
+  const og::PathGeometric *best_path = nullptr;
+  bool best_exact = false;
+
+  for (const auto &lane : impl->lanes) {
+    if (!lane.solved) continue;
+    const og::PathGeometric *path = exact_solution(lane);
+    const bool exact = path != nullptr;
+    if (!exact && lane.pdef->hasSolution()) path = lane.pdef->getSolutionPath()->as<og::PathGeometric>();
+    if (path == nullptr) continue;
+    if (best != nullptr && (exact != best_exact ? !exact : !(path->length() < best_path->length()))) continue;
+    best = &lane;
+    best_path = path;
+    best_exact = exact;
+  }
+
+  // Simplify the shortest exact path, if requested, within the rest of the budget
+
+  unique_ptr<og::PathGeometric> simplified;
+  double unsimplified_cost = 0.0, simplification_seconds = 0.0;
+
+  if (best_exact && impl->simplify_seconds > 0.0) {
+
+    const auto simplification_started = chrono::steady_clock::now();
+    const auto simplification_deadline = simplification_started + chrono::duration<double>(impl->simplify_seconds);
+
+    const ob::PlannerTerminationCondition terminate([&simplification_deadline, cancel = impl->cancel]() {
+      return (cancel != nullptr && cancel->load()) || chrono::steady_clock::now() >= simplification_deadline;
+    });
+
+    simplified = make_unique<og::PathGeometric>(*best_path);
+    unsimplified_cost = simplified->length();
+
+    og::PathSimplifier simplifier(best->si, best->pdef->getGoal(), best->obj);
+    simplify_path(simplifier, *simplified, terminate, impl->smooth_path);
+
+    // Report the simplified path as one more improvement, or keep the original if it is no shorter
+    if (simplified->length() < unsimplified_cost) {
+      if (query.watched) {
+        impl->improved(simplified->length(), [&simplified](google::protobuf::RepeatedPtrField<Coordinates> &path) {
+          detail::copy_path(*simplified, path);
+        });
+      }
+    } else {
+      simplified.reset();
+    }
+
+    simplification_seconds = seconds_since(simplification_started);
+
+  }
+
+  const og::PathGeometric *solution = simplified != nullptr ? simplified.get() : best_path;
+
+  if (report != nullptr) {
+
+    report->set_status(to_report_status(best != nullptr ? best->solved : impl->lanes.front().solved));
+    report->set_planning_seconds(seconds_since(started));
+
+    chrono::steady_clock::duration checking_time{};
+
+    for (auto &lane : impl->lanes) {
+      ob::PlannerData data(lane.si);
+      lane.planner->getPlannerData(data);
+      if (lane.seeder) lane.seeder->getPlannerData(data);
+      report->set_tree_size(report->tree_size() + data.numVertices());
+      report->set_state_checks(report->state_checks() + lane.telemetry.state_checks);
+      report->set_motion_checks(report->motion_checks() + lane.telemetry.motion_checks);
+      checking_time += lane.telemetry.checking_time;
+    }
+
+    report->set_tree_size(report->tree_size() + warm_tree_size);
+    report->set_checking_seconds(chrono::duration<double>(checking_time).count());
+
+    report->set_simplification_seconds(simplification_seconds);
+    if (simplified != nullptr) report->set_unsimplified_cost(unsimplified_cost);
+
+    impl->report_culled(*report);
+
+    if (best != nullptr) {
+      report->set_cost(solution->length());
+      if (report->convergence_size() > 0) {
+        report->set_first_solution_seconds(report->convergence(0).seconds());
+      } else {
+        report->set_first_solution_seconds(report->planning_seconds()); // approximate solutions are not reported
+      }
+    }
+
+  }
+
+  if (best == nullptr) return -2; // See the report for the planner status
+
+  // Save the output path, reusing the elements that `Clear` kept allocated
+  detail::copy_path(*solution, path);
+
+  // Unless it is approximate, which the cache refuses, since it stops short of the goal
+  if (cache != nullptr) cache->insert(key, x_init, y_init, x_goal, y_goal, path);
+
+  // Done
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+int PlannerSession::add_obstacle(double location_x, double location_y, double radius) {
+
+  if (impl->graph != nullptr || impl->field != nullptr) return -1; // precomputed for the original map
+
+  if (!isfinite(location_x) || location_x < 0.0 ||
+      !isfinite(location_y) || location_y < 0.0 ||
+      !isfinite(radius) || radius < 0.0 ) {
+    return -1;
+  }
+
+  const uint32_t id = impl->obstacles.insert(location_x, location_y, radius);
+  impl->changed(location_x, location_y, impl->obstacles.inflated_radius(id));
+  impl->map_changed = true;
+
+  return int(id);
+
+}
+
+int PlannerSession::move_obstacle(int id, double location_x, double location_y) {
+
+  if (impl->graph != nullptr || impl->field != nullptr) return -1;
+
+  if (id < 0 ||
+      !isfinite(location_x) || location_x < 0.0 ||
+      !isfinite(location_y) || location_y < 0.0 ) {
+    return -1;
+  }
+
+  if (!impl->obstacles.move(uint32_t(id), location_x, location_y)) return -1;
+  impl->changed(location_x, location_y, impl->obstacles.inflated_radius(uint32_t(id)));
+  impl->map_changed = true;
+
+  return 0;
+
+}
+
+int PlannerSession::remove_obstacle(int id) {
+
+  if (impl->graph != nullptr || impl->field != nullptr) return -1;
+
+  // Removing an obstacle never blocks a path, so it is not a change to check against
+  if (id < 0 || !impl->obstacles.erase(uint32_t(id))) return -1;
+  impl->map_changed = true;
+
+  return 0;
+
+}
+
+int PlannerSession::replan(google::protobuf::RepeatedPtrField<Coordinates> &path,
+    double timeout_seconds, PlannerReport *report)
+{
+  const auto started = chrono::steady_clock::now();
+
+  if (report != nullptr) report->Clear();
+
+  const auto invalid = [report]() {
+    if (report != nullptr) report->set_status(PlannerReport::INVALID_ARGUMENTS);
+    return -1;
+  };
+
+  if (!isfinite(timeout_seconds)) return invalid();
+  if (timeout_seconds <= 0.0) return invalid(); // timeout must be positive
+
+  Points points = points_of(path);
+  if (points.size() < 2) return invalid();
+
+  const auto &obstacles = impl->obstacles;
+  const auto start = points.front(), goal = points.back();
+
+  const auto fail = [&](PlannerReport::Status status) {
+    path.Clear();
+    if (report != nullptr) {
+      report->set_status(status);
+      report->set_planning_seconds(seconds_since(started));
+    }
+    return -2;
+  };
+
+  if (!obstacles.is_valid(start.first, start.second)) return fail(PlannerReport::INVALID_START);
+  if (!obstacles.is_valid(goal.first, goal.second)) return fail(PlannerReport::INVALID_GOAL);
+
+  // Check again only the segments that a change may block
+
+  const int segment_count = int(points.size()) - 1;
+  vector<bool> blocked(segment_count, false);
+  uint64_t motion_checks = 0;
+
+  for (int i = 0; i < segment_count; i++) {
+    const auto &a = points[i], &b = points[i + 1];
+    if (!impl->too_many_changes &&
+        none_of(impl->changes.begin(), impl->changes.end(), [&](const Change &change) { return may_block(change, a, b); })) {
+      continue;
+    }
+    motion_checks++;
+    blocked[i] = !obstacles.is_valid(a.first, a.second, b.first, b.second);
+  }
+
+  impl->changes.clear();
+  impl->too_many_changes = false;
+
+  const auto finish = [&](bool repaired, uint64_t tree_size) {
+    const double cost = detail::path_length(path);
+    if (repaired && impl->improved_path_callback) impl->improved_path_callback(path, cost);
+    if (report != nullptr) {
+      const double seconds = seconds_since(started);
+      report->set_status(PlannerReport::EXACT_SOLUTION);
+      report->set_first_solution_seconds(seconds);
+      report->set_planning_seconds(seconds);
+      report->set_tree_size(tree_size);
+      report->set_motion_checks(motion_checks);
+      report->set_cost(cost);
+      impl->report_culled(*report);
+      auto *point = report->add_convergence();
+      point->set_seconds(seconds);
+      point->set_cost(cost);
+    }
+    return 0;
+  };
+
+  if (none_of(blocked.begin(), blocked.end(), [](bool b) { return b; })) return finish(false, 0);
+
+  // Plans again, from scratch, with the rest of the budget, returning the first path found
+  const auto plan_again = [&]() {
+    const double elapsed = seconds_since(started);
+    if (!(timeout_seconds - elapsed > impl->simplify_seconds)) return fail(PlannerReport::TIMEOUT);
+    path.Clear(); // rather than start from it
+    const int result = plan(path, start.first, start.second, goal.first, goal.second,
+                            timeout_seconds - elapsed, numeric_limits<double>::max(), report);
+    if (report != nullptr) {
+      report->set_planning_seconds(elapsed + report->planning_seconds());
+      if (result == 0) report->set_first_solution_seconds(elapsed + report->first_solution_seconds());
+      for (auto &point : *report->mutable_convergence()) point.set_seconds(elapsed + point.seconds());
+    }
+    return result;
+  };
+
+  if (impl->lanes.empty()) return plan_again(); // the visibility graph, which is never updated, anyway
+
+  // Reconnect each blocked stretch locally, on the first lane, which is idle between queries
+
+  Lane &lane = impl->lanes.front();
+  lane.telemetry.reset(report != nullptr);
+
+  const auto deadline = started + chrono::duration_cast<chrono::steady_clock::duration>(
+      chrono::duration<double>(timeout_seconds));
+
+  const ob::PlannerTerminationCondition terminate([&deadline, cancel = impl->cancel]() {
+    return (cancel != nullptr && cancel->load()) || chrono::steady_clock::now() >= deadline;
+  });
+
+  uint64_t tree_size = 0;
+  if (!impl->reconnect(points, blocked, terminate, tree_size)) return plan_again();
+
+  copy_points(points, path);
+
+  if (report != nullptr) {
+    report->set_state_checks(lane.telemetry.state_checks);
+    report->set_checking_seconds(chrono::duration<double>(lane.telemetry.checking_time).count());
+    motion_checks += lane.telemetry.motion_checks;
+  }
+
+  return finish(true, tree_size);
+}
+
+// ---------------------------------------------------------------------------
+
+size_t sdmp::bb8::simple::distance_field_bytes(const MotionPlan &motion_plan, double resolution)
+{
+  if (!is_valid(motion_plan)) return 0;
+
+  return detail::DistanceField::memory_bytes(motion_plan, resolution);
+}
+
+namespace {
+
+  bool is_valid_options(const PlannerOptions &options) {
+
+    switch (options.algorithm) {
+      case PlannerOptions::Algorithm::rrt_star:
+      case PlannerOptions::Algorithm::visibility_graph:
+      case PlannerOptions::Algorithm::rrt_connect:
+      case PlannerOptions::Algorithm::informed_rrt_star:
+      case PlannerOptions::Algorithm::bit_star:
+      case PlannerOptions::Algorithm::hybrid:
+        break;
+      default:
+        return false;
+    }
+
+    if (!isfinite(options.range) || options.range < 0.0) return false;
+    if (!isfinite(options.simplify_seconds) || options.simplify_seconds < 0.0) return false;
+
+    if (!isfinite(options.field_resolution) || options.field_resolution < 0.0) return false;
+
+    return true;
+
+  }
+
+  // Whether a session in the motion plan can be created with the options, checked before indexing it
+  bool is_valid_session(const MotionPlan &motion_plan, const PlannerOptions &options) {
+    if (!is_valid_options(options)) return false;
+    if (options.field_resolution > 0.0 && distance_field_bytes(motion_plan, options.field_resolution) == 0) return false;
+    return true;
+  }
+
+  PlannerSessionPtr create_session(const MotionPlan &motion_plan, detail::ObstacleIndex &&obstacles,
+                                   const PlannerOptions &options) {
+    auto impl = make_unique<PlannerSession::Impl>(motion_plan, move(obstacles), options);
+    if (options.path_cache != nullptr) impl->map_hash = content_hash(motion_plan);
+    return make_shared<PlannerSession>(move(impl));
+  }
+
+}
+
+PlannerSessionPtr sdmp::bb8::simple::create_planner_session(const MotionPlan &motion_plan,
+                                                            const PlannerOptions &options)
+{
+  if (!is_valid(motion_plan)) return nullptr;
+  if (!is_valid_session(motion_plan, options)) return nullptr;
+
+  return create_session(motion_plan, detail::ObstacleIndex(motion_plan, 0.0, options.thread_count), options);
+}
+
+PlannerSessionPtr sdmp::detail::create_planner_session(const MotionPlan &motion_plan,
+                                                       const ObstacleIndex &obstacles,
+                                                       const PlannerOptions &options)
+{
+  if (!is_valid_session(motion_plan, options)) return nullptr;
+
+  return create_session(motion_plan, ObstacleIndex(obstacles), options);
+}
+
+PlannerSessionPtr sdmp::bb8::simple::create_planner_session(const FlatMap &map,
+                                                            const PlannerOptions &options)
+{
+  if (!is_valid_options(options)) return nullptr;
+
+  // Both need the obstacles of a motion plan
+  if (options.algorithm == PlannerOptions::Algorithm::visibility_graph) return nullptr;
+  if (options.field_resolution > 0.0) return nullptr;
+
+  // The session only uses the droid and bounds of the motion plan, and the obstacles of the map, as indexed in it
+  const auto bounds = create(map.droid_radius(), map.length(), map.width());
+  if (bounds == nullptr) return nullptr;
+
+  // Keyed as the motion plan the map was saved from, so that both share cached paths
+  auto impl = make_unique<PlannerSession::Impl>(*bounds, detail::ObstacleIndex(map, 0.0, options.thread_count), options);
+  impl->map_hash = map.content_hash();
+
+  return make_shared<PlannerSession>(move(impl));
+}
+
+// ---------------------------------------------------------------------------
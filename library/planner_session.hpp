@@ -0,0 +1,25 @@
+/*! \file
+ * Planner sessions over an index built once, and shared by many sessions
+ *
+ * This is a private header of the library, it is **not** installed.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include "sdmp.hpp"
+#include "obstacle_index.hpp"
+
+namespace sdmp::detail {
+
+// As `create_planner_session`, but the session copies the given index of the obstacles of
+// the motion plan, which is much quicker than indexing them again, so that many sessions
+// on the same map, such as the workers of a batch, only index it once
+//
+// Assumption on input: assert(is_valid(motion_plan)), and the index was built from it, without a
+// margin, or, but for the visibility graph and clearance fields, which need the obstacles of the
+// motion plan, from any map with the same droid and bounds, since those are all the session uses
+bb8::simple::PlannerSessionPtr create_planner_session(const MotionPlan &motion_plan,
+                                                      const ObstacleIndex &obstacles,
+                                                      const bb8::simple::PlannerOptions &options);
+
+} // end namespace sdmp::detail
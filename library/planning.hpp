@@ -0,0 +1,224 @@
+/*! \file
+ * The OMPL validators, and planning helpers, for `BB8` motion plans
+ *
+ * This is a private header of the library, it is **not** installed.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include "distance_field.hpp"
+#include "obstacle_index.hpp"
+#include "telemetry.hpp"
+
+#include <ompl/base/MotionValidator.h>
+#include <ompl/base/SpaceInformation.h>
+#include <ompl/base/StateValidityChecker.h>
+#include <ompl/base/spaces/RealVectorStateSpace.h>
+#include <ompl/geometric/PathGeometric.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace sdmp::detail {
+
+namespace ob = ompl::base;
+namespace og = ompl::geometric;
+
+// ---------------------------------------------------------------------------
+// This class is used by OMPL to plan the motion
+
+class ValidityChecker
+    : public ob::StateValidityChecker {
+
+  const ObstacleIndex &obstacles;
+  const DistanceField *field; // optional
+  Telemetry *telemetry;       // optional
+
+ public:
+
+  // Assumption on input: assert(is_valid(motion_plan))
+  explicit ValidityChecker(const ob::SpaceInformationPtr &si, const ObstacleIndex &obstacles,
+                           const DistanceField *field = nullptr, Telemetry *telemetry = nullptr)
+      : ob::StateValidityChecker(si), obstacles(obstacles), field(field), telemetry(telemetry) { }
+
+  // Returns whether the given state's position overlaps an obstacle or boundary
+  bool isValid(const ob::State *state) const override {
+
+    if (telemetry != nullptr) telemetry->state_checks++;
+    const CheckTimer timer(telemetry);
+
+    const auto *state2D = state->as<ob::RealVectorStateSpace::StateType>();
+    const double x = state2D->values[0];
+    const double y = state2D->values[1];
+
+    // The field decides, unless it is within its error margin of zero
+    double value;
+    if (field != nullptr && field->lookup(x, y, value)) {
+      if (value > field->margin()) return true;
+      if (value < -field->margin()) return false;
+    }
+
+    return obstacles.is_valid(x, y);
+
+  }
+
+  // Returns the distance from the given state's position to an obstacle or boundary,
+  // which is only approximate (within the field margin) when far from any of them
+  double clearance(const ob::State *state) const override {
+
+    // Get the current (x,y) Droid coordinate position
+    const auto *state2D = state->as<ob::RealVectorStateSpace::StateType>();
+    double x = state2D->values[0];
+    double y = state2D->values[1];
+
+    double value;
+    if (field != nullptr && field->lookup(x, y, value) && fabs(value) > field->margin()) {
+      return value;
+    }
+
+    // Calculate the minimum clearance to all nearby obstacles and boundary
+    return obstacles.clearance(x, y);
+
+  }
+
+};
+
+// ---------------------------------------------------------------------------
+// This class is used by OMPL to check the motion between two states exactly,
+// as a disc swept along a segment, instead of by sampling along the segment
+
+class SegmentValidator
+    : public ob::MotionValidator {
+
+  const ObstacleIndex &obstacles;
+  const DistanceField *field; // optional
+  Telemetry *telemetry;       // optional
+
+  // When a motion is invalid, back off this fraction from the first contact
+  static constexpr double contact_backoff = 1.0e-6;
+
+ public:
+
+  explicit SegmentValidator(const ob::SpaceInformationPtr &si, const ObstacleIndex &obstacles,
+                            const DistanceField *field = nullptr, Telemetry *telemetry = nullptr)
+      : ob::MotionValidator(si), obstacles(obstacles), field(field), telemetry(telemetry) { }
+
+  // Returns whether the motion from 's1' to 's2' is valid, including both states
+  bool checkMotion(const ob::State *s1, const ob::State *s2) const override {
+
+    if (telemetry != nullptr) telemetry->motion_checks++;
+    const CheckTimer timer(telemetry);
+
+    const auto &v1 = *s1->as<ob::RealVectorStateSpace::StateType>();
+    const auto &v2 = *s2->as<ob::RealVectorStateSpace::StateType>();
+
+    const bool result = is_clear(v1[0], v1[1], v2[0], v2[1]) || obstacles.is_valid(v1[0], v1[1], v2[0], v2[1]);
+
+    if (result) valid_++; else invalid_++;
+
+    return result;
+
+  }
+
+  // Returns whether the motion from 's1' to 's2' is valid, and if not, the last valid state
+  bool checkMotion(const ob::State *s1, const ob::State *s2, std::pair<ob::State *, double> &lastValid) const override {
+
+    if (telemetry != nullptr) telemetry->motion_checks++;
+    const CheckTimer timer(telemetry);
+
+    const auto &v1 = *s1->as<ob::RealVectorStateSpace::StateType>();
+    const auto &v2 = *s2->as<ob::RealVectorStateSpace::StateType>();
+
+    const double t = obstacles.first_contact(v1[0], v1[1], v2[0], v2[1]);
+
+    const bool result = t > 1.0;
+
+    if (!result) {
+      lastValid.second = std::max(0.0, t - contact_backoff);
+      if (lastValid.first != nullptr) {
+        si_->getStateSpace()->interpolate(s1, s2, lastValid.second, lastValid.first);
+      }
+    }
+
+    if (result) valid_++; else invalid_++;
+
+    return result;
+
+  }
+
+ private:
+
+  // Returns `true` if the field alone proves the segment valid: every point of
+  // the segment is within half its length of an end point, and clearance is
+  // 1-Lipschitz, so end point clearances above that half length suffice
+  bool is_clear(double x0, double y0, double x1, double y1) const {
+    if (field == nullptr) return false;
+    double value_0, value_1;
+    if (!field->lookup(x0, y0, value_0) || !field->lookup(x1, y1, value_1)) return false;
+    const double half_length = 0.5 * std::hypot(x1 - x0, y1 - y0);
+    return std::min(value_0, value_1) - field->margin() > half_length;
+  }
+
+};
+
+// ---------------------------------------------------------------------------
+
+// Constructs the robot state space in which we're planning, over the bounds of the plan
+inline ob::StateSpacePtr create_state_space(const MotionPlan &motion_plan) {
+
+  ob::StateSpacePtr space(new ob::RealVectorStateSpace());
+
+  // Set the dimension bounds for $R^2$ as given
+  auto *r2ss = space->as<ob::RealVectorStateSpace>();
+  r2ss->addDimension("length/m/x", 0.0, motion_plan.rectangle().length());
+  r2ss->addDimension("width/n/y", 0.0, motion_plan.rectangle().width());
+  r2ss->setup();
+
+  return space;
+
+}
+
+// Constructs, and sets up, a space information instance checked against the obstacles,
+// whose checks are counted by the telemetry, if any
+inline ob::SpaceInformationPtr create_space_information(const ob::StateSpacePtr &space,
+                                                        const ObstacleIndex &obstacles,
+                                                        const DistanceField *field = nullptr,
+                                                        Telemetry *telemetry = nullptr) {
+
+  ob::SpaceInformationPtr si(new ob::SpaceInformation(space));
+
+  // Set the object used to check which states in the space are valid
+  si->setStateValidityChecker(ob::StateValidityCheckerPtr(new ValidityChecker(si, obstacles, field, telemetry)));
+
+  // Set the object used to check motions exactly, rather than by discrete sampling
+  si->setMotionValidator(ob::MotionValidatorPtr(new SegmentValidator(si, obstacles, field, telemetry)));
+
+  // Setup the SpaceInformation
+  si->setup();
+
+  return si;
+
+}
+
+// Sets the (x,y) coordinates of a state
+inline void set_state(ob::State *state, double x, double y) {
+  auto *state2D = state->as<ob::RealVectorStateSpace::StateType>();
+  state2D->values[0] = x;
+  state2D->values[1] = y;
+}
+
+// Replaces the path with the states of a geometric path, reusing its allocated elements
+inline void copy_path(const og::PathGeometric &solution, google::protobuf::RepeatedPtrField<Coordinates> &path) {
+  path.Clear();
+  const auto &states = solution.getStates();
+  path.Reserve(int(states.size()));
+  for (const auto *state : states) {
+    auto *coordinates = path.Add();
+    const auto &values = *state->as<ob::RealVectorStateSpace::StateType>();
+    coordinates->set_x(values[0]);
+    coordinates->set_y(values[1]);
+  }
+}
+
+} // end namespace sdmp::detail
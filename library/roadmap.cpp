@@ -0,0 +1,207 @@
+#include "sdmp.hpp"
+#include "obstacle_index.hpp"
+#include "planning.hpp"
+
+#include <ompl/base/PlannerData.h>
+#include <ompl/base/PlannerDataStorage.h>
+#include <ompl/base/objectives/PathLengthOptimizationObjective.h>
+#include <ompl/geometric/planners/prm/PRM.h>
+#include <ompl/geometric/planners/prm/PRMstar.h>
+
+namespace ob = ompl::base;
+namespace og = ompl::geometric;
+
+#include <cstring>
+#include <limits>
+#include <mutex>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::bb8::simple;
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  // The roadmap stream header: magic, format version, and motion plan hash
+  const char roadmap_magic[8] = {'S', 'D', 'M', 'P', 'R', 'M', 'A', 'P'};
+  const uint32_t roadmap_version = 1;
+
+  void write_word(ostream &out, uint64_t word, int bytes) {
+    for (int i = 0; i < bytes; i++) out.put(char((word >> (8 * i)) & 0xff)); // little-endian
+  }
+
+  bool read_word(istream &in, uint64_t &word, int bytes) {
+    word = 0;
+    for (int i = 0; i < bytes; i++) {
+      const int c = in.get();
+      if (c == char_traits<char>::eof()) return false;
+      word |= uint64_t(uint8_t(c)) << (8 * i);
+    }
+    return true;
+  }
+
+}
+
+// ---------------------------------------------------------------------------
+
+struct Roadmap::Impl {
+
+  // Declared first, so that it outlives the validators that refer to it
+  const detail::ObstacleIndex obstacles;
+
+  const uint64_t hash;
+
+  ob::StateSpacePtr space;
+  ob::SpaceInformationPtr si;
+  ob::ProblemDefinitionPtr pdef;
+  ob::PlannerPtr planner;
+
+  mutex planner_mutex;
+
+  // Assumption on input: assert(is_valid(motion_plan))
+  explicit Impl(const MotionPlan &motion_plan);
+
+  // Sets up a (new or loaded) PRM* planner
+  void set_planner(ob::PlannerPtr planner);
+
+};
+
+Roadmap::Impl::Impl(const MotionPlan &motion_plan)
+    : obstacles(motion_plan), hash(content_hash(motion_plan))
+{
+  space = detail::create_state_space(motion_plan);
+  si = detail::create_space_information(space, obstacles);
+
+  // Any path through the roadmap satisfies a query, so there is no cost threshold
+  pdef = ob::ProblemDefinitionPtr(new ob::ProblemDefinition(si));
+  ob::OptimizationObjectivePtr obj(new ob::PathLengthOptimizationObjective(si));
+  obj->setCostThreshold(ob::Cost(numeric_limits<double>::infinity()));
+  pdef->setOptimizationObjective(obj);
+}
+
+void Roadmap::Impl::set_planner(ob::PlannerPtr prm) {
+  planner = move(prm);
+  planner->setProblemDefinition(pdef);
+  planner->setup();
+}
+
+// ---------------------------------------------------------------------------
+
+Roadmap::Roadmap(unique_ptr<Impl> impl)
+    : impl(move(impl)) { }
+
+Roadmap::~Roadmap() = default;
+
+int Roadmap::plan(google::protobuf::RepeatedPtrField<Coordinates> &path,
+    double x_init, double y_init, double x_goal, double y_goal,
+    double timeout_seconds)
+{
+  path.Clear();
+
+  if (!isfinite(x_init)) return -1;
+  if (!isfinite(y_init)) return -1;
+  if (!isfinite(x_goal)) return -1;
+  if (!isfinite(y_goal)) return -1;
+  if (!isfinite(timeout_seconds)) return -1;
+  if (timeout_seconds <= 0.0) return -1; // timeout must be positive
+
+  lock_guard<mutex> lock(impl->planner_mutex);
+
+  ob::ScopedState<> start(impl->space);
+  detail::set_state(start.get(), x_init, y_init);
+
+  ob::ScopedState<> goal(impl->space);
+  detail::set_state(goal.get(), x_goal, y_goal);
+
+  // Forget the previous query, but keep the roadmap
+  impl->planner->as<og::PRM>()->clearQuery();
+  impl->pdef->clearSolutionPaths();
+  impl->pdef->clearStartStates();
+  impl->pdef->setStartAndGoalStates(start, goal);
+
+  // Connects the start and goal to the roadmap, and searches it
+  const ob::PlannerStatus solved = impl->planner->solve(timeout_seconds);
+
+  if (!solved || !impl->pdef->hasExactSolution()) return -2;
+
+  detail::copy_path(*impl->pdef->getSolutionPath()->as<og::PathGeometric>(), path);
+
+  return 0;
+}
+
+void Roadmap::grow(double seconds) {
+  if (!isfinite(seconds) || seconds <= 0.0) return;
+  lock_guard<mutex> lock(impl->planner_mutex);
+  impl->planner->as<og::PRM>()->constructRoadmap(ob::timedPlannerTerminationCondition(seconds));
+}
+
+size_t Roadmap::milestone_count() const {
+  lock_guard<mutex> lock(impl->planner_mutex);
+  return impl->planner->as<og::PRM>()->milestoneCount();
+}
+
+size_t Roadmap::edge_count() const {
+  lock_guard<mutex> lock(impl->planner_mutex);
+  return impl->planner->as<og::PRM>()->edgeCount();
+}
+
+uint64_t Roadmap::hash() const {
+  return impl->hash;
+}
+
+// ---------------------------------------------------------------------------
+
+RoadmapPtr sdmp::bb8::simple::build_roadmap(const MotionPlan &motion_plan, double build_seconds)
+{
+  if (!isfinite(build_seconds) || build_seconds < 0.0) return nullptr;
+  if (!is_valid(motion_plan)) return nullptr;
+
+  auto impl = make_unique<Roadmap::Impl>(motion_plan);
+  impl->set_planner(ob::PlannerPtr(new og::PRMstar(impl->si)));
+
+  auto roadmap = make_shared<Roadmap>(move(impl));
+  roadmap->grow(build_seconds);
+
+  return roadmap;
+}
+
+bool sdmp::bb8::simple::save_roadmap(const Roadmap &roadmap, ostream &out)
+{
+  lock_guard<mutex> lock(roadmap.impl->planner_mutex);
+
+  out.write(roadmap_magic, sizeof(roadmap_magic));
+  write_word(out, roadmap_version, 4);
+  write_word(out, roadmap.impl->hash, 8);
+
+  ob::PlannerData data(roadmap.impl->si);
+  roadmap.impl->planner->getPlannerData(data);
+  ob::PlannerDataStorage().store(data, out);
+
+  return bool(out);
+}
+
+RoadmapPtr sdmp::bb8::simple::load_roadmap(const MotionPlan &motion_plan, istream &in)
+{
+  if (!is_valid(motion_plan)) return nullptr;
+
+  char magic[sizeof(roadmap_magic)];
+  if (!in.read(magic, sizeof(magic))) return nullptr;
+  if (memcmp(magic, roadmap_magic, sizeof(magic)) != 0) return nullptr;
+
+  uint64_t version, hash;
+  if (!read_word(in, version, 4) || version != roadmap_version) return nullptr;
+  if (!read_word(in, hash, 8) || hash != content_hash(motion_plan)) return nullptr;
+
+  auto impl = make_unique<Roadmap::Impl>(motion_plan);
+
+  ob::PlannerData data(impl->si);
+  ob::PlannerDataStorage().load(in, data);
+  if (!in) return nullptr;
+
+  impl->set_planner(ob::PlannerPtr(new og::PRM(data, true))); // PRM*, from the saved graph
+
+  return make_shared<Roadmap>(move(impl));
+}
+
+// ---------------------------------------------------------------------------
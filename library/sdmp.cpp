@@ -1,17 +1,19 @@
 #include "sdmp.hpp"
+#include "obstacle_index.hpp"
+#include "parallel.hpp"
+#include "path_cache.hpp"
 
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
 #include <google/protobuf/util/json_util.h>
 
-// Adapted from https://ompl.kavrakilab.org/optimalPlanningTutorial.html
-
-#include <ompl/base/spaces/RealVectorStateSpace.h>
-#include <ompl/base/objectives/PathLengthOptimizationObjective.h>
-#include <ompl/geometric/planners/rrt/RRTstar.h>
-#include <ompl/geometric/PathGeometric.h>
-
-namespace ob = ompl::base;
-namespace og = ompl::geometric;
+#include <ompl/util/Console.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <limits>
 #include <string>
 
 using namespace std;
@@ -71,71 +73,176 @@ string sdmp::save_json(const MotionPlan &motion_plan) {
 
 // ---------------------------------------------------------------------------
 
-string sdmp::bb8::simple::save_gnuplot(const MotionPlan &motion_plan)
-{
-  ostringstream commands;
+MotionPlanPtr sdmp::load_binary(const string &binary) {
 
-  const double alpha = 0.25;
+  MotionPlanPtr motion_plan(new MotionPlan());
+  if (!motion_plan->ParseFromString(binary)) motion_plan.reset();
 
-  commands << "set termoption enhanced" << endl;
-  commands << "set title '{/:Bold Simple Droid Motion Plan}'" << endl;
+  return motion_plan;
 
-  commands << "set xlabel '{/:Bold length} / {/:Italic m} / {/:Italic x}'" << endl;
-  commands << "set ylabel '{/:Bold width} / {/:Italic n} / {/:Italic y}'"  << endl;
-  commands << "set xrange [0:" << motion_plan.rectangle().length() << "]" << endl;
-  commands << "set yrange [0:" << motion_plan.rectangle().width()  << "]" << endl;
-  commands << "set size ratio " << motion_plan.rectangle().width() / motion_plan.rectangle().length() << endl;
-  commands << "set grid" << endl;
+}
 
-  unsigned index = 0;
+MotionPlanPtr sdmp::load_binary(istream &in) {
 
-  for (int i = 0; i < motion_plan.path_size(); i++) {
-    const double x(motion_plan.path(i).x()), y(motion_plan.path(i).y()), r(motion_plan.bb8().radius());
-    commands << "set object " << (++index) << " circle at " << x << "," << y << " size " << r
-      << " fillcolor rgb 'dark-orange' fillstyle transparent solid " << alpha << endl;
-  }
+  MotionPlanPtr motion_plan(new MotionPlan());
+  if (!motion_plan->ParseFromIstream(&in)) motion_plan.reset();
+
+  return motion_plan;
+
+}
+
+MotionPlan *sdmp::load_binary(google::protobuf::Arena &arena, const string &binary) {
+
+  auto *motion_plan = google::protobuf::Arena::CreateMessage<MotionPlan>(&arena);
+
+  // What was parsed stays on the arena until it is destroyed, as does anything allocated on it
+  return motion_plan->ParseFromString(binary) ? motion_plan : nullptr;
+
+}
+
+string sdmp::save_binary(const MotionPlan &motion_plan) {
+  return motion_plan.SerializeAsString();
+}
+
+bool sdmp::write_delimited(const MotionPlan &motion_plan, ostream &out) {
+  return google::protobuf::util::SerializeDelimitedToOstream(motion_plan, &out);
+}
+
+struct MotionPlanReader::Impl {
+
+  google::protobuf::io::IstreamInputStream stream;
+  bool failed = false;
+
+  explicit Impl(istream &in) : stream(&in) { }
+
+};
+
+MotionPlanReader::MotionPlanReader(istream &in)
+    : impl(make_unique<Impl>(in)) { }
+
+MotionPlanReader::~MotionPlanReader() = default;
+
+bool MotionPlanReader::read(MotionPlan &motion_plan) {
+
+  if (impl->failed) return false;
+
+  // Parsing merges, but clearing keeps the memory of the repeated fields, for reuse
+  motion_plan.Clear();
+
+  bool clean_eof = false;
+  if (google::protobuf::util::ParseDelimitedFromZeroCopyStream(&motion_plan, &impl->stream, &clean_eof)) return true;
 
-  if (motion_plan.path_size() >= 2) {
-    for (int i = 0; i < motion_plan.path_size() - 1; i++) {
-      commands << "set arrow from " << motion_plan.path(i).x() << "," << motion_plan.path(i).y() << " to "
-      << motion_plan.path(i + 1).x() << "," << motion_plan.path(i + 1).y()
-      << " linewidth 2 linecolor rgb 'dark-green'" << endl;
+  impl->failed = !clean_eof;
+  return false;
+
+}
+
+bool MotionPlanReader::failed() const {
+  return impl->failed;
+}
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  // See http://www.isthe.com/chongo/tech/comp/fnv/index.html#FNV-1a
+
+  class Fnv1a {
+
+    uint64_t value = 0xcbf29ce484222325ULL;
+
+   public:
+
+    void add(uint64_t word) {
+      for (int i = 0; i < 8; i++) { // little-endian, whatever the platform
+        value ^= (word >> (8 * i)) & 0xffULL;
+        value *= 0x100000001b3ULL;
+      }
+    }
+
+    void add(double number) {
+      if (number == 0.0) number = 0.0; // so that -0.0 hashes as 0.0
+      uint64_t word;
+      static_assert(sizeof(word) == sizeof(number), "IEEE 754 doubles are required");
+      memcpy(&word, &number, sizeof(word));
+      add(word);
     }
+
+    uint64_t digest() const { return value; }
+
+  };
+
+}
+
+uint64_t sdmp::content_hash(const MotionPlan &motion_plan) {
+
+  Fnv1a hash;
+
+  hash.add(uint64_t(motion_plan.Droid_case()));
+  if (motion_plan.has_bb8()) {
+    hash.add(motion_plan.bb8().radius());
   }
 
-  for (int i = 0; i < motion_plan.obstacle_size(); i++) {
-    const auto circle(motion_plan.obstacle(i).circle());
-    const double x(circle.coordinates().x()), y(circle.coordinates().y()), r(circle.radius());
-    commands << "set object " << (++index) << " circle at " << x << "," << y << " size " << r
-      << " fillcolor rgb 'black' fillstyle transparent solid " << alpha << endl;
+  hash.add(uint64_t(motion_plan.Bounds_case()));
+  if (motion_plan.has_rectangle()) {
+    hash.add(motion_plan.rectangle().length());
+    hash.add(motion_plan.rectangle().width());
+  }
+
+  hash.add(uint64_t(motion_plan.obstacle_size()));
+  for (const auto &obstacle : motion_plan.obstacle()) {
+    hash.add(uint64_t(obstacle.Type_case()));
+    if (obstacle.has_circle()) {
+      hash.add(obstacle.circle().radius());
+      hash.add(obstacle.circle().coordinates().x());
+      hash.add(obstacle.circle().coordinates().y());
+    }
   }
 
-  commands << "plot NaN notitle" << endl; // this command generates the plot even though we technically have no data
+  return hash.digest();
 
-  return commands.str();
 }
 
 // ---------------------------------------------------------------------------
 
+namespace {
+
+  bool is_valid_droid_and_bounds(double droid_radius, double bounds_length, double bounds_width) {
+    return isfinite(droid_radius) && droid_radius >= 0.0 &&
+           isfinite(bounds_length) && bounds_length >= 0.0 &&
+           isfinite(bounds_width) && bounds_width >= 0.0;
+  }
+
+  // The `mutable_` accessors allocate sub-messages where the plan lives, on its arena, if any
+  void set_droid_and_bounds(MotionPlan &motion_plan, double droid_radius, double bounds_length, double bounds_width) {
+
+    motion_plan.mutable_bb8()->set_radius(droid_radius);
+
+    auto *rectangle = motion_plan.mutable_rectangle();
+    rectangle->set_length(bounds_length);
+    rectangle->set_width(bounds_width);
+
+  }
+
+}
+
 MotionPlanPtr sdmp::bb8::simple::create(double droid_radius, double bounds_length, double bounds_width)
 {
+  if (!is_valid_droid_and_bounds(droid_radius, bounds_length, bounds_width)) return nullptr;
+
   MotionPlanPtr motion_plan(new MotionPlan());
+  set_droid_and_bounds(*motion_plan, droid_radius, bounds_length, bounds_width);
 
-  if (!isfinite(droid_radius) || droid_radius < 0.0 ||
-      !isfinite(bounds_length) || bounds_length < 0.0 ||
-      !isfinite(bounds_width) || bounds_width < 0.0 ) {
-    motion_plan.reset();
-    return motion_plan;
-  }
+  return motion_plan;
+}
 
-  auto bb8(new BB8());
-  bb8->set_radius(droid_radius);
-  motion_plan->set_allocated_bb8(bb8);
+MotionPlan *sdmp::bb8::simple::create(google::protobuf::Arena &arena,
+                                      double droid_radius, double bounds_length, double bounds_width)
+{
+  if (!is_valid_droid_and_bounds(droid_radius, bounds_length, bounds_width)) return nullptr;
 
-  auto rectangle(new Rectangle());
-  rectangle->set_length(bounds_length);
-  rectangle->set_width(bounds_width);
-  motion_plan->set_allocated_rectangle(rectangle);
+  auto *motion_plan = google::protobuf::Arena::CreateMessage<MotionPlan>(&arena);
+  set_droid_and_bounds(*motion_plan, droid_radius, bounds_length, bounds_width);
 
   return motion_plan;
 }
@@ -148,22 +255,20 @@ bool sdmp::add_circular_obstacle(MotionPlan &motion_plan, double location_x, dou
     return false;
   }
 
-  auto *obstacle = motion_plan.add_obstacle();
-  auto *circle = new Circle();
+  // Allocated where the plan lives, on its arena, if any
+  auto *circle = motion_plan.add_obstacle()->mutable_circle();
   circle->set_radius(radius);
-  auto *coordinates = new Coordinates();
+  auto *coordinates = circle->mutable_coordinates();
   coordinates->set_x(location_x);
   coordinates->set_y(location_y);
-  circle->set_allocated_coordinates(coordinates);
-  obstacle->set_allocated_circle(circle);
 
   return true;
 }
 
 // ---------------------------------------------------------------------------
 
-bool sdmp::bb8::simple::is_valid(const MotionPlan &motion_plan)
-{
+bool sdmp::detail::is_valid_map(const MotionPlan &motion_plan) {
+
   if (!motion_plan.IsInitialized()) return false;
 
   if (!motion_plan.has_bb8()) return false;
@@ -194,6 +299,17 @@ bool sdmp::bb8::simple::is_valid(const MotionPlan &motion_plan)
 
   }
 
+  return true;
+
+}
+
+bool sdmp::bb8::simple::is_valid(const MotionPlan &motion_plan)
+{
+  if (!detail::is_valid_map(motion_plan)) return false;
+
+  const auto &bb8(motion_plan.bb8());
+  const auto &bounds(motion_plan.rectangle());
+
   for (int i = 0; i < motion_plan.path_size(); i++) {
 
     const auto &path(motion_plan.path(i));
@@ -210,155 +326,192 @@ bool sdmp::bb8::simple::is_valid(const MotionPlan &motion_plan)
   return true;
 }
 
-// ---------------------------------------------------------------------------
-
 namespace {
 
-// ---------------------------------------------------------------------------
-// This class is used by OMPL to plan the motion
+  // Assumption on input: the map of the obstacles is valid, the path is not
+  // empty, and the verification, if any, has been cleared
+  bool verify(const detail::ObstacleIndex &obstacles, const google::protobuf::RepeatedPtrField<Coordinates> &path,
+              PathVerification *verification, unsigned thread_count) {
 
-class ValidityChecker
-    : public ob::StateValidityChecker {
+    const int count = path.size();
 
-  const MotionPlan &motion_plan;
+    // A path of one waypoint is checked as a segment of zero length
+    const size_t segment_count = size_t(max(1, count - 1));
 
- public:
+    const auto is_finite = [&path](int i) {
+      return isfinite(path.Get(i).x()) && isfinite(path.Get(i).y());
+    };
 
-  // Assumption on input: assert(is_valid(motion_plan))
-  explicit ValidityChecker(const ob::SpaceInformationPtr &si, const MotionPlan &motion_plan)
-      : ob::StateValidityChecker(si), motion_plan(motion_plan) { }
+    const auto segment_is_clear = [&](size_t i) {
+      const int j = min(int(i) + 1, count - 1);
+      if (!is_finite(int(i)) || !is_finite(j)) return false;
+      const auto &a = path.Get(int(i)), &b = path.Get(j);
+      return obstacles.is_valid(a.x(), a.y(), b.x(), b.y());
+    };
 
-  // Returns whether the given state's position overlaps an obstacle or boundary
-  bool isValid(const ob::State *state) const override {
-    return this->clearance(state) > 0.0;
-  }
+    const auto segment_clearance = [&](size_t i) {
+      const int j = min(int(i) + 1, count - 1);
+      if (!is_finite(int(i)) || !is_finite(j)) return -numeric_limits<double>::infinity();
+      const auto &a = path.Get(int(i)), &b = path.Get(j);
+      return obstacles.clearance(a.x(), a.y(), b.x(), b.y());
+    };
 
-  // Returns the distance from the given state's position to an obstacle or boundary
-  double clearance(const ob::State *state) const override {
+    // Check the segments in chunks, which long paths spread over the threads
 
-    // Get the Droid size and bounding rectangle
+    constexpr size_t chunk_size = 1024;
+    constexpr size_t none = numeric_limits<size_t>::max();
 
-    const double r_d = motion_plan.bb8().radius();
-    const double x_min = 0.0, y_min = 0.0;
-    const double x_max = motion_plan.rectangle().length();
-    const double y_max = motion_plan.rectangle().width();
+    struct Chunk {
+      double min_clearance = numeric_limits<double>::infinity();
+      size_t min_clearance_segment = 0;
+      size_t first_violation = none;
+    };
 
-    // Get the current (x,y) Droid coordinate position
-    const auto *state2D = state->as<ob::RealVectorStateSpace::StateType>();
-    double x = state2D->values[0];
-    double y = state2D->values[1];
+    const size_t chunk_count = (segment_count + chunk_size - 1) / chunk_size;
+    vector<Chunk> chunks(chunk_count);
 
-    // Calculate the minimum clearance to all obstacles and boundary
+    // Without a verification, any violation is the answer, so every chunk stops at the first one
+    atomic<bool> violated(false);
 
-    double clearance = numeric_limits<double>::infinity();
+    detail::parallel_for(chunk_count, detail::resolve_thread_count(thread_count), [&](unsigned, size_t c) {
 
-    clearance = min(clearance, (x - r_d) - x_min);
-    clearance = min(clearance, (y - r_d) - y_min);
-    clearance = min(clearance, x_max - (x + r_d));
-    clearance = min(clearance, y_max - (y + r_d));
+      Chunk &chunk = chunks[c];
+      const size_t end = min(segment_count, (c + 1) * chunk_size);
 
-    for (int i = 0; i < motion_plan.obstacle_size(); i++) {
-      const auto obstacle = motion_plan.obstacle(i);
-      const double r_o = obstacle.circle().radius();
-      const double delta_x = x - obstacle.circle().coordinates().x();
-      const double delta_y = y - obstacle.circle().coordinates().y();
-      const double distance = hypot(delta_x, delta_y); // compute sqrt(x*x+y*y) without undue overflow or underflow
-      clearance = min(clearance, distance - (r_d + r_o));
-    }
+      for (size_t i = c * chunk_size; i < end; i++) {
 
-    return clearance;
+        if (verification == nullptr) {
+          if (violated.load(memory_order_relaxed)) return;
+          if (!segment_is_clear(i)) violated = true;
+          continue;
+        }
 
-  }
+        const double clearance = segment_clearance(i);
+        if (clearance < chunk.min_clearance) {
+          chunk.min_clearance = clearance;
+          chunk.min_clearance_segment = i;
+        }
+        if (!(clearance > 0.0) && chunk.first_violation == none) chunk.first_violation = i;
 
-};
+      }
 
-} // end anonymous namespace -------------------------------------------------
+    });
 
-int sdmp::bb8::simple::find_path(MotionPlan &motion_plan,
-    double x_init, double y_init, double x_goal, double y_goal,
-    double timeout_seconds, double length_threshold)
-{
-  motion_plan.clear_path();
+    if (verification == nullptr) return !violated;
+
+    // The chunks are in order, so the first violation, and smallest clearance, are those of the first chunk with them
+
+    Chunk whole;
+    for (const auto &chunk : chunks) {
+      if (chunk.min_clearance < whole.min_clearance) {
+        whole.min_clearance = chunk.min_clearance;
+        whole.min_clearance_segment = chunk.min_clearance_segment;
+      }
+      if (whole.first_violation == none) whole.first_violation = chunk.first_violation;
+    }
+
+    const bool valid = whole.first_violation == none;
+
+    verification->set_valid(valid);
+    verification->set_first_violation(valid ? -1 : int32_t(whole.first_violation));
+    verification->set_min_clearance(whole.min_clearance);
+    verification->set_min_clearance_segment(uint32_t(whole.min_clearance_segment));
 
-  if (!isfinite(x_init)) return -1;
-  if (!isfinite(y_init)) return -1;
-  if (!isfinite(x_goal)) return -1;
-  if (!isfinite(y_goal)) return -1;
-  if (!isfinite(timeout_seconds)) return -1;
-  if (timeout_seconds <= 0.0) return -1; // timeout must be positive
-  if (!isfinite(length_threshold)) return -1;
-  if (length_threshold < 0.0) return -1; // zero means 'keep trying'
+    return valid;
 
-  // The `ValidityChecker` object will verify that initial and goal coordinates are valid
+  }
+
+}
 
-  // Construct the robot state space in which we're planning.
-  ob::StateSpacePtr space(new ob::RealVectorStateSpace());
+bool sdmp::bb8::simple::verify_path(const MotionPlan &motion_plan, PathVerification *verification, unsigned thread_count)
+{
+  if (verification != nullptr) {
+    verification->Clear();
+    verification->set_first_violation(-1);
+  }
 
-  // Set the dimension bounds for $R^2$ as given
-  auto *r2ss = space->as<ob::RealVectorStateSpace>();
-  r2ss->addDimension("length/m/x", 0.0, motion_plan.rectangle().length());
-  r2ss->addDimension("width/n/y", 0.0, motion_plan.rectangle().width());
-  r2ss->setup();
+  if (!detail::is_valid_map(motion_plan) || motion_plan.path_size() == 0) return false;
 
-  // Construct a space information instance for this state space
-  ob::SpaceInformationPtr si(new ob::SpaceInformation(space));
+  const detail::ObstacleIndex obstacles(motion_plan, 0.0, thread_count);
 
-  // Set the object used to check which states in the space are valid
-  si->setStateValidityChecker(ob::StateValidityCheckerPtr(new ValidityChecker(si, motion_plan)));
+  return verify(obstacles, motion_plan.path(), verification, thread_count);
+}
 
-  // Setup the SpaceInformation
-  si->setup();
+bool sdmp::bb8::simple::verify_path(const FlatMap &map, const google::protobuf::RepeatedPtrField<Coordinates> &path,
+                                    PathVerification *verification, unsigned thread_count)
+{
+  if (verification != nullptr) {
+    verification->Clear();
+    verification->set_first_violation(-1);
+  }
 
-  // Set our robot's starting state
-  ob::ScopedState<> start(space);
-  start->as<ob::RealVectorStateSpace::StateType>()->values[0] = x_init;
-  start->as<ob::RealVectorStateSpace::StateType>()->values[1] = y_init;
+  if (path.empty()) return false;
 
-  // Set our robot's goal state
-  ob::ScopedState<> goal(space);
-  goal->as<ob::RealVectorStateSpace::StateType>()->values[0] = x_goal;
-  goal->as<ob::RealVectorStateSpace::StateType>()->values[1] = y_goal;
+  // The map was checked when it was opened, and is indexed once
+  return verify(detail::ObstacleIndex::of(map), path, verification, thread_count);
+}
 
-  // Create a problem instance
-  ob::ProblemDefinitionPtr pdef(new ob::ProblemDefinition(si));
+// ---------------------------------------------------------------------------
 
-  // Set the start and goal states
-  pdef->setStartAndGoalStates(start, goal);
+int sdmp::bb8::simple::find_path(MotionPlan &motion_plan,
+    double x_init, double y_init, double x_goal, double y_goal,
+    double timeout_seconds, double length_threshold)
+{
+  return find_path(motion_plan, x_init, y_init, x_goal, y_goal, timeout_seconds, length_threshold, PlannerOptions());
+}
 
-  // Set the optimization objective and threshold
-  ob::OptimizationObjectivePtr obj(new ob::PathLengthOptimizationObjective(si));
-  obj->setCostThreshold(ob::Cost(length_threshold));
-  pdef->setOptimizationObjective(obj);
+int sdmp::bb8::simple::find_path(MotionPlan &motion_plan,
+    double x_init, double y_init, double x_goal, double y_goal,
+    double timeout_seconds, double length_threshold,
+    const PlannerOptions &options, PlannerReport *report)
+{
+  // Keep the previous path aside, to start from, so that it does not fail the validation of the map
+  google::protobuf::RepeatedPtrField<Coordinates> previous;
+  if (options.warm_start) previous.Swap(motion_plan.mutable_path());
 
-  // Construct our optimizing planner using the RRTstar algorithm.
-  ob::PlannerPtr optimizingPlanner(new og::RRTstar(si));
+  motion_plan.clear_path();
 
-  // Set the problem instance for our planner to solve
-  optimizingPlanner->setProblemDefinition(pdef);
-  optimizingPlanner->setup();
+  // A cached path is only checked, without the setup of a session, and planned paths are cached
 
-  // Attempt to solve the planning problem within one second of planning time
-  ob::PlannerStatus solved = optimizingPlanner->solve(timeout_seconds);
+  PathCache *cache = options.path_cache;
+  PlannerOptions uncached = options;
+  uncached.path_cache = nullptr;
 
-  const ob::PlannerStatus::StatusType status(solved); // TODO Use this for more informative error conditions
-  if (!solved) return -2;
+  // As the session would check them, but for the coordinates, which the cache checks
+  const bool valid_budget = isfinite(timeout_seconds) && timeout_seconds > 0.0 &&
+                            isfinite(length_threshold) && length_threshold >= 0.0;
 
-  // Save the output path to the motion plan
+  // The map is hashed once, for both the lookup and the insertion
+  const uint64_t map_hash = cache != nullptr ? content_hash(motion_plan) : 0;
 
-  assert(r2ss->getDimension() == 2);
-  assert(motion_plan.path_size() == 0);
+  if (cache != nullptr && valid_budget) {
+    const auto started = chrono::steady_clock::now();
+    if (cache->find(motion_plan, map_hash, x_init, y_init, x_goal, y_goal, *motion_plan.mutable_path())) {
+      const auto &path = motion_plan.path();
+      if (options.improved_path_callback) options.improved_path_callback(path, detail::path_length(path));
+      if (report != nullptr) {
+        detail::report_cached_path(*report, path, chrono::duration<double>(chrono::steady_clock::now() - started).count());
+      }
+      return 0;
+    }
+  }
 
-  const auto path = pdef->getSolutionPath()->as<og::PathGeometric>();
-  const auto states = path->getStates();
-  for (auto state : states) {
-    auto motion_path = motion_plan.add_path();
-    const auto &values = *state->as<ob::RealVectorStateSpace::StateType>();
-    motion_path->set_x(values[0]);
-    motion_path->set_y(values[1]);
+  // A one-shot session; reuse a `PlannerSession` to amortize the setup over many queries
+  const auto session = create_planner_session(motion_plan, uncached);
+  if (session == nullptr) {
+    if (report != nullptr) {
+      report->Clear();
+      report->set_status(PlannerReport::INVALID_ARGUMENTS);
+    }
+    return -1;
   }
 
-  // Done
-  return 0;
+  motion_plan.mutable_path()->Swap(&previous);
+
+  const int result = session->plan(*motion_plan.mutable_path(), x_init, y_init, x_goal, y_goal, timeout_seconds, length_threshold, report);
+  if (result == 0 && cache != nullptr) cache->insert(map_hash, x_init, y_init, x_goal, y_goal, motion_plan.path());
+
+  return result;
 }
 
 // ---------------------------------------------------------------------------
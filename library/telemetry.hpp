@@ -0,0 +1,58 @@
+/*! \file
+ * Counters, and timers, for the validity checks of a planner
+ *
+ * This is a private header of the library, it is **not** installed.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include <chrono>
+#include <cstdint>
+
+namespace sdmp::detail {
+
+/**
+ * \brief The validity checks made by one planner, on one thread.
+ *
+ * Counting is always on, since it costs an increment per check.
+ * Timing costs two clock reads per check, which is about as
+ * much as a check itself, so it is only on when requested.
+ */
+struct Telemetry {
+
+  std::uint64_t state_checks = 0;
+  std::uint64_t motion_checks = 0;
+  std::chrono::steady_clock::duration checking_time{};
+
+  bool timed = false;
+
+  void reset(bool timed_checks) {
+    *this = Telemetry();
+    timed = timed_checks;
+  }
+
+};
+
+// Adds the time from its construction to its destruction to the checking time, if timed
+class CheckTimer {
+
+  Telemetry *telemetry; // optional
+  std::chrono::steady_clock::time_point start;
+
+ public:
+
+  explicit CheckTimer(Telemetry *telemetry)
+      : telemetry(telemetry != nullptr && telemetry->timed ? telemetry : nullptr) {
+    if (this->telemetry != nullptr) start = std::chrono::steady_clock::now();
+  }
+
+  ~CheckTimer() {
+    if (telemetry != nullptr) telemetry->checking_time += std::chrono::steady_clock::now() - start;
+  }
+
+  CheckTimer(const CheckTimer &) = delete;
+  CheckTimer &operator=(const CheckTimer &) = delete;
+
+};
+
+} // end namespace sdmp::detail
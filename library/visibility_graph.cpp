@@ -0,0 +1,670 @@
+#include "visibility_graph.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+
+using namespace std;
+using namespace sdmp;
+using namespace sdmp::detail;
+
+// ---------------------------------------------------------------------------
+
+namespace {
+
+  constexpr double pi = 3.14159265358979323846;
+
+  // The circles are inflated by this fraction of the larger side of the rectangle
+  constexpr double relative_margin = 1.0e-9;
+
+  // Arcs are split into pieces of at most this angle, so that their polylines
+  // are at most a factor `1 + step² / 12` (under 0.1%) longer than the arcs
+  constexpr double max_arc_step = pi / 16.0;
+
+  // A polyline that bulges into an obstacle is split again, at most this many
+  // times, since halving the step quarters how far the polyline bulges out
+  constexpr int max_arc_splits = 8;
+
+  // Points on a circle closer than this angle are the same point
+  constexpr double min_arc_sweep = 1.0e-9;
+
+  // How often, in popped candidates, the search looks at the clock and the cancel flag
+  constexpr unsigned deadline_period = 64;
+
+  // The grid of the circles has at most this many cells along a side
+  constexpr int max_grid_side = 1024;
+
+  struct Point { double x, y; };
+
+  struct Disc { double x, y, r; }; // points are discs of radius zero
+
+  // Orientations are +1 for counterclockwise, and -1 for clockwise
+
+  // Finds the segment that leaves the first circle, and reaches the second one, tangentially
+  // and with the given orientations, returning `false` if there is no such segment
+  bool tangent(const Disc &from, int from_orientation, const Disc &to, int to_orientation,
+               Point &departure, Point &arrival) {
+
+    // With the signed radii 'a' and 'b', the tangent points are `c_from + a n` and
+    // `c_to + b n`, for the unit normal 'n' on the right of the direction of travel
+
+    const double dx = to.x - from.x, dy = to.y - from.y;
+    const double distance = hypot(dx, dy);
+    const double a = from_orientation * from.r, b = to_orientation * to.r;
+
+    const double cosine = (a - b) / distance;
+    if (!(fabs(cosine) < 1.0)) return false; // nested or overlapping circles, or coincident centers
+    const double sine = -sqrt(1.0 - cosine * cosine);
+
+    const double ux = dx / distance, uy = dy / distance;
+    const double nx = cosine * ux - sine * uy, ny = cosine * uy + sine * ux;
+
+    departure = {from.x + a * nx, from.y + a * ny};
+    arrival = {to.x + b * nx, to.y + b * ny};
+    return true;
+
+  }
+
+  // Returns the angle swept around the circle, with the given orientation, from 'p' to 'q'
+  double sweep(const Disc &circle, int orientation, const Point &p, const Point &q) {
+    if (circle.r == 0.0) return 0.0;
+    const double angle = orientation * (atan2(q.y - circle.y, q.x - circle.x) - atan2(p.y - circle.y, p.x - circle.x));
+    double result = fmod(angle, 2.0 * pi);
+    if (result < 0.0) result += 2.0 * pi;
+    if (result < min_arc_sweep || result > 2.0 * pi - min_arc_sweep) return 0.0;
+    return result;
+  }
+
+  // The polyline that follows an arc from its first point, with segments tangent to the circle,
+  // so that it never comes closer to the center than the arc does
+  struct ArcPolyline {
+
+    Disc circle;
+    int orientation;
+    double start, step, radius;
+
+    ArcPolyline(const Disc &circle, int orientation, const Point &p, double sweep, int pieces)
+        : circle(circle), orientation(orientation),
+          start(atan2(p.y - circle.y, p.x - circle.x)),
+          step(sweep / pieces),
+          radius(circle.r / cos(0.5 * step)) { }
+
+    // Returns the vertex 'i', of [0, pieces), between the end points, or its projection on the arc
+    Point vertex(int i, bool on_arc = false) const {
+      const double angle = start + orientation * (i + 0.5) * step;
+      const double r = on_arc ? circle.r : radius;
+      return {circle.x + r * cos(angle), circle.y + r * sin(angle)};
+    }
+
+  };
+
+  // The validity checks, counted (and timed, on request) like those of the OMPL planners
+
+  bool is_valid(const ObstacleIndex &obstacles, Telemetry &telemetry, const Point &p) {
+    telemetry.state_checks++;
+    const CheckTimer timer(&telemetry);
+    return obstacles.is_valid(p.x, p.y);
+  }
+
+  bool is_valid(const ObstacleIndex &obstacles, Telemetry &telemetry, const Point &p, const Point &q) {
+    telemetry.motion_checks++;
+    const CheckTimer timer(&telemetry);
+    return obstacles.is_valid(p.x, p.y, q.x, q.y);
+  }
+
+  // Returns the number of pieces of the first clear polyline along the arc from 'p' to 'q',
+  // or zero if there is none, which is always the case if the arc itself is blocked
+  int clear_arc_pieces(const ObstacleIndex &obstacles, Telemetry &telemetry, const Disc &circle, int orientation,
+                       const Point &p, const Point &q, double sweep) {
+
+    int pieces = max(1, int(ceil(sweep / max_arc_step)));
+
+    for (int split = 0; split <= max_arc_splits; split++, pieces *= 2) {
+
+      const ArcPolyline polyline(circle, orientation, p, sweep, pieces);
+
+      bool clear = true;
+      Point previous = p;
+
+      for (int i = 0; i < pieces && clear; i++) {
+        const Point on_arc = polyline.vertex(i, true);
+        if (!is_valid(obstacles, telemetry, on_arc)) return 0;
+        const Point vertex = polyline.vertex(i);
+        clear = is_valid(obstacles, telemetry, previous, vertex);
+        previous = vertex;
+      }
+
+      if (clear && is_valid(obstacles, telemetry, previous, q)) return pieces;
+
+    }
+
+    return 0;
+
+  }
+
+  // A vertex of the graph, reached along the arc of its parent's circle, then a tangent segment
+  struct Vertex {
+    uint64_t parent;
+    uint32_t circle;
+    int orientation;
+    Point arrival;   // on the vertex's circle
+    Point departure; // from the parent's circle
+    double sweep;    // of the arc along the parent's circle
+    int pieces;      // of the polyline along that arc
+    double g;        // the path length from the start
+  };
+
+  // A tangent from a circle to another (with an orientation), that may be clear
+  struct Tangent {
+    uint32_t circle;
+    int32_t orientation;
+    Point departure, arrival;
+  };
+
+  // A tangent from a vertex to a circle (with an orientation), whose edge is only checked when
+  // it is popped. Its points and length are recomputed then, which keeps the queue compact.
+  struct Candidate {
+    double f;
+    uint64_t parent;
+    uint32_t circle;
+    int32_t orientation;
+  };
+
+  // Pops the smallest estimate first, breaking ties so that searches are deterministic
+  bool operator>(const Candidate &a, const Candidate &b) {
+    if (a.f != b.f) return a.f > b.f;
+    if (a.parent != b.parent) return a.parent > b.parent;
+    if (a.circle != b.circle) return a.circle > b.circle;
+    return a.orientation > b.orientation;
+  }
+
+  // The tangents that leave a circle with one orientation, by the angle of their departure point
+  // around it, that are surely blocked, as a union of open arcs, within [0, 2π), but for those
+  // across zero, which are split in two, and overrun it, so that zero is covered too
+  class Shadows {
+
+   public:
+
+    void clear() { arcs.clear(); }
+
+    // Adds the tangents that cross the disc before they get further from the center of the
+    // circle than its far side, which are those departing in an arc, of less than π
+    void add(const Disc &from, int orientation, const Disc &disc) {
+
+      // The tangent departing at angle θ runs along the line of the points 'p' where
+      // `(p - c)·u(θ) = r`, which crosses the disc if `|v·u(θ) - r| < R`, for the
+      // vector 'v' from the center 'c' to that of the disc, and moves towards the disc
+      // in the arc where the angle from 'v' to u(θ) has the sign of the orientation
+
+      const double vx = disc.x - from.x, vy = disc.y - from.y;
+      const double distance = sqrt(vx * vx + vy * vy);
+      if (!(distance > 0.0)) return;
+
+      const double near = acos(min(1.0, (from.r + disc.r) / distance));
+      const double far = acos(max(-1.0, (from.r - disc.r) / distance));
+      if (!(near < far)) return;
+
+      const double phi = atan2(vy, vx);
+      if (orientation > 0) insert(phi - far, phi - near);
+      else insert(phi + near, phi + far);
+
+    }
+
+    // Adds the tangents that cross a side, with the outward normal at the given angle, at the given distance
+    // from the center of the circle, before they get the given distance from it, which the departure
+    // angles θ of the tangents along `c + r u(θ) + s t(θ)`, for s in [0, √(d² - r²)), do if
+    // `r cos(θ - ψ) - o √(d² - r²) sin(θ - ψ) > h`, that is `d cos(θ - ψ + o β) > h`, or depart beyond it
+    void add(const Disc &from, int orientation, double normal, double h, double d) {
+      if (!(d > from.r) || !(h < d)) return;
+      const double half = acos(max(-1.0, h / d));
+      const double middle = normal - orientation * atan2(sqrt(d * d - from.r * from.r), from.r);
+      if (half < pi) insert(middle - half, middle + half);
+      else arcs.assign(1, {-1.0, 2.0 * pi + 1.0}); // the circle is that far beyond the side
+    }
+
+    // Whether the angle, in [0, 2π), is in an arc
+    bool covers(double angle) const {
+      const auto after = upper_bound(arcs.begin(), arcs.end(), angle,
+                                     [](double a, const pair<double, double> &arc) { return a < arc.first; });
+      return after != arcs.begin() && angle < prev(after)->second;
+    }
+
+    bool covers_all() const { return arcs.size() == 1 && arcs[0].first < 0.0 && arcs[0].second > 2.0 * pi; }
+
+   private:
+
+    void insert(double from, double to) {
+      double start = from;
+      while (start < 0.0) start += 2.0 * pi;
+      while (start >= 2.0 * pi) start -= 2.0 * pi;
+      const double end = start + (to - from);
+      if (end <= 2.0 * pi) {
+        merge(start, end);
+      } else {
+        merge(start, 2.0 * pi + 1.0);
+        merge(-1.0, end - 2.0 * pi);
+      }
+    }
+
+    // Merges the open arc with those it overlaps, keeping the arcs sorted and disjoint
+    void merge(double start, double end) {
+      auto first = lower_bound(arcs.begin(), arcs.end(), start,
+                               [](const pair<double, double> &arc, double a) { return arc.second <= a; });
+      auto last = first;
+      while (last != arcs.end() && last->first < end) {
+        start = min(start, last->first);
+        end = max(end, last->second);
+        ++last;
+      }
+      if (first == last) {
+        arcs.insert(first, {start, end});
+      } else {
+        *first = {start, end};
+        arcs.erase(next(first), last);
+      }
+    }
+
+    vector<pair<double, double>> arcs; // sorted, and disjoint
+
+  };
+
+  // A circle, by its distance from the one being expanded, in a min-heap
+  typedef pair<double, uint32_t> Ranked;
+
+}
+
+// ---------------------------------------------------------------------------
+
+VisibilityGraph::VisibilityGraph(const MotionPlan &motion_plan, unsigned thread_count)
+    : margin(relative_margin * max(motion_plan.rectangle().length(), motion_plan.rectangle().width())),
+      obstacles(motion_plan, 0.5 * margin, thread_count),
+      x_min(motion_plan.bb8().radius()),
+      y_min(motion_plan.bb8().radius()),
+      x_max(motion_plan.rectangle().length() - motion_plan.bb8().radius()),
+      y_max(motion_plan.rectangle().width() - motion_plan.bb8().radius())
+{
+  const double r_d = motion_plan.bb8().radius();
+
+  // Skip the circles that do not reach into the rectangle that the droid's center may visit
+
+  for (const auto &obstacle : motion_plan.obstacle()) {
+    const auto &circle(obstacle.circle());
+    const double x = circle.coordinates().x(), y = circle.coordinates().y();
+    const double r = circle.radius() + r_d + margin;
+    if (hypot(x - clamp(x, r_d, max(r_d, x_max)), y - clamp(y, r_d, max(r_d, y_max))) >= r) continue;
+    xs.push_back(x);
+    ys.push_back(y);
+    rs.push_back(r);
+  }
+
+  // Find the circles that overlap, sweeping them by their left edges, so that each is only
+  // compared with those whose horizontal extents overlap its own
+
+  const uint32_t count = uint32_t(xs.size());
+
+  vector<uint32_t> order(count);
+  for (uint32_t i = 0; i < count; i++) order[i] = i;
+  sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return xs[a] - rs[a] < xs[b] - rs[b]; });
+
+  vector<pair<uint32_t, uint32_t>> overlaps;
+  for (uint32_t k = 0; k < count; k++) {
+    const uint32_t i = order[k];
+    for (uint32_t l = k + 1; l < count && xs[order[l]] - rs[order[l]] < xs[i] + rs[i]; l++) {
+      const uint32_t j = order[l];
+      if (hypot(xs[i] - xs[j], ys[i] - ys[j]) < rs[i] + rs[j]) {
+        overlaps.emplace_back(i, j);
+        overlaps.emplace_back(j, i);
+      }
+    }
+  }
+
+  sort(overlaps.begin(), overlaps.end());
+
+  neighbour_start.assign(count + 1, 0);
+  neighbours.reserve(overlaps.size());
+  for (const auto &[i, j] : overlaps) {
+    neighbour_start[i + 1]++;
+    neighbours.push_back(j);
+  }
+  for (uint32_t i = 0; i < count; i++) neighbour_start[i + 1] += neighbour_start[i];
+
+  // Bucket the circles by the cell of their center, a few per cell, clamping those off the grid to its edge
+
+  const double length = motion_plan.rectangle().length(), width = motion_plan.rectangle().width();
+  cell_size = max(sqrt(2.0 * length * width / max(1u, count)), 1.0e-3 * max(length, width));
+  if (!(cell_size > 0.0)) cell_size = 1.0;
+  columns = int(min(double(max_grid_side), max(1.0, ceil(length / cell_size))));
+  rows = int(min(double(max_grid_side), max(1.0, ceil(width / cell_size))));
+
+  cell_start.assign(size_t(columns) * rows + 1, 0);
+  vector<uint32_t> cells(count);
+  for (uint32_t i = 0; i < count; i++) {
+    cells[i] = cell_of(xs[i], ys[i]);
+    cell_start[cells[i] + 1]++;
+    r_max = max(r_max, rs[i]);
+  }
+  for (size_t c = 0; c + 1 < cell_start.size(); c++) cell_start[c + 1] += cell_start[c];
+
+  vector<uint32_t> fill(cell_start.begin(), cell_start.end() - 1);
+  cell_circles.resize(count);
+  for (uint32_t i = 0; i < count; i++) cell_circles[fill[cells[i]]++] = i;
+}
+
+uint32_t VisibilityGraph::cell_of(double x, double y) const {
+  const int column = int(clamp(floor(x / cell_size), 0.0, double(columns - 1)));
+  const int row = int(clamp(floor(y / cell_size), 0.0, double(rows - 1)));
+  return uint32_t(row) * uint32_t(columns) + uint32_t(column);
+}
+
+bool VisibilityGraph::is_buried(uint32_t i, double x, double y) const {
+
+  // Only by more than the margin, which the checks of the edge inflate the droid by a half of
+  if (x < x_min - margin || x > x_max + margin || y < y_min - margin || y > y_max + margin) return true;
+
+  for (uint32_t k = neighbour_start[i]; k < neighbour_start[i + 1]; k++) {
+    const uint32_t j = neighbours[k];
+    if (hypot(x - xs[j], y - ys[j]) < rs[j] - 2.0 * margin) return true;
+  }
+
+  return false;
+
+}
+
+int VisibilityGraph::find_path(google::protobuf::RepeatedPtrField<Coordinates> &path,
+                               double x_init, double y_init, double x_goal, double y_goal,
+                               chrono::steady_clock::time_point deadline,
+                               const atomic<bool> *cancel,
+                               PlannerReport *report) const
+{
+  const auto started = chrono::steady_clock::now();
+
+  path.Clear();
+  if (report != nullptr) report->Clear();
+
+  Telemetry telemetry;
+  telemetry.reset(report != nullptr);
+
+  size_t vertex_count = 0;
+
+  // Fills the report, if any, and returns the result
+  const auto finish = [&](PlannerReport::Status status) {
+    if (report != nullptr) {
+      const double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+      report->set_status(status);
+      report->set_planning_seconds(seconds);
+      report->set_tree_size(vertex_count);
+      report->set_state_checks(telemetry.state_checks);
+      report->set_motion_checks(telemetry.motion_checks);
+      report->set_checking_seconds(chrono::duration<double>(telemetry.checking_time).count());
+      if (status == PlannerReport::EXACT_SOLUTION) {
+        double cost = 0.0;
+        for (int i = 0; i + 1 < path.size(); i++) {
+          cost += hypot(path.Get(i + 1).x() - path.Get(i).x(), path.Get(i + 1).y() - path.Get(i).y());
+        }
+        report->set_first_solution_seconds(seconds);
+        report->set_cost(cost);
+        auto *point = report->add_convergence();
+        point->set_seconds(seconds);
+        point->set_cost(cost);
+      }
+    }
+    return status == PlannerReport::EXACT_SOLUTION ? 0 : -2;
+  };
+
+  // The end points must be outside of the inflated circles
+  if (!(obstacles.clearance(x_init, y_init) > 0.5 * margin)) return finish(PlannerReport::INVALID_START);
+  if (!(obstacles.clearance(x_goal, y_goal) > 0.5 * margin)) return finish(PlannerReport::INVALID_GOAL);
+
+  const auto add = [&path](const Point &point) {
+    auto *coordinates = path.Add();
+    coordinates->set_x(point.x);
+    coordinates->set_y(point.y);
+  };
+
+  if (x_init == x_goal && y_init == y_goal) {
+    add({x_init, y_init});
+    add({x_goal, y_goal});
+    return finish(PlannerReport::EXACT_SOLUTION);
+  }
+
+  // The start and goal are the last two circles, of radius zero
+
+  const uint32_t count = uint32_t(xs.size()), start = count, goal = count + 1;
+
+  const auto circle = [&](uint32_t i) -> Disc {
+    if (i == start) return {x_init, y_init, 0.0};
+    if (i == goal) return {x_goal, y_goal, 0.0};
+    return {xs[i], ys[i], rs[i]};
+  };
+
+  // A vertex is identified by the tangent that reaches it, since that fixes its point and orientation
+  const auto key_of = [&](uint32_t from, int from_orientation, uint32_t to, int to_orientation) {
+    return ((uint64_t(from) * (count + 2) + to) << 2) | (from_orientation > 0 ? 2 : 0) | (to_orientation > 0 ? 1 : 0);
+  };
+
+  const uint64_t start_key = key_of(start, 1, start, 1), goal_key = key_of(goal, 1, goal, 1);
+
+  unordered_map<uint64_t, Vertex> vertices;
+  priority_queue<Candidate, vector<Candidate>, greater<Candidate>> candidates;
+
+  // The tangent from the vertex's circle, with its orientation, to a circle, and the resulting length
+
+  const auto length = [&](const Vertex &vertex, const Point &departure, const Point &arrival, double &swept) {
+    const Disc from = circle(vertex.circle);
+    swept = sweep(from, vertex.orientation, vertex.arrival, departure);
+    return vertex.g + from.r * swept + hypot(arrival.x - departure.x, arrival.y - departure.y);
+  };
+
+  const auto edge = [&](const Vertex &vertex, uint32_t to, int to_orientation,
+                        Point &departure, Point &arrival, double &swept, double &g) {
+    if (!tangent(circle(vertex.circle), vertex.orientation, circle(to), to_orientation, departure, arrival)) return false;
+    g = length(vertex, departure, arrival, swept);
+    return true;
+  };
+
+  const auto next_key = [&](const Vertex &vertex, uint32_t to, int to_orientation) {
+    return to == goal ? goal_key : key_of(vertex.circle, vertex.orientation, to, to_orientation);
+  };
+
+  // Finds the tangents from a circle, with an orientation, to the goal and the other circles, but for those
+  // surely blocked by a nearer circle: it visits the circles ring by ring of cells, and ranks them by how
+  // near to the circle they come, so that the tangent to each is only kept once every circle that could
+  // block it before it gets there casts its shadow, and stops once the shadows cover every tangent
+
+  Shadows shadows;
+  vector<Ranked> targets, blockers; // by their near, and far, side
+
+  const auto look = [&](uint32_t from_circle, int orientation, vector<Tangent> &visible) {
+
+    const Disc from = circle(from_circle);
+
+    const auto keep = [&](uint32_t to, int to_orientation) {
+      Point departure, arrival;
+      if (!tangent(from, orientation, circle(to), to_orientation, departure, arrival)) return;
+      if (arrival.x != departure.x || arrival.y != departure.y) {
+        // The angle of the departure point, from the direction of the tangent, which also holds for a point
+        double angle = atan2(arrival.y - departure.y, arrival.x - departure.x) - orientation * 0.5 * pi;
+        if (angle < 0.0) angle += 2.0 * pi;
+        if (angle >= 2.0 * pi) angle -= 2.0 * pi;
+        if (shadows.covers(angle)) return;
+      }
+      if (to != goal && is_buried(to, arrival.x, arrival.y)) return;
+      if (from_circle != start && is_buried(from_circle, departure.x, departure.y)) return;
+      visible.push_back({to, to_orientation, departure, arrival});
+    };
+
+    shadows.clear();
+    targets.clear();
+    blockers.clear();
+
+    const auto rank = [](vector<Ranked> &heap, double distance, uint32_t i) {
+      heap.emplace_back(distance, i);
+      push_heap(heap.begin(), heap.end(), greater<Ranked>());
+    };
+
+    rank(targets, hypot(x_goal - from.x, y_goal - from.y), goal);
+
+    const uint32_t home = cell_of(from.x, from.y);
+    const int column = int(home % uint32_t(columns)), row = int(home / uint32_t(columns));
+    const int last_ring = max(max(column, columns - 1 - column), max(row, rows - 1 - row));
+
+    for (int ring = 0; ring <= last_ring; ring++) {
+
+      // The cells at this Chebyshev distance from that of the circle, within the grid
+      for (int r = max(0, row - ring); r <= min(rows - 1, row + ring); r++) {
+        const int step = r == row - ring || r == row + ring ? 1 : 2 * ring;
+        for (int c = column - ring; c <= column + ring; c += max(1, step)) {
+          if (c < 0 || c >= columns) continue;
+          const uint32_t cell = uint32_t(r) * uint32_t(columns) + uint32_t(c);
+          for (uint32_t k = cell_start[cell]; k < cell_start[cell + 1]; k++) {
+            const uint32_t i = cell_circles[k];
+            if (i == from_circle) continue;
+            const double dx = xs[i] - from.x, dy = ys[i] - from.y, distance = sqrt(dx * dx + dy * dy);
+            rank(targets, distance - rs[i], i);
+            rank(blockers, distance + rs[i] - 2.0 * margin, i); // shrunk, as for `is_buried`
+          }
+        }
+      }
+
+      // The sides of the rectangle cast shadows too, up to the distance of the targets left from the last ring
+      if (ring > 0) {
+        const double d = (ring - 1) * cell_size - r_max;
+        shadows.add(from, orientation, 0.0, x_max + margin - from.x, d);
+        shadows.add(from, orientation, 0.5 * pi, y_max + margin - from.y, d);
+        shadows.add(from, orientation, pi, from.x - (x_min - margin), d);
+        shadows.add(from, orientation, -0.5 * pi, from.y - (y_min - margin), d);
+      }
+
+      // Every circle whose center is nearer than this has been ranked, and so has every circle that
+      // comes nearer than this, less the largest radius, and every one that could block its tangents
+      const double known = ring < last_ring ? ring * cell_size - r_max : numeric_limits<double>::infinity();
+
+      while (!targets.empty() && targets.front().first <= known) {
+        const uint32_t to = targets.front().second;
+        const double near = targets.front().first;
+        pop_heap(targets.begin(), targets.end(), greater<Ranked>());
+        targets.pop_back();
+        while (!blockers.empty() && blockers.front().first < near - margin) {
+          const uint32_t i = blockers.front().second;
+          pop_heap(blockers.begin(), blockers.end(), greater<Ranked>());
+          blockers.pop_back();
+          shadows.add(from, orientation, {xs[i], ys[i], rs[i] - 2.0 * margin});
+        }
+        if (shadows.covers_all()) return;
+        if (to == goal) {
+          keep(goal, 1);
+        } else {
+          keep(to, 1);
+          keep(to, -1);
+        }
+      }
+
+    }
+
+  };
+
+  // The tangents from each circle, but the goal, with each orientation, which are the same for every
+  // vertex on it, so that each is only looked for once, the first time a vertex on it is expanded
+  vector<vector<Tangent>> visible(2 * (size_t(count) + 1));
+  vector<bool> looked(visible.size(), false);
+
+  // Pushes the tangents from the vertex, but for those to vertices already reached
+
+  const auto expand = [&](uint64_t key, const Vertex &vertex) {
+
+    const size_t slot = 2 * size_t(vertex.circle) + (vertex.orientation > 0 ? 1 : 0);
+    if (!looked[slot]) {
+      look(vertex.circle, vertex.orientation, visible[slot]);
+      looked[slot] = true;
+    }
+
+    for (const Tangent &next : visible[slot]) {
+      if (vertices.count(next_key(vertex, next.circle, next.orientation)) > 0) continue;
+      double swept = 0.0;
+      const double g = length(vertex, next.departure, next.arrival, swept);
+      const double h = hypot(x_goal - next.arrival.x, y_goal - next.arrival.y); // consistent, so A* is exact
+      candidates.push({g + h, key, next.circle, next.orientation});
+    }
+
+  };
+
+  expand(start_key, vertices[start_key] = {start_key, start, 1, {x_init, y_init}, {x_init, y_init}, 0.0, 0, 0.0});
+
+  // Lazy A*: check each edge only when its candidate is popped, and drop it if it is blocked
+
+  for (unsigned popped = 1; !candidates.empty(); popped++) {
+
+    if (popped % deadline_period == 0) {
+      vertex_count = vertices.size();
+      if (cancel != nullptr && cancel->load()) return finish(PlannerReport::ABORT);
+      if (chrono::steady_clock::now() >= deadline) return finish(PlannerReport::TIMEOUT);
+    }
+
+    const Candidate candidate = candidates.top();
+    candidates.pop();
+
+    const Vertex &parent = vertices.at(candidate.parent);
+    const uint64_t key = next_key(parent, candidate.circle, candidate.orientation);
+
+    if (vertices.count(key) > 0) continue; // already reached, by a shorter path
+
+    Point departure, arrival;
+    double swept = 0.0, g = 0.0;
+    edge(parent, candidate.circle, candidate.orientation, departure, arrival, swept, g);
+
+    int pieces = 0;
+    if (swept > 0.0) {
+      pieces = clear_arc_pieces(obstacles, telemetry, circle(parent.circle), parent.orientation, parent.arrival, departure, swept);
+      if (pieces == 0) continue;
+    }
+
+    if (!is_valid(obstacles, telemetry, departure, arrival)) continue;
+
+    const Vertex &vertex = vertices[key] = {candidate.parent, candidate.circle, candidate.orientation,
+                                            arrival, departure, swept, pieces, g};
+
+    if (key != goal_key) {
+      expand(key, vertex);
+      continue;
+    }
+
+    // Walk back from the goal, then output the path from the start
+
+    vector<const Vertex *> chain;
+    for (uint64_t link = goal_key; link != start_key; link = vertices.at(link).parent) {
+      chain.push_back(&vertices.at(link));
+    }
+
+    // Every point is known by now, so that the path is allocated once
+    int point_count = 1;
+    for (const Vertex *next : chain) point_count += next->pieces > 0 ? next->pieces + 2 : 1;
+    path.Reserve(point_count);
+
+    add({x_init, y_init});
+
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      const Vertex &next = **it;
+      if (next.pieces > 0) {
+        const Vertex &previous = vertices.at(next.parent);
+        const ArcPolyline polyline(circle(previous.circle), previous.orientation, previous.arrival, next.sweep, next.pieces);
+        for (int i = 0; i < next.pieces; i++) add(polyline.vertex(i));
+        add(next.departure);
+      }
+      add(next.arrival);
+    }
+
+    vertex_count = vertices.size();
+    return finish(PlannerReport::EXACT_SOLUTION);
+
+  }
+
+  vertex_count = vertices.size();
+  return finish(PlannerReport::INFEASIBLE); // every reachable vertex is expanded
+}
+
+// ---------------------------------------------------------------------------
@@ -0,0 +1,111 @@
+/*! \file
+ * An exact shortest-path solver over the tangent graph of a `MotionPlan`
+ *
+ * This is a private header of the library, it is **not** installed.
+ */
+
+#pragma once // https://en.wikipedia.org/wiki/Pragma_once#Portability
+
+#include "obstacle_index.hpp"
+#include "telemetry.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace sdmp::detail {
+
+/**
+ * \brief The tangent visibility graph of a `BB8` motion plan.
+ *
+ * The shortest path of a disc among circular obstacles, in a
+ * rectangle, is made of segments tangent to the obstacles
+ * (inflated by the droid radius) and of arcs along them. So
+ * the graph's vertices are tangent points, reached with a
+ * given orientation (clockwise or counterclockwise) around
+ * their circle, and its edges are an arc followed by a
+ * tangent segment.
+ *
+ * The graph is never built in full: A* expands a vertex by
+ * enumerating the tangents from its circle to the others,
+ * and only checks an edge, with the spatial index, when it
+ * is popped. So only the edges that could be on a shortest
+ * path are ever checked, rather than all O(n²) of them, each
+ * against all n obstacles.
+ *
+ * The tangents from a circle are found by a rotational sweep: it
+ * visits the circles on a uniform grid, ring by ring of cells,
+ * nearest first, and each casts a shadow over the tangents that it
+ * surely blocks. A tangent is only kept if it is out of the shadows
+ * of the circles nearer than its end, and the sweep stops once they
+ * cover every tangent. So it only reaches the k circles up to the
+ * distance where every line of sight from the circle is blocked.
+ * The tangents only depend on the circle and the orientation, so
+ * each is swept at most once per search, and expanding a vertex
+ * only queues the tangents kept: a search of V vertices takes
+ * O(min(V, n) k log k + V t log V) time, with t ≤ k the tangents
+ * kept, rather than O(V n log n), in maps cluttered enough that k
+ * does not grow with n; only in open maps does k approach n. Tangents
+ * that touch their circles where another one overlaps them, as in
+ * walls made of circles, are dropped too. Only edges whose check
+ * would fail are dropped, so the paths are unchanged.
+ *
+ * The circles are inflated by a small margin (a billionth of
+ * the rectangle), and arcs are output as polylines that are
+ * tangent to them, so paths clear every obstacle and boundary
+ * by half of that margin, and are within 0.1% of optimal.
+ *
+ * The graph is immutable, so it may be searched concurrently.
+ */
+class VisibilityGraph {
+
+ public:
+
+  // Assumption on input: assert(is_valid(motion_plan))
+  //
+  // Indexes the obstacles on (at most) the given number of threads, zero for one per hardware thread
+  explicit VisibilityGraph(const MotionPlan &motion_plan, unsigned thread_count = 0);
+
+  // Sets 'path' to the shortest path and returns zero, or returns -2, with
+  // an empty path, if there is none, or the deadline passes or the (optional)
+  // cancel flag is set first, and replaces the report, if any, with what the
+  // search did
+  int find_path(google::protobuf::RepeatedPtrField<Coordinates> &path,
+                double x_init, double y_init, double x_goal, double y_goal,
+                std::chrono::steady_clock::time_point deadline,
+                const std::atomic<bool> *cancel = nullptr,
+                PlannerReport *report = nullptr) const;
+
+ private:
+
+  double margin; // by which the circles are inflated
+
+  // Checks the output, with the droid inflated by half of the margin
+  ObstacleIndex obstacles;
+
+  // The circles that reach into the rectangle, inflated by the droid radius and the margin
+  std::vector<double> xs, ys, rs;
+
+  // The circles that overlap each circle, those of circle 'i' in [neighbour_start[i], neighbour_start[i+1])
+  std::vector<std::uint32_t> neighbour_start, neighbours;
+
+  // Whether a point on circle 'i' is surely inside one of the circles that overlap it, or out of
+  // bounds, so that any tangent through it is blocked, as the check of its edge would find later
+  bool is_buried(std::uint32_t i, double x, double y) const;
+
+  double x_min, y_min, x_max, y_max; // of the droid's center
+
+  // The circles by the cell of their center, those of cell 'c' in [cell_start[c], cell_start[c+1]), on a
+  // grid from the origin, with those off it in the nearest cell, so as to visit them nearest first
+  std::vector<std::uint32_t> cell_start, cell_circles;
+  double cell_size;
+  int columns, rows;
+
+  double r_max = 0.0; // the largest inflated radius of the circles
+
+  std::uint32_t cell_of(double x, double y) const;
+
+};
+
+} // end namespace sdmp::detail
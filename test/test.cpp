@@ -1,9 +1,28 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
 #include <vector>
 
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+#include <google/protobuf/util/json_util.h>
+
 #include "sdmp.hpp"
+#include "distance_field.hpp"
+#include "obstacle_index.hpp"
+#include "server.hpp"
 
 using namespace std;
 using namespace sdmp;
@@ -15,6 +34,52 @@ namespace {
     return motion_plan;
   }
 
+  // Adds a wall across the middle, with a single gap twice as wide as the droid
+  bool test_add_wall(MotionPlan &motion_plan) {
+    for (double y : {0.0, 0.5, 1.0, 2.0, 2.5, 3.0}) {
+      if (!add_circular_obstacle(motion_plan, 2.0, y, 0.25)) return false;
+    }
+    return true;
+  }
+
+  MotionPlanPtr test_create_wall() {
+    auto motion_plan = test_create();
+    if (motion_plan != nullptr && !test_add_wall(*motion_plan)) return nullptr;
+    return motion_plan;
+  }
+
+  // Brute-force check that the droid, swept along every path segment, clears every obstacle
+  bool test_path_is_clear(const MotionPlan &motion_plan) {
+    const double r_d = motion_plan.bb8().radius();
+    for (int i = 0; i + 1 < motion_plan.path_size(); i++) {
+      const double x0 = motion_plan.path(i).x(), y0 = motion_plan.path(i).y();
+      const double dx = motion_plan.path(i + 1).x() - x0, dy = motion_plan.path(i + 1).y() - y0;
+      const double length2 = dx * dx + dy * dy;
+      for (const auto &obstacle : motion_plan.obstacle()) {
+        const double cx = obstacle.circle().coordinates().x() - x0, cy = obstacle.circle().coordinates().y() - y0;
+        const double t = length2 > 0.0 ? clamp((cx * dx + cy * dy) / length2, 0.0, 1.0) : 0.0;
+        if (hypot(cx - t * dx, cy - t * dy) <= r_d + obstacle.circle().radius()) return false;
+      }
+    }
+    return true;
+  }
+
+  // The clearance of the brute-force scan, as `find_path` computed it before the index
+  double test_clearance(const MotionPlan &motion_plan, double x, double y) {
+    const double r_d = motion_plan.bb8().radius();
+    double clearance = numeric_limits<double>::infinity();
+    clearance = min(clearance, (x - r_d) - 0.0);
+    clearance = min(clearance, (y - r_d) - 0.0);
+    clearance = min(clearance, motion_plan.rectangle().length() - (x + r_d));
+    clearance = min(clearance, motion_plan.rectangle().width() - (y + r_d));
+    for (const auto &obstacle : motion_plan.obstacle()) {
+      const auto &circle = obstacle.circle();
+      const double distance = hypot(x - circle.coordinates().x(), y - circle.coordinates().y());
+      clearance = min(clearance, distance - (r_d + circle.radius()));
+    }
+    return clearance;
+  }
+
 }
 
 // TODO These tests are not really exhaustive (Yet!)
@@ -50,6 +115,119 @@ TEST_CASE("add_circular_obstacle", "[sdmp::add_circular_obstacle]") {
 
 }
 
+TEST_CASE("the obstacle index matches a brute-force scan", "[sdmp::detail::ObstacleIndex]") {
+
+  mt19937 random(3);
+
+  // A dense cluster of small obstacles, a few large ones spanning many cells, and some sparse ones,
+  // so that the rings of cells searched around a query grow, and stop, unevenly
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  uniform_real_distribution<double> cluster(0.5, 1.0), small(0.005, 0.02);
+  for (int i = 0; i < 300; i++) REQUIRE(add_circular_obstacle(*motion_plan, cluster(random), cluster(random), small(random)));
+
+  REQUIRE(add_circular_obstacle(*motion_plan, 3.0, 2.0, 0.75));
+  REQUIRE(add_circular_obstacle(*motion_plan, 1.0, 2.5, 0.5));
+
+  uniform_real_distribution<double> x(0.0, 4.0), y(0.0, 3.0), radius(0.05, 0.2);
+  for (int i = 0; i < 20; i++) REQUIRE(add_circular_obstacle(*motion_plan, x(random), y(random), radius(random)));
+
+  const detail::ObstacleIndex index(*motion_plan);
+
+  // Inside the map, and well outside of the grid, where every ring is empty until the nearest obstacle
+
+  uniform_real_distribution<double> query_x(-3.0, 7.0), query_y(-3.0, 6.0);
+
+  bool same_clearance = true;
+  for (int q = 0; q < 5000; q++) {
+    const double px = q % 2 ? cluster(random) : query_x(random), py = q % 2 ? cluster(random) : query_y(random);
+    same_clearance = same_clearance && index.clearance(px, py) == test_clearance(*motion_plan, px, py);
+  }
+
+  REQUIRE(same_clearance);
+
+  // An empty map is only bounded
+
+  auto empty = test_create();
+  REQUIRE(empty.get() != nullptr);
+  const detail::ObstacleIndex empty_index(*empty);
+  REQUIRE(empty_index.clearance(2.0, 1.5) == test_clearance(*empty, 2.0, 1.5));
+  REQUIRE(empty_index.clearance(-1.0, 1.5) == test_clearance(*empty, -1.0, 1.5));
+
+}
+
+TEST_CASE("the obstacle index kernels, and culling, match a brute-force scan", "[sdmp::detail::ObstacleIndex]") {
+
+  mt19937 random(7);
+
+  // Every count up to a few vector widths, so that each kernel tail is exercised, then larger maps
+  for (const int count : {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 17, 100, 1000}) {
+
+    auto motion_plan = test_create();
+    REQUIRE(motion_plan.get() != nullptr);
+
+    // Some obstacles beyond the bounds, and some inside, or duplicates of, others, so that culling is exercised too
+    uniform_real_distribution<double> x(0.0, 5.0), y(0.0, 4.0), radius(0.01, 0.3);
+    for (int i = 0; i < count; i++) {
+      if (i % 5 == 4) {
+        const auto &other = motion_plan->obstacle(i - 1).circle();
+        const double r = i % 2 ? other.radius() : 0.5 * other.radius();
+        REQUIRE(add_circular_obstacle(*motion_plan, other.coordinates().x(), other.coordinates().y(), r));
+      } else {
+        REQUIRE(add_circular_obstacle(*motion_plan, x(random), y(random), radius(random)));
+      }
+    }
+
+    const detail::ObstacleIndex index(*motion_plan);
+
+    uniform_real_distribution<double> query_x(-0.5, 4.5), query_y(-0.5, 3.5);
+
+    bool same_clearance = true, same_validity = true;
+    for (int q = 0; q < 2000; q++) {
+      const double px = query_x(random), py = query_y(random);
+      const double expected = test_clearance(*motion_plan, px, py);
+      same_clearance = same_clearance && index.clearance(px, py) == expected;
+      // Squared distances may round the other way within a bit of contact
+      if (fabs(expected) > 1e-12) same_validity = same_validity && index.is_valid(px, py) == (expected > 0.0);
+    }
+
+    REQUIRE(same_clearance);
+    REQUIRE(same_validity);
+
+    // A scan of the obstacles, without the index, checks short paths the same way
+    bool same_path_validity = true;
+    for (int q = 0; q < 200; q++) {
+      vector<double> waypoints;
+      for (int w = 0; w < 1 + q % 4; w++) {
+        waypoints.push_back(query_x(random));
+        waypoints.push_back(query_y(random));
+      }
+      same_path_validity = same_path_validity &&
+        detail::ObstacleIndex::is_valid_path(*motion_plan, waypoints) == index.is_valid_path(waypoints);
+    }
+
+    REQUIRE(same_path_validity);
+
+  }
+
+  // Large maps are culled in parallel chunks, on as many threads as asked, with the same result
+
+  auto large = test_create();
+  REQUIRE(large.get() != nullptr);
+  uniform_real_distribution<double> x(0.0, 5.0), y(0.0, 4.0), radius(0.001, 0.1);
+  for (int i = 0; i < 40000; i++) REQUIRE(add_circular_obstacle(*large, x(random), y(random), radius(random)));
+
+  const detail::ObstacleIndex serial(*large, 0.0, 1), parallel(*large, 0.0, 4);
+  REQUIRE(serial.out_of_bounds_count() > 0);
+  REQUIRE(serial.dominated_count() > 0);
+  REQUIRE(serial.out_of_bounds_count() == parallel.out_of_bounds_count());
+  REQUIRE(serial.dominated_count() == parallel.dominated_count());
+  REQUIRE(serial.size() == parallel.size());
+
+}
+
 TEST_CASE("find_path", "[sdmp::bb8::simple::find_path]") {
 
   auto motion_plan = test_create();
@@ -82,4 +260,1330 @@ TEST_CASE("find_path", "[sdmp::bb8::simple::find_path]") {
 
 }
 
+TEST_CASE("find_path through a narrow gap", "[sdmp::bb8::simple::find_path]") {
+
+  // A wall across the middle, with a single gap twice as wide as the droid
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  REQUIRE(bb8::simple::is_valid(*motion_plan));
+
+  const bool failed = sdmp::bb8::simple::find_path(*motion_plan,
+      0.5, 1.5, 3.5, 1.5,
+      3.0, 100.0);
+
+  REQUIRE_FALSE(failed);
+  REQUIRE(motion_plan->path_size() >= 2);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+}
+
+TEST_CASE("find_path with parallel planners", "[sdmp::bb8::simple::find_path]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  REQUIRE(bb8::simple::is_valid(*motion_plan));
+
+  bb8::simple::PlannerOptions options;
+  options.thread_count = 4;
+
+  const bool failed = sdmp::bb8::simple::find_path(*motion_plan,
+      0.5, 1.5, 3.5, 1.5,
+      1.0, 0.0, options);
+
+  REQUIRE_FALSE(failed);
+  REQUIRE(motion_plan->path_size() >= 2);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+}
+
+TEST_CASE("create_planner_session", "[sdmp::bb8::simple::PlannerSession]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  REQUIRE(bb8::simple::is_valid(*motion_plan));
+
+  REQUIRE(bb8::simple::create_planner_session(MotionPlan()) == nullptr);
+
+  auto session = bb8::simple::create_planner_session(*motion_plan);
+  REQUIRE(session != nullptr);
+
+  // Many queries against the same session, reusing the same output path
+
+  for (int i = 0; i < 3; i++) {
+    const bool failed = session->plan(*motion_plan->mutable_path(),
+        0.5, 0.5 + i, 3.5, 2.5 - i,
+        1.0, 100.0);
+    REQUIRE_FALSE(failed);
+    REQUIRE(motion_plan->path_size() >= 2);
+    REQUIRE(test_path_is_clear(*motion_plan));
+  }
+
+  // Invalid arguments fail, and leave an empty path
+  REQUIRE(session->plan(*motion_plan->mutable_path(), 0.5, 0.5, 3.5, 2.5, 0.0) != 0);
+  REQUIRE(motion_plan->path_size() == 0);
+
+}
+
+TEST_CASE("batch_find_path", "[sdmp::bb8::simple::batch_find_path]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+  REQUIRE(bb8::simple::is_valid(*motion_plan));
+
+  vector<PathQuery> queries(6);
+  for (size_t i = 0; i < queries.size(); i++) {
+    queries[i].mutable_init()->set_x(0.5);
+    queries[i].mutable_init()->set_y(0.5 + 0.25 * i);
+    queries[i].mutable_goal()->set_x(3.5);
+    queries[i].mutable_goal()->set_y(2.5);
+    queries[i].set_timeout_seconds(1.0);
+    queries[i].set_length_threshold(100.0);
+  }
+  queries.back().set_timeout_seconds(0.0); // invalid
+
+  size_t callbacks = 0;
+  const auto results = bb8::simple::batch_find_path(*motion_plan, queries, 3,
+    [&callbacks](const PathResult &) { callbacks++; });
+
+  REQUIRE(results.size() == queries.size());
+  REQUIRE(callbacks == queries.size());
+
+  for (size_t i = 0; i < results.size(); i++) {
+    REQUIRE(results[i].index() == i);
+    REQUIRE(!results[i].has_report());
+    if (i + 1 < results.size()) {
+      REQUIRE(results[i].status() == 0);
+      REQUIRE(results[i].path_size() >= 2);
+    } else {
+      REQUIRE(results[i].status() != 0);
+    }
+  }
+
+  // With reports, each result says what the planner did
+
+  const auto reported = bb8::simple::batch_find_path(*motion_plan, queries, 3, nullptr, true);
+  REQUIRE(reported.size() == queries.size());
+
+  for (size_t i = 0; i < reported.size(); i++) {
+    REQUIRE(reported[i].has_report());
+    if (i + 1 < reported.size()) {
+      REQUIRE(reported[i].status() == 0);
+      REQUIRE(reported[i].report().status() == PlannerReport::EXACT_SOLUTION);
+      REQUIRE(reported[i].report().cost() > 0.0);
+    } else {
+      REQUIRE(reported[i].report().status() == PlannerReport::INVALID_ARGUMENTS);
+    }
+  }
+
+}
+
+TEST_CASE("content_hash", "[sdmp::content_hash]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+  REQUIRE(add_circular_obstacle(*motion_plan, 1.0, 1.0, 0.25));
+
+  MotionPlan copy(*motion_plan);
+  REQUIRE(content_hash(copy) == content_hash(*motion_plan));
+
+  // The path is not part of the map
+  auto *coordinates = copy.add_path();
+  coordinates->set_x(0.5);
+  coordinates->set_y(0.5);
+  REQUIRE(content_hash(copy) == content_hash(*motion_plan));
+
+  REQUIRE(add_circular_obstacle(copy, 2.0, 2.0, 0.25));
+  REQUIRE(content_hash(copy) != content_hash(*motion_plan));
+
+}
+
+TEST_CASE("build_roadmap", "[sdmp::bb8::simple::Roadmap]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  REQUIRE(bb8::simple::is_valid(*motion_plan));
+
+  auto roadmap = bb8::simple::build_roadmap(*motion_plan, 0.5);
+  REQUIRE(roadmap != nullptr);
+  REQUIRE(roadmap->milestone_count() > 0);
+  REQUIRE(roadmap->hash() == content_hash(*motion_plan));
+
+  for (int i = 0; i < 3; i++) {
+    const bool failed = roadmap->plan(*motion_plan->mutable_path(), 0.5, 0.5 + i, 3.5, 2.5 - i, 1.0);
+    REQUIRE_FALSE(failed);
+    REQUIRE(test_path_is_clear(*motion_plan));
+  }
+
+  // Save and reload, for the same map only
+
+  stringstream stream;
+  REQUIRE(bb8::simple::save_roadmap(*roadmap, stream));
+
+  const string saved = stream.str();
+
+  stringstream in(saved);
+  auto loaded = bb8::simple::load_roadmap(*motion_plan, in);
+  REQUIRE(loaded != nullptr);
+  REQUIRE(loaded->milestone_count() == roadmap->milestone_count());
+
+  const bool failed = loaded->plan(*motion_plan->mutable_path(), 0.5, 1.5, 3.5, 1.5, 1.0);
+  REQUIRE_FALSE(failed);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+  MotionPlan other(*motion_plan);
+  REQUIRE(add_circular_obstacle(other, 1.0, 1.0, 0.25));
+  stringstream other_in(saved);
+  REQUIRE(bb8::simple::load_roadmap(other, other_in) == nullptr);
+
+}
+
 // TODO Test 'save_json', 'load_json', and 'save_gnuplot' (doing so is more involved)
+
+TEST_CASE("find_path with a distance field", "[sdmp::bb8::simple::find_path]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  REQUIRE(bb8::simple::is_valid(*motion_plan));
+
+  REQUIRE(bb8::simple::distance_field_bytes(*motion_plan, 0.05) > 0);
+  REQUIRE(bb8::simple::distance_field_bytes(*motion_plan, 0.0) == 0);
+
+  bb8::simple::PlannerOptions options;
+  options.field_resolution = -1.0;
+  REQUIRE(bb8::simple::create_planner_session(*motion_plan, options) == nullptr);
+
+  // A coarse field, wider than the gap, must still never admit a colliding path
+  options.field_resolution = 0.25;
+
+  const bool failed = sdmp::bb8::simple::find_path(*motion_plan,
+      0.5, 1.5, 3.5, 1.5,
+      1.0, 100.0, options);
+
+  REQUIRE_FALSE(failed);
+  REQUIRE(motion_plan->path_size() >= 2);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+}
+
+TEST_CASE("clearance fields are shared by map and resolution", "[sdmp::detail::DistanceField]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+  REQUIRE(add_circular_obstacle(*motion_plan, 2.0, 1.5, 0.25));
+
+  const detail::ObstacleIndex obstacles(*motion_plan);
+
+  // Sessions created at once all get the same field, built once
+
+  vector<shared_ptr<const detail::DistanceField>> fields(4);
+  vector<thread> threads;
+  for (auto &field : fields) {
+    threads.emplace_back([&]() { field = detail::DistanceField::get(*motion_plan, obstacles, 0.05); });
+  }
+  for (auto &worker : threads) worker.join();
+
+  REQUIRE(fields.front() != nullptr);
+  for (const auto &field : fields) REQUIRE(field == fields.front());
+
+  // Another map, even of the same size, or another resolution, has a field of its own
+
+  auto moved = test_create();
+  REQUIRE(moved.get() != nullptr);
+  REQUIRE(add_circular_obstacle(*moved, 2.5, 1.5, 0.25));
+
+  const detail::ObstacleIndex moved_obstacles(*moved);
+  const auto moved_field = detail::DistanceField::get(*moved, moved_obstacles, 0.05);
+  REQUIRE(moved_field != nullptr);
+  REQUIRE(moved_field != fields.front());
+
+  double value = 0.0;
+  REQUIRE(moved_field->lookup(2.5, 1.5, value));
+  REQUIRE(value < 0.0);
+
+  const auto coarser = detail::DistanceField::get(*motion_plan, obstacles, 0.1);
+  REQUIRE(coarser != nullptr);
+  REQUIRE(coarser != fields.front());
+
+}
+
+TEST_CASE("find_path with the visibility graph", "[sdmp::bb8::simple::find_path]") {
+
+  bb8::simple::PlannerOptions options;
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::visibility_graph;
+
+  // Around a single obstacle, the shortest path is known in closed form
+
+  auto motion_plan = bb8::simple::create(0.5, 10.0, 10.0);
+  REQUIRE(motion_plan.get() != nullptr);
+  REQUIRE(add_circular_obstacle(*motion_plan, 5.0, 5.0, 0.5));
+
+  bool failed = bb8::simple::find_path(*motion_plan, 2.0, 5.0, 8.0, 5.0, 1.0, 0.0, options);
+
+  REQUIRE_FALSE(failed);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+  double length = 0.0;
+  for (int i = 0; i + 1 < motion_plan->path_size(); i++) {
+    length += hypot(motion_plan->path(i + 1).x() - motion_plan->path(i).x(),
+                    motion_plan->path(i + 1).y() - motion_plan->path(i).y());
+  }
+
+  const double optimum = 2.0 * sqrt(8.0) + (acos(-1.0) - 2.0 * acos(1.0 / 3.0));
+  REQUIRE(length >= optimum);
+  REQUIRE(length <= optimum * 1.001);
+
+  // Through the narrow gap, with the same path every time
+
+  motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  failed = bb8::simple::find_path(*motion_plan, 0.5, 0.5, 3.5, 0.5, 1.0, 0.0, options);
+
+  REQUIRE_FALSE(failed);
+  REQUIRE(motion_plan->path_size() >= 2);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+  const auto path = motion_plan->path();
+
+  failed = bb8::simple::find_path(*motion_plan, 0.5, 0.5, 3.5, 0.5, 1.0, 0.0, options);
+
+  REQUIRE_FALSE(failed);
+  REQUIRE(motion_plan->path_size() == path.size());
+  for (int i = 0; i < path.size(); i++) {
+    REQUIRE(motion_plan->path(i).x() == path.Get(i).x());
+    REQUIRE(motion_plan->path(i).y() == path.Get(i).y());
+  }
+
+  // A closed gap has no path
+
+  REQUIRE(add_circular_obstacle(*motion_plan, 2.0, 1.5, 0.25));
+  failed = bb8::simple::find_path(*motion_plan, 0.5, 0.5, 3.5, 0.5, 1.0, 0.0, options);
+  REQUIRE(failed);
+
+}
+
+TEST_CASE("find_path with a report", "[sdmp::bb8::simple::find_path]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  bb8::simple::PlannerOptions options;
+  options.thread_count = 2;
+
+  PlannerReport report;
+
+  bool failed = bb8::simple::find_path(*motion_plan, 0.5, 0.5, 3.5, 0.5, 0.5, 0.0, options, &report);
+
+  REQUIRE_FALSE(failed);
+  REQUIRE(report.status() == PlannerReport::EXACT_SOLUTION);
+  REQUIRE(report.first_solution_seconds() > 0.0);
+  REQUIRE(report.first_solution_seconds() <= report.planning_seconds());
+  REQUIRE(report.tree_size() > 0);
+  REQUIRE(report.state_checks() > 0);
+  REQUIRE(report.motion_checks() > 0);
+  REQUIRE(report.checking_seconds() > 0.0);
+  REQUIRE(report.convergence_size() > 0);
+  REQUIRE(report.cost() == Approx(report.convergence(report.convergence_size() - 1).cost()));
+  for (int i = 1; i < report.convergence_size(); i++) {
+    REQUIRE(report.convergence(i).seconds() >= report.convergence(i - 1).seconds());
+    REQUIRE(report.convergence(i).cost() < report.convergence(i - 1).cost());
+  }
+
+  // Failures report why
+
+  failed = bb8::simple::find_path(*motion_plan, 0.5, 0.5, 3.5, 0.5, -1.0, 0.0, options, &report);
+  REQUIRE(failed);
+  REQUIRE(report.status() == PlannerReport::INVALID_ARGUMENTS);
+
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::visibility_graph;
+
+  failed = bb8::simple::find_path(*motion_plan, 0.5, 0.5, 3.5, 0.5, 1.0, 0.0, options, &report);
+  REQUIRE_FALSE(failed);
+  REQUIRE(report.status() == PlannerReport::EXACT_SOLUTION);
+  REQUIRE(report.convergence_size() == 1);
+
+  REQUIRE(add_circular_obstacle(*motion_plan, 2.0, 1.5, 0.25));
+  failed = bb8::simple::find_path(*motion_plan, 0.5, 0.5, 3.5, 0.5, 1.0, 0.0, options, &report);
+  REQUIRE(failed);
+  REQUIRE(report.status() == PlannerReport::INFEASIBLE);
+
+}
+
+TEST_CASE("find_path with improved paths, and cancellation", "[sdmp::bb8::simple::find_path]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  // Every improved path goes from the start to the goal, and is shorter than the last
+
+  vector<MotionPlan> improved; // assertions are made on this thread, after planning
+  vector<double> lengths;
+
+  bb8::simple::PlannerOptions options;
+  options.thread_count = 2;
+  options.improved_path_callback = [&](const google::protobuf::RepeatedPtrField<Coordinates> &path, double length) {
+    improved.push_back(*motion_plan);
+    *improved.back().mutable_path() = path;
+    lengths.push_back(length);
+  };
+
+  bool failed = bb8::simple::find_path(*motion_plan, 0.5, 0.5, 3.5, 0.5, 0.5, 0.0, options);
+
+  REQUIRE_FALSE(failed);
+  REQUIRE_FALSE(improved.empty());
+
+  for (size_t i = 0; i < improved.size(); i++) {
+    const auto &path = improved[i].path();
+    REQUIRE(path.size() >= 2);
+    REQUIRE(path.Get(0).x() == 0.5);
+    REQUIRE(path.Get(0).y() == 0.5);
+    REQUIRE(path.Get(path.size() - 1).x() == 3.5);
+    REQUIRE(path.Get(path.size() - 1).y() == 0.5);
+    REQUIRE(test_path_is_clear(improved[i]));
+    if (i > 0) REQUIRE(lengths[i] < lengths[i - 1]);
+  }
+
+  // Cancelling from another thread stops long before the timeout, with the best path so far
+
+  atomic<bool> cancel(false);
+  options.improved_path_callback = nullptr;
+  options.cancel = &cancel;
+
+  const auto started = chrono::steady_clock::now();
+
+  thread canceller([&cancel]() {
+    this_thread::sleep_for(chrono::milliseconds(200));
+    cancel = true;
+  });
+
+  failed = bb8::simple::find_path(*motion_plan, 0.5, 0.5, 3.5, 0.5, 60.0, 0.0, options);
+  canceller.join();
+
+  REQUIRE_FALSE(failed);
+  REQUIRE(test_path_is_clear(*motion_plan));
+  REQUIRE(chrono::steady_clock::now() - started < chrono::seconds(10));
+
+}
+
+TEST_CASE("find_path with each planner", "[sdmp::bb8::simple::find_path]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  REQUIRE(bb8::simple::is_valid(*motion_plan));
+
+  using Algorithm = bb8::simple::PlannerOptions::Algorithm;
+
+  bb8::simple::PlannerOptions options;
+  options.range = -1.0;
+  REQUIRE(bb8::simple::create_planner_session(*motion_plan, options) == nullptr);
+
+  options.range = 0.5;
+
+  for (auto algorithm : {Algorithm::rrt_connect, Algorithm::informed_rrt_star, Algorithm::bit_star, Algorithm::hybrid}) {
+
+    options.algorithm = algorithm;
+
+    PlannerReport report;
+    const bool failed = sdmp::bb8::simple::find_path(*motion_plan,
+        0.5, 1.5, 3.5, 1.5,
+        1.0, 0.0, options, &report);
+
+    REQUIRE_FALSE(failed);
+    REQUIRE(motion_plan->path_size() >= 2);
+    REQUIRE(test_path_is_clear(*motion_plan));
+
+    // Every planner reports its first path, even those that do not optimize
+    REQUIRE(report.status() == PlannerReport::EXACT_SOLUTION);
+    REQUIRE(report.convergence_size() > 0);
+    REQUIRE(report.cost() == Approx(report.convergence(report.convergence_size() - 1).cost()));
+
+  }
+
+}
+
+TEST_CASE("find_path with simplification", "[sdmp::bb8::simple::find_path]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  REQUIRE(bb8::simple::is_valid(*motion_plan));
+
+  bb8::simple::PlannerOptions options;
+  options.simplify_seconds = -1.0;
+  REQUIRE(bb8::simple::create_planner_session(*motion_plan, options) == nullptr);
+
+  // The budget for simplification is taken out of the timeout
+  options.simplify_seconds = 1.0;
+  PlannerReport report;
+  REQUIRE(sdmp::bb8::simple::find_path(*motion_plan, 0.5, 1.5, 3.5, 1.5, 1.0, 0.0, options, &report) == -1);
+  REQUIRE(report.status() == PlannerReport::INVALID_ARGUMENTS);
+
+  // A first path, which is usually far from the shortest, gets shorter, and stays clear
+
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::rrt_connect;
+  options.simplify_seconds = 0.25;
+
+  for (bool smooth_path : {false, true}) {
+
+    options.smooth_path = smooth_path;
+
+    const bool failed = sdmp::bb8::simple::find_path(*motion_plan,
+        0.5, 1.5, 3.5, 1.5,
+        1.0, 0.0, options, &report);
+
+    REQUIRE_FALSE(failed);
+    REQUIRE(motion_plan->path_size() >= 2);
+    REQUIRE(test_path_is_clear(*motion_plan));
+
+    REQUIRE(report.simplification_seconds() > 0.0);
+    REQUIRE(report.planning_seconds() < 2.0);
+    if (report.unsimplified_cost() > 0.0) REQUIRE(report.cost() < report.unsimplified_cost());
+    REQUIRE(report.cost() == Approx(report.convergence(report.convergence_size() - 1).cost()));
+
+  }
+
+}
+
+TEST_CASE("save_binary, load_binary, and delimited streams", "[sdmp::save_binary]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  // Binary round trips, from a string and from a stream
+
+  const string binary = save_binary(*motion_plan);
+  REQUIRE(binary.size() < save_json(*motion_plan).size());
+
+  auto loaded = load_binary(binary);
+  REQUIRE(loaded != nullptr);
+  REQUIRE(content_hash(*loaded) == content_hash(*motion_plan));
+
+  istringstream in(binary);
+  loaded = load_binary(in);
+  REQUIRE(loaded != nullptr);
+  REQUIRE(content_hash(*loaded) == content_hash(*motion_plan));
+
+  REQUIRE(load_binary(string("\xff\xff\xff")) == nullptr);
+
+  // Many plans through one stream, each read into the same plan, which must not accumulate
+
+  stringstream stream;
+  for (int i = 0; i < 3; i++) {
+    REQUIRE(write_delimited(*motion_plan, stream));
+    add_circular_obstacle(*motion_plan, 0.5 + i, 2.5, 0.1);
+  }
+
+  MotionPlanReader reader(stream);
+  MotionPlan read;
+  int count = 0;
+  while (reader.read(read)) {
+    REQUIRE(read.obstacle_size() == 6 + count);
+    count++;
+  }
+
+  REQUIRE(count == 3);
+  REQUIRE_FALSE(reader.failed());
+
+  // A truncated message is a failure, rather than the end of the stream
+
+  stringstream truncated(string("\x10\x0a", 2)); // 16 bytes are announced, but only one follows
+  MotionPlanReader truncated_reader(truncated);
+  REQUIRE_FALSE(truncated_reader.read(read));
+  REQUIRE(truncated_reader.failed());
+
+}
+
+TEST_CASE("create on an arena", "[sdmp::bb8::simple::create]") {
+
+  google::protobuf::Arena arena;
+
+  REQUIRE(bb8::simple::create(arena, -1.0, 4.0, 3.0) == nullptr);
+
+  auto *motion_plan = bb8::simple::create(arena, 0.125, 4.0, 3.0);
+  REQUIRE(motion_plan != nullptr);
+  REQUIRE(motion_plan->GetArena() == &arena);
+  REQUIRE(bb8::simple::is_valid(*motion_plan));
+
+  motion_plan->mutable_obstacle()->Reserve(6);
+  REQUIRE(test_add_wall(*motion_plan));
+
+  // Sub-messages, and the path found, live on the arena of the plan
+
+  REQUIRE(motion_plan->bb8().GetArena() == &arena);
+  REQUIRE(motion_plan->obstacle(0).circle().coordinates().GetArena() == &arena);
+
+  bb8::simple::PlannerOptions options;
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::visibility_graph;
+
+  const bool failed = sdmp::bb8::simple::find_path(*motion_plan,
+      0.5, 1.5, 3.5, 1.5,
+      1.0, 0.0, options);
+
+  REQUIRE_FALSE(failed);
+  REQUIRE(motion_plan->path_size() >= 2);
+  REQUIRE(motion_plan->path(0).GetArena() == &arena);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+  // And so do loaded plans
+
+  const auto *loaded = load_binary(arena, save_binary(*motion_plan));
+  REQUIRE(loaded != nullptr);
+  REQUIRE(loaded->GetArena() == &arena);
+  REQUIRE(content_hash(*loaded) == content_hash(*motion_plan));
+
+  REQUIRE(load_binary(arena, string("\xff\xff\xff")) == nullptr);
+
+}
+
+TEST_CASE("replan after the map changes", "[sdmp::bb8::simple::PlannerSession::replan]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+  REQUIRE(add_circular_obstacle(*motion_plan, 2.0, 0.5, 0.25));
+
+  bb8::simple::PlannerOptions options;
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::rrt_connect;
+
+  auto session = bb8::simple::create_planner_session(*motion_plan, options);
+  REQUIRE(session != nullptr);
+
+  auto &path = *motion_plan->mutable_path();
+  REQUIRE(session->plan(path, 0.5, 1.5, 3.5, 1.5, 1.0) == 0);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+  // Drop an obstacle onto the path, well away from its ends
+
+  double x = 0.0, y = 0.0;
+  for (int i = 0; i + 1 < path.size(); i++) {
+    x = 0.5 * (path.Get(i).x() + path.Get(i + 1).x());
+    y = 0.5 * (path.Get(i).y() + path.Get(i + 1).y());
+    if (hypot(x - 0.5, y - 1.5) > 0.6 && hypot(x - 3.5, y - 1.5) > 0.6) break;
+  }
+
+  const int id = session->add_obstacle(x, y, 0.1);
+  REQUIRE(id == 1); // after the obstacle of the motion plan
+  REQUIRE(add_circular_obstacle(*motion_plan, x, y, 0.1));
+  REQUIRE_FALSE(test_path_is_clear(*motion_plan));
+
+  PlannerReport report;
+  REQUIRE(session->replan(path, 1.0, &report) == 0);
+  REQUIRE(report.status() == PlannerReport::EXACT_SOLUTION);
+  REQUIRE(test_path_is_clear(*motion_plan));
+  REQUIRE(path.Get(0).x() == 0.5);
+  REQUIRE(path.Get(path.size() - 1).x() == 3.5);
+
+  // A path that nothing blocks is returned as is
+
+  const auto repaired = path;
+  REQUIRE(session->move_obstacle(id, 3.9, 0.1) == 0);
+  REQUIRE(session->replan(path, 1.0) == 0);
+  REQUIRE(path.size() == repaired.size());
+
+  REQUIRE(session->remove_obstacle(id) == 0);
+  REQUIRE(session->remove_obstacle(id) == -1);
+  REQUIRE(session->move_obstacle(7, 1.0, 1.0) == -1);
+  REQUIRE(session->add_obstacle(-1.0, 1.0, 0.1) == -1);
+
+  // A blocked goal cannot be repaired
+
+  REQUIRE(session->add_obstacle(3.5, 1.5, 0.1) == 2);
+  REQUIRE(session->replan(path, 1.0, &report) == -2);
+  REQUIRE(report.status() == PlannerReport::INVALID_GOAL);
+  REQUIRE(path.empty());
+  REQUIRE(session->replan(path, 1.0) == -1);
+
+  // Sessions precomputed for the whole map cannot be updated
+
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::visibility_graph;
+  session = bb8::simple::create_planner_session(*motion_plan, options);
+  REQUIRE(session != nullptr);
+  REQUIRE(session->add_obstacle(1.0, 1.0, 0.1) == -1);
+
+}
+
+TEST_CASE("find_path with a warm start", "[sdmp::bb8::simple::find_path]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+  REQUIRE(add_circular_obstacle(*motion_plan, 2.0, 0.5, 0.25));
+
+  bb8::simple::PlannerOptions options;
+  REQUIRE(bb8::simple::find_path(*motion_plan, 0.5, 1.5, 3.5, 1.5, 0.5, 0.0, options) == 0);
+
+  const auto path_length = [&motion_plan]() {
+    double length = 0.0;
+    for (int i = 0; i + 1 < motion_plan->path_size(); i++) {
+      length += hypot(motion_plan->path(i + 1).x() - motion_plan->path(i).x(), motion_plan->path(i + 1).y() - motion_plan->path(i).y());
+    }
+    return length;
+  };
+
+  const double length = path_length();
+
+  // The previous path is the first solution, and is only ever improved upon, by every planner
+
+  using Algorithm = bb8::simple::PlannerOptions::Algorithm;
+
+  options.warm_start = true;
+
+  PlannerReport report;
+
+  for (auto algorithm : {Algorithm::rrt_star, Algorithm::rrt_connect, Algorithm::informed_rrt_star, Algorithm::bit_star, Algorithm::hybrid}) {
+    options.algorithm = algorithm;
+    const double warm_length = path_length();
+    REQUIRE(bb8::simple::find_path(*motion_plan, 0.5, 1.5, 3.5, 1.5, 0.25, 0.0, options, &report) == 0);
+    REQUIRE(report.status() == PlannerReport::EXACT_SOLUTION);
+    REQUIRE(report.convergence_size() > 0);
+    REQUIRE(report.convergence(0).cost() == Approx(warm_length));
+    REQUIRE(report.cost() <= report.convergence(0).cost());
+    REQUIRE(path_length() <= warm_length);
+    REQUIRE(test_path_is_clear(*motion_plan));
+  }
+
+  options.algorithm = Algorithm::rrt_star;
+
+  // A path that satisfies the length threshold is returned at once
+
+  REQUIRE(bb8::simple::find_path(*motion_plan, 0.5, 1.5, 3.5, 1.5, 10.0, 2.0 * length, options, &report) == 0);
+  REQUIRE(report.planning_seconds() < 1.0);
+
+  // A previous path that an obstacle now blocks is repaired, from a new start
+
+  const int middle = motion_plan->path_size() / 2;
+  const double x = motion_plan->path(middle).x(), y = motion_plan->path(middle).y();
+  if (hypot(x - 0.6, y - 1.5) > 0.5 && hypot(x - 3.5, y - 1.5) > 0.5) {
+    REQUIRE(add_circular_obstacle(*motion_plan, x, y, 0.1));
+  }
+
+  REQUIRE(bb8::simple::find_path(*motion_plan, 0.6, 1.5, 3.5, 1.5, 0.25, 0.0, options, &report) == 0);
+  REQUIRE(report.status() == PlannerReport::EXACT_SOLUTION);
+  REQUIRE(test_path_is_clear(*motion_plan));
+  REQUIRE(motion_plan->path(0).x() == 0.6);
+
+}
+
+TEST_CASE("verify_path", "[sdmp::bb8::simple::verify_path]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+  REQUIRE(add_circular_obstacle(*motion_plan, 2.0, 1.5, 0.25));
+
+  PathVerification verification;
+
+  // An empty path is not a valid one
+
+  REQUIRE(!bb8::simple::verify_path(*motion_plan, &verification));
+  REQUIRE(verification.first_violation() == -1);
+
+  // Around the obstacle, the clearance is smallest on the segment closest to it
+
+  const auto add_waypoint = [&motion_plan](double x, double y) {
+    auto coordinates = motion_plan->add_path();
+    coordinates->set_x(x);
+    coordinates->set_y(y);
+  };
+
+  add_waypoint(0.5, 1.5);
+  add_waypoint(1.0, 1.0);
+  add_waypoint(3.0, 1.0);
+  add_waypoint(3.5, 1.5);
+
+  REQUIRE(bb8::simple::verify_path(*motion_plan, &verification));
+  REQUIRE(verification.valid());
+  REQUIRE(verification.first_violation() == -1);
+  REQUIRE(verification.min_clearance() == Approx(0.125));
+  REQUIRE(verification.min_clearance_segment() == 1);
+  REQUIRE(bb8::simple::verify_path(*motion_plan));
+
+  // A segment through the obstacle, though both its ends are clear, is the first violation
+
+  add_waypoint(0.5, 1.5);
+
+  REQUIRE(!bb8::simple::verify_path(*motion_plan, &verification));
+  REQUIRE(!verification.valid());
+  REQUIRE(verification.first_violation() == 3);
+  REQUIRE(verification.min_clearance() == Approx(-0.375));
+  REQUIRE(verification.min_clearance_segment() == 3);
+  REQUIRE(!bb8::simple::verify_path(*motion_plan));
+
+  // A single waypoint is checked where it is
+
+  motion_plan->clear_path();
+  add_waypoint(2.0, 1.5);
+  REQUIRE(!bb8::simple::verify_path(*motion_plan, &verification));
+  REQUIRE(verification.first_violation() == 0);
+
+  // A long path, checked on many threads, agrees with the brute-force check
+
+  motion_plan->clear_path();
+  for (int i = 0; i < 10000; i++) add_waypoint(0.5 + 3.0 * (i % 2), 0.5 + 2.0 * i / 10000.0);
+  const bool clear = test_path_is_clear(*motion_plan);
+  REQUIRE(bb8::simple::verify_path(*motion_plan, &verification, 4) == clear);
+  REQUIRE(bb8::simple::verify_path(*motion_plan, nullptr, 4) == clear);
+
+}
+
+TEST_CASE("save_gnuplot and save_svg to a sink", "[sdmp::bb8::simple::save_svg]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+  for (int i = 0; i < 1000; i++) REQUIRE(add_circular_obstacle(*motion_plan, 0.5 + 3.0 * (i % 100) / 100.0, 0.5 + 2.0 * (i / 100) / 10.0, 0.01));
+
+  const auto count = [](const string &text, const string &what) {
+    size_t n = 0;
+    for (size_t at = text.find(what); at != string::npos; at = text.find(what, at + 1)) n++;
+    return n;
+  };
+
+  // Streamed, the commands are the same as those saved to a string
+
+  ostringstream gnuplot;
+  REQUIRE(bb8::simple::save_gnuplot(*motion_plan, gnuplot));
+  REQUIRE(gnuplot.str() == bb8::simple::save_gnuplot(*motion_plan));
+  REQUIRE(count(gnuplot.str(), "set object") == 1000);
+
+  ostringstream svg;
+  REQUIRE(bb8::simple::save_svg(*motion_plan, svg));
+  REQUIRE(svg.str().rfind("<?xml", 0) == 0);
+  REQUIRE(svg.str().find("</svg>") != string::npos);
+  REQUIRE(count(svg.str(), "<circle") == 1000);
+
+  // A viewport culls everything outside it
+
+  const bb8::simple::Viewport viewport{0.4, 0.4, 0.995, 1.0};
+
+  svg.str("");
+  REQUIRE(bb8::simple::save_svg(*motion_plan, svg, &viewport));
+  REQUIRE(count(svg.str(), "<circle") == 17 * 3);
+
+  // An empty, or not finite, viewport is refused, and nothing is written
+
+  const double nan = numeric_limits<double>::quiet_NaN(), inf = numeric_limits<double>::infinity();
+  for (const bb8::simple::Viewport &refused : {bb8::simple::Viewport{nan, 0.4, 0.995, 1.0},
+                                               bb8::simple::Viewport{0.4, 0.4, inf, 1.0},
+                                               bb8::simple::Viewport{0.4, 0.4, 0.4, 1.0},
+                                               bb8::simple::Viewport{0.4, 1.0, 0.995, 0.4}}) {
+    svg.str("");
+    gnuplot.str("");
+    REQUIRE(!bb8::simple::save_svg(*motion_plan, svg, &refused));
+    REQUIRE(!bb8::simple::save_gnuplot(*motion_plan, gnuplot, &refused));
+    REQUIRE(svg.str().empty());
+    REQUIRE(gnuplot.str().empty());
+  }
+
+  // The sink may stop the export
+
+  size_t chunks = 0;
+  REQUIRE(!bb8::simple::save_svg(*motion_plan, bb8::simple::ExportSink([&chunks](const char *, size_t) {
+    chunks++;
+    return false;
+  })));
+  REQUIRE(chunks == 1);
+
+}
+
+TEST_CASE("save_flat_map, open_flat_map, and planning in a flat map", "[sdmp::bb8::simple::open_flat_map]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+  for (int i = 0; i < 100; i++) REQUIRE(add_circular_obstacle(*motion_plan, 0.5 + 0.03 * i, 0.25 + 0.025 * (i % 7), 0.01 + 0.001 * i));
+
+  const string filename = (filesystem::temp_directory_path() / "sdmp-test.flat").string();
+
+  {
+    ofstream file(filename, ios::binary);
+    REQUIRE(bb8::simple::save_flat_map(*motion_plan, file));
+  }
+
+  const auto map = bb8::simple::open_flat_map(filename);
+  REQUIRE(map != nullptr);
+  REQUIRE(map->obstacle_count() == 100);
+  REQUIRE(map->content_hash() == content_hash(*motion_plan));
+
+  // Back to the same motion plan, with its obstacles in their order
+
+  const auto converted = bb8::simple::to_motion_plan(*map);
+  REQUIRE(converted != nullptr);
+  REQUIRE(save_binary(*converted) == save_binary(*motion_plan));
+
+  // Planning, and verifying, in the map, as in the motion plan
+
+  bb8::simple::PlannerOptions options;
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::rrt_connect;
+
+  auto session = bb8::simple::create_planner_session(*map, options);
+  REQUIRE(session != nullptr);
+
+  auto &path = *motion_plan->mutable_path();
+  REQUIRE(session->plan(path, 0.25, 1.5, 3.75, 1.5, 1.0) == 0);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+  PathVerification verification;
+  REQUIRE(bb8::simple::verify_path(*map, path, &verification));
+  REQUIRE(bb8::simple::verify_path(*motion_plan, &verification));
+
+  // Exported, with and without a viewport, as the motion plan is
+
+  const bb8::simple::Viewport viewport{1.0, 0.0, 2.0, 3.0};
+
+  for (const auto *window : {(const bb8::simple::Viewport *) nullptr, &viewport}) {
+    ostringstream from_map, from_motion_plan;
+    REQUIRE(bb8::simple::save_svg(*map, path, from_map, window));
+    REQUIRE(bb8::simple::save_svg(*motion_plan, from_motion_plan, window));
+    REQUIRE(from_map.str().size() == from_motion_plan.str().size());
+  }
+
+  // Sessions of a flat map have no motion plan to build a visibility graph from
+
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::visibility_graph;
+  REQUIRE(bb8::simple::create_planner_session(*map, options) == nullptr);
+
+  // A truncated file is not opened
+
+  const string truncated_filename = filename + ".truncated";
+
+  {
+    ifstream file(filename, ios::binary);
+    const string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    ofstream truncated(truncated_filename, ios::binary);
+    truncated.write(contents.data(), streamsize(contents.size() - 1));
+  }
+
+  REQUIRE(bb8::simple::open_flat_map(truncated_filename) == nullptr);
+
+  // Nor is one whose header claims a grid, or an obstacle count, that could not have been saved
+
+  const string tampered_filename = filename + ".tampered";
+
+  const auto tampered = [&](const auto &tamper) {
+    ifstream file(filename, ios::binary);
+    string contents((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    detail::FlatMapHeader header;
+    memcpy(&header, contents.data(), sizeof(header));
+    tamper(header);
+    memcpy(&contents[0], &header, sizeof(header));
+    ofstream rewritten(tampered_filename, ios::binary);
+    rewritten.write(contents.data(), streamsize(contents.size()));
+    rewritten.close();
+    return bb8::simple::open_flat_map(tampered_filename);
+  };
+
+  REQUIRE(tampered([](detail::FlatMapHeader &) {}) != nullptr);
+  REQUIRE(tampered([](detail::FlatMapHeader &header) { header.columns = header.rows = 0x80000000u; }) == nullptr);
+  REQUIRE(tampered([](detail::FlatMapHeader &header) { header.columns *= 1000; }) == nullptr);
+  REQUIRE(tampered([](detail::FlatMapHeader &header) { header.obstacle_count = uint64_t(1) << 31; }) == nullptr);
+  REQUIRE(tampered([](detail::FlatMapHeader &header) { header.obstacle_count = ~uint64_t(0) / 8; }) == nullptr);
+
+  // An empty map has a grid too, which is checked, and exported, as any other
+
+  {
+    const auto empty = test_create();
+    ofstream file(filename, ios::binary);
+    REQUIRE(bb8::simple::save_flat_map(*empty, file));
+  }
+
+  REQUIRE(tampered([](detail::FlatMapHeader &header) { header.columns = 0; }) == nullptr);
+  REQUIRE(tampered([](detail::FlatMapHeader &header) { header.cell_size = numeric_limits<double>::quiet_NaN(); }) == nullptr);
+
+  const auto empty_map = bb8::simple::open_flat_map(filename);
+  REQUIRE(empty_map != nullptr);
+  REQUIRE(empty_map->obstacle_count() == 0);
+
+  ostringstream empty_svg;
+  REQUIRE(bb8::simple::save_svg(*empty_map, path, empty_svg, &viewport));
+
+  filesystem::remove(filename);
+  filesystem::remove(truncated_filename);
+  filesystem::remove(tampered_filename);
+
+}
+
+TEST_CASE("obstacles that cannot matter are culled, once per map", "[sdmp::bb8::simple::PlannerSession]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+  REQUIRE(add_circular_obstacle(*motion_plan, 2.0, 1.5, 0.5));
+  REQUIRE(add_circular_obstacle(*motion_plan, 2.1, 1.5, 0.2));  // inside the first
+  REQUIRE(add_circular_obstacle(*motion_plan, 2.0, 1.5, 0.5));  // a duplicate of it
+  REQUIRE(add_circular_obstacle(*motion_plan, 4.5, 1.0, 0.25)); // beyond the bounds
+
+  bb8::simple::PlannerOptions options;
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::rrt_connect;
+
+  auto session = bb8::simple::create_planner_session(*motion_plan, options);
+  REQUIRE(session != nullptr);
+
+  auto &path = *motion_plan->mutable_path();
+  PlannerReport report;
+
+  REQUIRE(session->plan(path, 0.5, 1.5, 3.5, 1.5, 1.0, 0.0, &report) == 0);
+  REQUIRE(report.out_of_bounds_obstacles() == 1);
+  REQUIRE(report.dominated_obstacles() == 2);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+  // Those inside an obstacle are checked again once it is gone
+
+  REQUIRE(session->remove_obstacle(0) == 0);
+  REQUIRE(session->plan(path, 0.5, 1.5, 3.5, 1.5, 1.0, 0.0, &report) == 0);
+  REQUIRE(report.out_of_bounds_obstacles() == 1);
+  REQUIRE(report.dominated_obstacles() == 0);
+  REQUIRE(test_path_is_clear(*motion_plan)); // the duplicate is where the first was
+
+}
+
+TEST_CASE("find_path with a path cache", "[sdmp::bb8::simple::PathCache]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+  REQUIRE(add_circular_obstacle(*motion_plan, 2.0, 1.5, 0.5));
+
+  const auto cache = bb8::simple::create_path_cache();
+  REQUIRE(cache != nullptr);
+
+  bb8::simple::PlannerOptions options;
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::rrt_connect;
+  options.path_cache = cache.get();
+
+  PlannerReport report;
+
+  REQUIRE(bb8::simple::find_path(*motion_plan, 0.5, 1.5, 3.5, 1.5, 1.0, 0.0, options, &report) == 0);
+  REQUIRE_FALSE(report.cached());
+  REQUIRE(cache->misses() == 1);
+  REQUIRE(cache->size() == 1);
+
+  const auto planned = motion_plan->path();
+
+  // The same query, or one within the quantum of it, is answered from the cache, ending exactly where asked
+
+  REQUIRE(bb8::simple::find_path(*motion_plan, 0.5, 1.5, 3.5, 1.5, 1.0, 0.0, options, &report) == 0);
+  REQUIRE(report.cached());
+  REQUIRE(report.status() == PlannerReport::EXACT_SOLUTION);
+  REQUIRE(cache->hits() == 1);
+  REQUIRE(motion_plan->path_size() == planned.size());
+
+  REQUIRE(bb8::simple::find_path(*motion_plan, 0.5001, 1.5, 3.5, 1.5, 1.0, 0.0, options, &report) == 0);
+  REQUIRE(report.cached());
+  REQUIRE(motion_plan->path(0).x() == 0.5001);
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+  // Sessions share the cache, and stop using it once their map changes
+
+  auto session = bb8::simple::create_planner_session(*motion_plan, options);
+  REQUIRE(session != nullptr);
+
+  auto &path = *motion_plan->mutable_path();
+  REQUIRE(session->plan(path, 0.5, 1.5, 3.5, 1.5, 1.0, 0.0, &report) == 0);
+  REQUIRE(report.cached());
+
+  REQUIRE(session->add_obstacle(1.0, 2.75, 0.1) == 1);
+  REQUIRE(session->plan(path, 0.5, 1.5, 3.5, 1.5, 1.0, 0.0, &report) == 0);
+  REQUIRE_FALSE(report.cached());
+
+  // So do other maps
+
+  REQUIRE(add_circular_obstacle(*motion_plan, 1.0, 2.75, 0.1));
+  REQUIRE(bb8::simple::find_path(*motion_plan, 0.5, 1.5, 3.5, 1.5, 1.0, 0.0, options, &report) == 0);
+  REQUIRE_FALSE(report.cached());
+  REQUIRE(cache->size() == 2);
+
+  // Saved and loaded, most recently used last
+
+  stringstream saved;
+  REQUIRE(bb8::simple::save_path_cache(*cache, saved));
+
+  const auto loaded = bb8::simple::load_path_cache(saved);
+  REQUIRE(loaded != nullptr);
+  REQUIRE(loaded->size() == 2);
+  REQUIRE(loaded->memory_bytes() == cache->memory_bytes());
+  REQUIRE(loaded->find(*motion_plan, 0.5, 1.5, 3.5, 1.5, path));
+
+  // Or with the hash of the map, computed once
+
+  const uint64_t map_hash = content_hash(*motion_plan);
+  REQUIRE(loaded->find(*motion_plan, map_hash, 0.5, 1.5, 3.5, 1.5, path));
+  REQUIRE_FALSE(loaded->find(*motion_plan, map_hash + 1, 0.5, 1.5, 3.5, 1.5, path));
+  REQUIRE(loaded->insert(map_hash + 1, 0.5, 1.5, 3.5, 1.5, path));
+  REQUIRE(loaded->find(*motion_plan, map_hash + 1, 0.5, 1.5, 3.5, 1.5, path));
+
+  const auto truncated = saved.str().substr(0, saved.str().size() - 1);
+  stringstream truncated_stream(truncated);
+  REQUIRE(bb8::simple::load_path_cache(truncated_stream) == nullptr);
+
+  // A cache too small for any path keeps none
+
+  const auto tiny = bb8::simple::create_path_cache(1);
+  REQUIRE(tiny != nullptr);
+  REQUIRE_FALSE(tiny->insert(*motion_plan, 0.5, 1.5, 3.5, 1.5, motion_plan->path()));
+  REQUIRE(tiny->size() == 0);
+
+  REQUIRE(bb8::simple::create_path_cache(1024, 0.0) == nullptr);
+
+}
+
+TEST_CASE("find_fleet_paths", "[sdmp::bb8::simple::find_fleet_paths]") {
+
+  auto motion_plan = test_create();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  // Two droids cross, and a third, faster, crosses both, diagonally
+
+  const auto droid = [](double x_init, double y_init, double x_goal, double y_goal, double radius, double speed) {
+    FleetDroid droid;
+    droid.mutable_init()->set_x(x_init);
+    droid.mutable_init()->set_y(y_init);
+    droid.mutable_goal()->set_x(x_goal);
+    droid.mutable_goal()->set_y(y_goal);
+    droid.set_radius(radius);
+    droid.set_speed(speed);
+    return droid;
+  };
+
+  const vector<FleetDroid> fleet = {
+    droid(0.5, 1.5, 3.5, 1.5, 0.2, 0.0),
+    droid(2.0, 0.4, 2.0, 2.6, 0.2, 1.0),
+    droid(3.5, 0.4, 0.5, 2.6, 0.15, 2.0),
+    droid(1.0, 1.0, 3.0, 2.0, -1.0, 1.0), // not a droid
+  };
+
+  bb8::simple::PlannerOptions options;
+  options.algorithm = bb8::simple::PlannerOptions::Algorithm::rrt_connect;
+
+  const auto results = bb8::simple::find_fleet_paths(*motion_plan, fleet, 2.0, 0.0, options, 2);
+  REQUIRE(results.size() == fleet.size());
+  REQUIRE(results[3].status() == -1);
+
+  // Where a droid is at a time, waiting at its first waypoint before, and staying at its last after
+  const auto position = [](const FleetResult &result, double t) {
+    const auto &path = result.path();
+    for (int i = 0; i + 1 < path.size(); i++) {
+      const auto &from = path.Get(i), &to = path.Get(i + 1);
+      if (t > to.seconds()) continue;
+      const double s = to.seconds() > from.seconds() ? max(0.0, (t - from.seconds()) / (to.seconds() - from.seconds())) : 1.0;
+      return make_pair(from.x() + s * (to.x() - from.x()), from.y() + s * (to.y() - from.y()));
+    }
+    return make_pair(path.Get(path.size() - 1).x(), path.Get(path.size() - 1).y());
+  };
+
+  double end = 0.0;
+  for (int i = 0; i < 3; i++) {
+    const auto &result = results[size_t(i)];
+    REQUIRE(result.index() == uint32_t(i));
+    REQUIRE(result.status() == 0);
+    REQUIRE(result.path_size() >= 2);
+    REQUIRE(result.path(0).x() == fleet[size_t(i)].init().x());
+    REQUIRE(result.path(result.path_size() - 1).y() == fleet[size_t(i)].goal().y());
+    for (int w = 0; w + 1 < result.path_size(); w++) REQUIRE(result.path(w).seconds() <= result.path(w + 1).seconds());
+    end = max(end, result.path(result.path_size() - 1).seconds());
+  }
+
+  // The discs of the droids never touch, at any time
+
+  bool apart = true;
+  for (double t = 0.0; t <= end + 0.1; t += 1e-3) {
+    for (size_t i = 0; i < 3; i++) {
+      for (size_t j = i + 1; j < 3; j++) {
+        const auto a = position(results[i], t), b = position(results[j], t);
+        apart = apart && hypot(a.first - b.first, a.second - b.second) > fleet[i].radius() + fleet[j].radius();
+      }
+    }
+  }
+  REQUIRE(apart);
+
+  // Droids plan in their own maps, with the other droids in them, which a path cache must not keep,
+  // even with the visibility graph, which plans in a copy of the motion plan, with the droids added
+
+  const auto cache = bb8::simple::create_path_cache();
+  REQUIRE(cache != nullptr);
+  options.path_cache = cache.get();
+
+  for (const auto algorithm : {bb8::simple::PlannerOptions::Algorithm::rrt_connect,
+                               bb8::simple::PlannerOptions::Algorithm::visibility_graph}) {
+    options.algorithm = algorithm;
+    const auto cached = bb8::simple::find_fleet_paths(*motion_plan, fleet, 2.0, 0.0, options, 2);
+    REQUIRE(cached.size() == fleet.size());
+    for (size_t i = 0; i < 3; i++) REQUIRE(cached[i].status() == 0);
+  }
+
+  REQUIRE(cache->size() == 0);
+  REQUIRE(cache->hits() + cache->misses() == 0);
+
+  REQUIRE(bb8::simple::find_fleet_paths(*motion_plan, fleet, 0.0, 0.0).empty());
+
+}
+
+TEST_CASE("serve JSON lines", "[sdmp::application::serve]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(content_hash(*motion_plan)));
+
+  // A long query, that the others overtake, then the map by name, and by hash, a malformed line,
+  // and the map forgotten, by name, after which neither its name nor its hash are known
+
+  vector<ServeRequest> requests(7);
+  for (size_t i = 0; i < requests.size(); i++) requests[i].set_id(i + 1);
+
+  requests[0].set_map_id("wall");
+  *requests[0].mutable_motion_plan() = *motion_plan;
+  requests[0].set_algorithm("rrt_star");
+  requests[0].mutable_query()->mutable_init()->set_x(0.5);
+  requests[0].mutable_query()->mutable_init()->set_y(1.5);
+  requests[0].mutable_query()->mutable_goal()->set_x(3.5);
+  requests[0].mutable_query()->mutable_goal()->set_y(1.5);
+  requests[0].mutable_query()->set_timeout_seconds(0.5);
+
+  requests[1].set_map_id("wall");
+  requests[1].set_command(ServeRequest::GNUPLOT);
+
+  requests[2].set_map_id(hash);
+  requests[2].set_algorithm("rrt_connect");
+  *requests[2].mutable_query() = requests[0].query();
+  requests[2].mutable_query()->set_length_threshold(numeric_limits<double>::max());
+
+  requests[3].set_map_id("wall");
+  requests[3].set_command(ServeRequest::FORGET);
+
+  requests[4].set_map_id("wall");
+  requests[4].set_command(ServeRequest::GNUPLOT);
+
+  requests[5].set_map_id(hash);
+  requests[5].set_command(ServeRequest::GNUPLOT);
+
+  requests[6].set_map_id(hash);
+  requests[6].set_command(ServeRequest::FORGET);
+
+  string input;
+  for (size_t i = 0; i < requests.size(); i++) {
+    string json;
+    REQUIRE(google::protobuf::util::MessageToJsonString(requests[i], &json).ok());
+    input += json + '\n';
+    if (i == 2) input += "not json\n\n";
+  }
+
+  istringstream in(input);
+  ostringstream out;
+  REQUIRE(application::serve(in, out, application::Framing::json_lines, 2) == 0);
+
+  vector<ServeResponse> responses;
+  istringstream lines(out.str());
+  for (string line; getline(lines, line);) {
+    responses.emplace_back();
+    REQUIRE(google::protobuf::util::JsonStringToMessage(line, &responses.back()).ok());
+  }
+
+  // One response per request, and one for the malformed line, matched by id, since they come out of order
+
+  REQUIRE(responses.size() == requests.size() + 1);
+  REQUIRE(responses.back().id() == 1);
+
+  map<uint64_t, ServeResponse> by_id;
+  for (const auto &response : responses) REQUIRE(by_id.emplace(response.id(), response).second);
+
+  REQUIRE(by_id[0].status() == -1);
+  REQUIRE(!by_id[0].error().empty());
+
+  REQUIRE(by_id[2].status() == 0);
+  REQUIRE(by_id[2].map_hash() == hash);
+  REQUIRE(by_id[2].gnuplot() == bb8::simple::save_gnuplot(*motion_plan));
+
+  for (uint64_t id : {1, 3}) {
+    REQUIRE(by_id[id].status() == 0);
+    REQUIRE(by_id[id].map_hash() == hash);
+    REQUIRE(by_id[id].path_size() >= 2);
+    *motion_plan->mutable_path() = by_id[id].path();
+    REQUIRE(test_path_is_clear(*motion_plan));
+  }
+
+  REQUIRE(by_id[4].status() == 0);
+  for (uint64_t id : {5, 6, 7}) REQUIRE(by_id[id].status() == -3);
+
+}
+
+TEST_CASE("serve delimited messages", "[sdmp::application::serve]") {
+
+  auto motion_plan = test_create_wall();
+  REQUIRE(motion_plan.get() != nullptr);
+
+  // The map by hash only, a bad request, the map forgotten, and a truncated message, which ends the input
+
+  vector<ServeRequest> requests(6);
+  for (size_t i = 0; i < requests.size(); i++) requests[i].set_id(i + 1);
+
+  *requests[0].mutable_motion_plan() = *motion_plan;
+  requests[0].set_command(ServeRequest::GNUPLOT);
+
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(content_hash(*motion_plan)));
+
+  requests[1].set_map_id(hash);
+  requests[1].set_algorithm("rrt_connect");
+  requests[1].mutable_query()->mutable_init()->set_x(0.5);
+  requests[1].mutable_query()->mutable_init()->set_y(1.5);
+  requests[1].mutable_query()->mutable_goal()->set_x(3.5);
+  requests[1].mutable_query()->mutable_goal()->set_y(1.5);
+  requests[1].mutable_query()->set_timeout_seconds(1.0);
+  requests[1].mutable_query()->set_length_threshold(numeric_limits<double>::max());
+
+  requests[2] = requests[1];
+  requests[2].set_id(3);
+  requests[2].set_algorithm("bogus");
+
+  requests[3].set_map_id(hash);
+  requests[3].set_command(ServeRequest::FORGET);
+
+  requests[4] = requests[1];
+  requests[4].set_id(5);
+
+  requests[5].set_map_id(hash);
+  requests[5].set_command(ServeRequest::GNUPLOT);
+
+  ostringstream input;
+  for (size_t i = 0; i < requests.size(); i++) {
+    REQUIRE(google::protobuf::util::SerializeDelimitedToOstream(requests[i], &input));
+    if (i == 4) input << "\xe8\x07truncated"; // a size of 1000 bytes, far more than are left
+  }
+
+  istringstream in(input.str());
+  ostringstream out;
+  REQUIRE(application::serve(in, out, application::Framing::delimited, 2) == -1);
+
+  map<uint64_t, ServeResponse> by_id;
+  istringstream responses(out.str());
+  google::protobuf::io::IstreamInputStream stream(&responses);
+  for (;;) {
+    ServeResponse response; // which parsing merges into, rather than replaces
+    if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(&response, &stream, nullptr)) break;
+    REQUIRE(by_id.emplace(response.id(), response).second);
+  }
+
+  // Nothing after the truncated message is answered
+
+  REQUIRE(by_id.size() == 6);
+  REQUIRE(by_id.count(6) == 0);
+
+  REQUIRE(by_id[0].status() == -1);
+  REQUIRE(!by_id[0].error().empty());
+
+  REQUIRE(by_id[1].status() == 0);
+  REQUIRE(by_id[1].map_hash() == hash);
+  REQUIRE(by_id[1].gnuplot() == bb8::simple::save_gnuplot(*motion_plan));
+
+  REQUIRE(by_id[2].status() == 0);
+  REQUIRE(by_id[2].map_hash() == hash);
+  *motion_plan->mutable_path() = by_id[2].path();
+  REQUIRE(test_path_is_clear(*motion_plan));
+
+  REQUIRE(by_id[3].status() == -1);
+  REQUIRE(by_id[4].status() == 0);
+  REQUIRE(by_id[5].status() == -3);
+
+}